@@ -0,0 +1,172 @@
+/*
+ * Copyright (c) 2014 Institute of Geological & Nuclear Sciences Ltd.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *		notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *		notice, this list of conditions and the following disclaimer in the
+ *		documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+/* system includes */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fnmatch.h>
+
+#include <libmseed.h>
+#include <libcrex.h>
+
+#include "config.h"
+
+/* apply one key=value setting to a rule */
+static int config_setting(config_rule_t *rule, char *key, char *value, int *tides, int *filters) {
+	char *label, *amp, *lag, *name;
+
+	if (strcmp(key, "tag") == 0) {
+		strncpy(rule->tag, value, sizeof(rule->tag) - 1);
+	}
+	else if (strcmp(key, "alpha") == 0) {
+		rule->alpha = atof(value);
+	}
+	else if (strcmp(key, "beta") == 0) {
+		rule->beta = atof(value);
+	}
+	else if (strcmp(key, "latitude") == 0) {
+		rule->tidal.latitude = atof(value);
+	}
+	else if (strcmp(key, "zone") == 0) {
+		rule->tidal.zone = atof(value);
+	}
+	else if (strcmp(key, "filter") == 0) {
+		/* the first filter setting replaces the defaults */
+		if ((*filters)++ == 0)
+			rule->nfirs = 0;
+		for (name = strtok(value, ","); name != NULL; name = strtok(NULL, ",")) {
+			if (rule->nfirs >= FIR_MAX_FILTERS)
+				return -1;
+			strncpy(rule->firnames[rule->nfirs++], name, CONFIG_FILTER - 1);
+		}
+	}
+	else if (strcmp(key, "tide") == 0) {
+		/* as are the default constituents */
+		if ((*tides)++ == 0)
+			rule->tidal.num_tides = 0;
+		if (((label = strtok(value, "/")) == NULL) || ((amp = strtok(NULL, "/")) == NULL) || ((lag = strtok(NULL, "/")) == NULL))
+			return -1;
+		if (rule->tidal.num_tides >= LIBTIDAL_MAX_CONSTITUENTS)
+			return -1;
+		memset(rule->tidal.tides[rule->tidal.num_tides].name, 0, LIBTIDAL_CHARLEN);
+		strncpy(rule->tidal.tides[rule->tidal.num_tides].name, label, LIBTIDAL_CHARLEN - 1);
+		rule->tidal.tides[rule->tidal.num_tides].amplitude = atof(amp);
+		rule->tidal.tides[rule->tidal.num_tides].lag = atof(lag) / 360.0;
+		rule->tidal.num_tides++;
+	}
+	else {
+		return -1;
+	}
+
+	return 0;
+}
+
+int config_load(config_t *config, const char *file, const config_rule_t *defaults) {
+	config_rule_t *rules = NULL, *rule;
+	char line[4096], *token, *value, *save = NULL;
+	int nrules = 0, lineno = 0;
+	int tides, filters;
+	FILE *fp;
+
+	if ((fp = fopen(file, "r")) == NULL) {
+		ms_log (2, "unable to open config file [%s]\n", file); return -1;
+	}
+
+	while (fgets(line, sizeof(line), fp) != NULL) {
+		lineno++;
+		if ((token = strchr(line, '#')) != NULL)
+			*token = '\0';
+		if ((token = strtok_r(line, " \t\r\n", &save)) == NULL)
+			continue;
+
+		if ((rule = (config_rule_t *) realloc(rules, (nrules + 1) * sizeof(config_rule_t))) == NULL) {
+			ms_log (2, "memory error!\n"); free((char *) rules); fclose(fp); return -1;
+		}
+		rules = rule;
+		rule = &rules[nrules++];
+
+		memcpy(rule, defaults, sizeof(config_rule_t));
+		memset(rule->pattern, 0, CONFIG_PATTERN);
+		strncpy(rule->pattern, token, CONFIG_PATTERN - 1);
+
+		tides = filters = 0;
+		while ((token = strtok_r(NULL, " \t\r\n", &save)) != NULL) {
+			if ((value = strchr(token, '=')) == NULL) {
+				ms_log (2, "%s:%d: expected key=value [%s]\n", file, lineno, token); free((char *) rules); fclose(fp); return -1;
+			}
+			*value++ = '\0';
+			if (config_setting(rule, token, value, &tides, &filters) < 0) {
+				ms_log (2, "%s:%d: invalid setting [%s]\n", file, lineno, token); free((char *) rules); fclose(fp); return -1;
+			}
+		}
+	}
+	fclose(fp);
+
+	config->rules = rules;
+	config->nrules = nrules;
+
+	return 0;
+}
+
+void config_free(config_t *config) {
+	free((char *) config->rules);
+	config->rules = NULL;
+	config->nrules = 0;
+}
+
+/* the settings for a stream, the defaults if nothing matches */
+const config_rule_t *config_match(const config_t *config, const char *srcname, const config_rule_t *defaults) {
+	int n;
+
+	for (n = 0; n < config->nrules; n++) {
+		if (fnmatch(config->rules[n].pattern, srcname, 0) == 0)
+			return &config->rules[n];
+	}
+
+	return defaults;
+}
+
+/* do two rules give a stream the same settings */
+int config_equal(const config_rule_t *a, const config_rule_t *b) {
+	int n;
+
+	if ((strcmp(a->tag, b->tag) != 0) || (a->alpha != b->alpha) || (a->beta != b->beta) || (a->nfirs != b->nfirs))
+		return 0;
+	for (n = 0; n < a->nfirs; n++) {
+		if (strcmp(a->firnames[n], b->firnames[n]) != 0)
+			return 0;
+	}
+	if ((a->tidal.latitude != b->tidal.latitude) || (a->tidal.zone != b->tidal.zone) || (a->tidal.num_tides != b->tidal.num_tides))
+		return 0;
+	for (n = 0; n < a->tidal.num_tides; n++) {
+		if ((strcmp(a->tidal.tides[n].name, b->tidal.tides[n].name) != 0) ||
+				(a->tidal.tides[n].amplitude != b->tidal.tides[n].amplitude) || (a->tidal.tides[n].lag != b->tidal.tides[n].lag))
+			return 0;
+	}
+
+	return 1;
+}
@@ -0,0 +1,68 @@
+/*
+ * Copyright (c) 2014 Institute of Geological & Nuclear Sciences Ltd.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *		notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *		notice, this list of conditions and the following disclaimer in the
+ *		documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#ifndef _CONFIG_H
+#define _CONFIG_H
+
+/*
+ * config: per-stream CREX settings, matched on the stream source name.
+ *
+ * Each non blank line of the file gives a source name pattern followed
+ * by settings, anything not given is taken from the command line, e.g.
+ *
+ *	# pattern	settings
+ *	NZ_WLGT_40_?TH	tag=WLGT alpha=0.0 beta=1.0 latitude=-41.28 zone=12 filter=F1,F2 tide=M2/0.61/118.2 tide=S2/0.07/182.3
+ *
+ * the first matching pattern is used.
+ */
+
+#include <libcrex.h>
+
+#define CONFIG_PATTERN 64
+#define CONFIG_FILTER 64
+
+typedef struct config_rule_s {
+	char pattern[CONFIG_PATTERN];
+	char tag[25];
+	double alpha;
+	double beta;
+	int nfirs;
+	char firnames[FIR_MAX_FILTERS][CONFIG_FILTER];
+	crex_tidal_t tidal;
+} config_rule_t;
+
+typedef struct config_s {
+	config_rule_t *rules;
+	int nrules;
+} config_t;
+
+extern int config_load(config_t *config, const char *file, const config_rule_t *defaults);
+extern void config_free(config_t *config);
+
+extern const config_rule_t *config_match(const config_t *config, const char *srcname, const config_rule_t *defaults);
+extern int config_equal(const config_rule_t *a, const config_rule_t *b);
+
+#endif /* _CONFIG_H */
@@ -0,0 +1,1249 @@
+/*
+ * Copyright (c) 2014 Institute of Geological & Nuclear Sciences Ltd.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *		notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *		notice, this list of conditions and the following disclaimer in the
+ *		documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+/*
+ * crexbench: replay synthetic, or recorded, miniseed through slcrex and
+ * mscrex on one machine with no network, using stand-in seedlink and
+ * datalink servers on the loopback interface, along with timings of the
+ * stream registry and of reading the record headers.
+ *
+ * The seedlink server hands out the packets at a given rate, or as fast
+ * as slcrex takes them, and notes when each was sent. The datalink
+ * server takes the records, holding back acknowledgements or dropping
+ * the connection when asked, and times each record from when the packet
+ * holding its last sample was sent. A run ends once every packet has
+ * been sent and no record has come for a second, slcrex is then stopped
+ * and its CPU time and peak memory taken from the kernel.
+ *
+ * Run by "make bench", the programs are expected in the current directory.
+ */
+
+/* system includes */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <unistd.h>
+#include <signal.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <math.h>
+#include <dirent.h>
+#include <getopt.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+
+#include <libmseed.h>
+
+#include "registry.h"
+#include "msheader.h"
+#include "metrics.h"
+#include "fakesl.h"
+#include "fakedl.h"
+
+#ifndef PROGRAM
+#define PROGRAM "crexbench"
+#endif
+
+/* program variables */
+static char *program_name = PROGRAM;
+static char *program_usage = PROGRAM " [-hv][-s <streams>][-p <packets>][-r <rate>][-R <file>][-L <usecs>][-D <records>][-t <threads,...>][-T <seconds>][-b <dir>][-O <options>][<section> ...]";
+static char *program_prefix = "[" PROGRAM "] ";
+
+static int verbose = 0;
+
+#define BENCH_SAMPLES 800 /* more than a steim2 record can hold */
+#define BENCH_FILES 8 /* mscrex inputs, streams are spread over them */
+#define BENCH_RATE 1000.0 /* packets per second for timing latency when no rate is given */
+#define BENCH_IDLE 1000000 /* microseconds without a record to count as done */
+#define BENCH_REPEAT 1000000 /* header and registry lookups timed */
+
+#define MAX_ARGS 64
+
+static int nstreams = 100; /* synthetic stations */
+static int npackets = 100; /* synthetic packets per station */
+static double rate = 0.0; /* packets per second, zero as fast as possible */
+static char *replay = NULL; /* recorded 512 byte records instead */
+static int latency = 0; /* microseconds before each datalink acknowledgement */
+static unsigned long dropevery = 0; /* drop the datalink connection on every so many records */
+static char *threadlist = "1,2,4,8";
+static int timeout = 300; /* longest a run may take, in seconds */
+static char *bindir = ".";
+static char *options = NULL; /* passed to slcrex and mscrex */
+
+static char workdir[] = "/tmp/crexbenchXXXXXX";
+static char streamfile[PATH_MAX]; /* the stations, for slcrex -l */
+static char statefile[PATH_MAX];
+static char snapshotfile[PATH_MAX];
+static char datafile[PATH_MAX]; /* every record, for mscrex */
+
+/* the packets on offer, in the order they are sent */
+typedef struct bench_packet_s {
+	char key[24]; /* NET_STA */
+	int station;
+	hptime_t end;
+} bench_packet_t;
+
+static char *records = NULL;
+static bench_packet_t *packets = NULL;
+static uint64_t *sent = NULL; /* when each was sent, zero if not yet */
+static unsigned long total = 0;
+static atomic_ulong limit; /* packets the seedlink server may send */
+
+/* the packets of each station, in time order, to find the one a record was waiting on */
+static char (*stations)[24] = NULL;
+static int nstations = 0;
+static unsigned long *first = NULL; /* offset of each station in order */
+static unsigned long *order = NULL;
+
+/* what the datalink server has seen */
+static struct {
+	pthread_mutex_t lock;
+	uint64_t *latencies; /* microseconds */
+	unsigned long nlatencies, maxlatencies;
+	unsigned long unmatched;
+	atomic_ulong writes;
+	_Atomic uint64_t first, last; /* monotonic microseconds */
+} seen = {PTHREAD_MUTEX_INITIALIZER, NULL, 0, 0, 0, 0, 0, 0};
+
+typedef struct bench_result_s {
+	unsigned long packets;
+	unsigned long records;
+	unsigned long drops; /* datalink connections dropped */
+	uint64_t start, end; /* first packet sent, last record taken */
+	double cpu; /* seconds */
+	long rss; /* kilobytes */
+} bench_result_t;
+
+static void log_print(char *message) {
+	fprintf(stderr, "%s", message);
+}
+
+static void err_print(char *message) {
+	fprintf(stderr, "error: %s", message);
+}
+
+static int compare_key(const void *a, const void *b) {
+	return strcmp((const char *) a, (const char *) b);
+}
+
+static int compare_time(const void *a, const void *b) {
+	uint64_t x = *(const uint64_t *) a, y = *(const uint64_t *) b;
+
+	return (x < y) ? -1 : (x > y) ? 1 : 0;
+}
+
+/* the packet a record ending at the given time was waiting on, -1 if none */
+static long waiting_on(const char *streamid, hptime_t end) {
+	char key[24], *c;
+	unsigned long lo, hi, mid;
+	char (*station)[24];
+	int s;
+
+	/* NET_STA_LOC_CHA/MSEED */
+	strncpy(key, streamid, sizeof(key) - 1);
+	key[sizeof(key) - 1] = '\0';
+	if (((c = strchr(key, '_')) == NULL) || ((c = strchr(c + 1, '_')) == NULL))
+		return -1;
+	*c = '\0';
+
+	if ((station = bsearch(key, stations, nstations, sizeof(stations[0]), compare_key)) == NULL)
+		return -1;
+	s = (int) (station - stations);
+	if (first[s] == first[s + 1])
+		return -1;
+
+	lo = first[s]; hi = first[s + 1] - 1;
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		if (packets[order[mid]].end < end)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	return (long) order[lo];
+}
+
+static int bench_record(const char *streamid, long long start, long long end, const char *data, int size, void *arg) {
+	uint64_t now = metrics_now(), zero = 0, wait;
+	long packet;
+
+	if ((dropevery > 0) && (atomic_fetch_add(&seen.writes, 1) % dropevery == dropevery - 1))
+		return FAKEDL_DROP;
+
+	(void) atomic_compare_exchange_strong(&seen.first, &zero, now);
+	atomic_store(&seen.last, now);
+
+	pthread_mutex_lock(&seen.lock);
+	if (((packet = waiting_on(streamid, (hptime_t) end)) < 0) || (sent[packet] == 0) || (sent[packet] > now)) {
+		seen.unmatched++;
+	}
+	else {
+		wait = now - sent[packet];
+		if (seen.nlatencies == seen.maxlatencies) {
+			seen.maxlatencies = (seen.maxlatencies) ? 2 * seen.maxlatencies : 4096;
+			if ((seen.latencies = (uint64_t *) realloc(seen.latencies, seen.maxlatencies * sizeof(uint64_t))) == NULL) {
+				ms_log(2, "memory error!\n"); exit(-1);
+			}
+		}
+		seen.latencies[seen.nlatencies++] = wait;
+	}
+	pthread_mutex_unlock(&seen.lock);
+
+	return FAKEDL_OK;
+}
+
+static int bench_source(unsigned long n, char *record, void *arg) {
+	if (n >= atomic_load(&limit))
+		return -1;
+
+	memcpy(record, records + n * FAKESL_RECLEN, FAKESL_RECLEN);
+	sent[n] = metrics_now();
+
+	return 0;
+}
+
+static void bench_reset(void) {
+	pthread_mutex_lock(&seen.lock);
+	seen.nlatencies = 0;
+	seen.unmatched = 0;
+	atomic_store(&seen.writes, 0);
+	atomic_store(&seen.first, 0);
+	atomic_store(&seen.last, 0);
+	pthread_mutex_unlock(&seen.lock);
+}
+
+/* keep the first record msr_pack gives back */
+static void pack_handler(char *record, int reclen, void *data) {
+	char *keep = (char *) data;
+
+	if ((keep[0] == '\0') && (reclen == FAKESL_RECLEN))
+		memcpy(keep, record, FAKESL_RECLEN);
+}
+
+static int add_packet(const char *record) {
+	MSRecord *msr = NULL;
+
+	if (msr_unpack((char *) record, FAKESL_RECLEN, &msr, 0, 0) != MS_NOERROR)
+		return -1;
+	if ((msr->reclen != FAKESL_RECLEN) || (msr->samprate <= 0.0)) {
+		msr_free(&msr); return -1;
+	}
+
+	memcpy(records + total * FAKESL_RECLEN, record, FAKESL_RECLEN);
+	snprintf(packets[total].key, sizeof(packets[total].key), "%s_%s", msr->network, msr->station);
+	packets[total].end = msr_endtime(msr);
+	total++;
+
+	msr_free(&msr);
+
+	return 0;
+}
+
+/* a tide, plus a little noise, from each station at one sample a second */
+static int synthesise(void) {
+	int32_t samples[BENCH_SAMPLES];
+	char record[FAKESL_RECLEN];
+	hptime_t epoch = ms_time2hptime(2020, 1, 0, 0, 0, 0);
+	hptime_t *next;
+	int64_t packed;
+	MSRecord *msr = NULL, *hdr = NULL;
+	unsigned int noise = 1;
+	int k, s, n;
+
+	if (((records = (char *) malloc((size_t) nstreams * npackets * FAKESL_RECLEN)) == NULL) ||
+			((packets = (bench_packet_t *) calloc((size_t) nstreams * npackets, sizeof(bench_packet_t))) == NULL) ||
+			((next = (hptime_t *) calloc(nstreams, sizeof(hptime_t))) == NULL)) {
+		ms_log(2, "memory error!\n"); return -1;
+	}
+	for (s = 0; s < nstreams; s++)
+		next[s] = epoch;
+
+	/* the stations take turns, as they would coming off a server */
+	for (k = 0; k < npackets; k++) {
+		for (s = 0; s < nstreams; s++) {
+			if ((msr = msr_init(msr)) == NULL) {
+				ms_log(2, "memory error!\n"); return -1;
+			}
+			strcpy(msr->network, "NZ");
+			snprintf(msr->station, sizeof(msr->station), "B%04d", s % 10000);
+			strcpy(msr->location, "40");
+			strcpy(msr->channel, "BTT");
+			msr->dataquality = 'D';
+			msr->sequence_number = k + 1;
+			msr->starttime = next[s];
+			msr->samprate = 1.0;
+			msr->reclen = FAKESL_RECLEN;
+			msr->encoding = DE_STEIM2;
+			msr->byteorder = 1;
+			for (n = 0; n < BENCH_SAMPLES; n++) {
+				double t = (double) MS_HPTIME2EPOCH(next[s]) + n + 600.0 * s;
+				noise = noise * 1103515245 + 12345;
+				samples[n] = (int32_t) (1000.0 * sin(2.0 * M_PI * t / 44712.0)) + (int32_t) ((noise >> 16) % 11) - 5;
+			}
+			msr->datasamples = samples;
+			msr->numsamples = BENCH_SAMPLES;
+			msr->sampletype = 'i';
+
+			record[0] = '\0';
+			if ((msr_pack(msr, pack_handler, record, &packed, 1, 0) < 0) || (record[0] == '\0')) {
+				ms_log(2, "unable to pack synthetic data\n"); return -1;
+			}
+			msr->datasamples = NULL;
+
+			if (add_packet(record) < 0) {
+				ms_log(2, "unable to read back synthetic data\n"); return -1;
+			}
+			if (msr_unpack(record, FAKESL_RECLEN, &hdr, 0, 0) != MS_NOERROR) {
+				ms_log(2, "unable to read back synthetic data\n"); return -1;
+			}
+			next[s] += (hptime_t) hdr->samplecnt * HPTMODULUS;
+			msr_free(&hdr);
+		}
+	}
+
+	msr_free(&msr);
+	free((char *) next);
+
+	return 0;
+}
+
+/* recorded packets, every 512 byte record in the file */
+static int load(const char *path) {
+	char record[FAKESL_RECLEN];
+	struct stat st;
+	unsigned long skipped = 0;
+	FILE *fp;
+
+	if ((fp = fopen(path, "r")) == NULL) {
+		ms_log(2, "unable to open [%s]: %s\n", path, strerror(errno)); return -1;
+	}
+	if ((fstat(fileno(fp), &st) < 0) || (st.st_size < FAKESL_RECLEN)) {
+		ms_log(2, "no records in [%s]\n", path); fclose(fp); return -1;
+	}
+	if (((records = (char *) malloc((size_t) st.st_size)) == NULL) ||
+			((packets = (bench_packet_t *) calloc((size_t) st.st_size / FAKESL_RECLEN, sizeof(bench_packet_t))) == NULL)) {
+		ms_log(2, "memory error!\n"); fclose(fp); return -1;
+	}
+	while (fread(record, FAKESL_RECLEN, 1, fp) == 1) {
+		if (add_packet(record) < 0)
+			skipped++;
+	}
+	fclose(fp);
+
+	if (skipped > 0)
+		ms_log(1, "skipped %lu records in [%s] that were not 512 byte data records\n", skipped, path);
+	if (total == 0) {
+		ms_log(2, "no records in [%s]\n", path); return -1;
+	}
+
+	return 0;
+}
+
+/* number the stations, and list the packets of each in time order */
+static int index_packets(void) {
+	unsigned long n, *at;
+	char (*station)[24];
+	int s;
+
+	if (((stations = calloc(total, sizeof(stations[0]))) == NULL) ||
+			((order = (unsigned long *) malloc(total * sizeof(unsigned long))) == NULL) ||
+			((sent = (uint64_t *) calloc(total, sizeof(uint64_t))) == NULL)) {
+		ms_log(2, "memory error!\n"); return -1;
+	}
+
+	for (n = 0; n < total; n++)
+		memcpy(stations[n], packets[n].key, sizeof(stations[0]));
+	qsort(stations, total, sizeof(stations[0]), compare_key);
+	for (n = 0; n < total; n++) {
+		if ((nstations == 0) || (strcmp(stations[nstations - 1], stations[n]) != 0))
+			memmove(stations[nstations++], stations[n], sizeof(stations[0]));
+	}
+
+	if (((first = (unsigned long *) calloc(nstations + 1, sizeof(unsigned long))) == NULL) ||
+			((at = (unsigned long *) calloc(nstations, sizeof(unsigned long))) == NULL)) {
+		ms_log(2, "memory error!\n"); return -1;
+	}
+	for (n = 0; n < total; n++) {
+		station = bsearch(packets[n].key, stations, nstations, sizeof(stations[0]), compare_key);
+		packets[n].station = (int) (station - stations);
+		first[packets[n].station + 1]++;
+	}
+	for (s = 0; s < nstations; s++) {
+		first[s + 1] += first[s];
+		at[s] = first[s];
+	}
+
+	/* assumes each station's packets come in time order, as a server would send them */
+	for (n = 0; n < total; n++)
+		order[at[packets[n].station]++] = n;
+	free((char *) at);
+
+	return 0;
+}
+
+static int write_file(const char *path, int part, int parts) {
+	unsigned long n;
+	FILE *fp;
+
+	if ((fp = fopen(path, "w")) == NULL) {
+		ms_log(2, "unable to create [%s]: %s\n", path, strerror(errno)); return -1;
+	}
+	for (n = 0; n < total; n++) {
+		if ((parts > 1) && (packets[n].station % parts != part))
+			continue;
+		if (fwrite(records + n * FAKESL_RECLEN, FAKESL_RECLEN, 1, fp) != 1) {
+			ms_log(2, "unable to write [%s]: %s\n", path, strerror(errno)); fclose(fp); return -1;
+		}
+	}
+
+	return (fclose(fp) == 0) ? 0 : -1;
+}
+
+static int write_streamlist(const char *path) {
+	FILE *fp;
+	int s;
+
+	if ((fp = fopen(path, "w")) == NULL) {
+		ms_log(2, "unable to create [%s]: %s\n", path, strerror(errno)); return -1;
+	}
+	for (s = 0; s < nstations; s++) {
+		char net[24], *sta;
+
+		strcpy(net, stations[s]);
+		if ((sta = strchr(net, '_')) == NULL)
+			continue;
+		*sta++ = '\0';
+		fprintf(fp, "%s %s\n", net, sta);
+	}
+
+	return (fclose(fp) == 0) ? 0 : -1;
+}
+
+/* remove everything the runs have left */
+static void tidy(void) {
+	char path[PATH_MAX];
+	struct dirent *entry;
+	DIR *dir;
+
+	if ((dir = opendir(workdir)) == NULL)
+		return;
+	while ((entry = readdir(dir)) != NULL) {
+		if (entry->d_name[0] == '.')
+			continue;
+		snprintf(path, sizeof(path), "%s/%s", workdir, entry->d_name);
+		(void) unlink(path);
+	}
+	closedir(dir);
+	(void) rmdir(workdir);
+}
+
+/* the program, the extra options, then the run's own arguments */
+static int arguments(char **argv, const char *program, char **args) {
+	static char copy[1024];
+	static char bin[PATH_MAX];
+	char *c;
+	int n = 0;
+
+	snprintf(bin, sizeof(bin), "%s/%s", bindir, program);
+	argv[n++] = bin;
+	if (options) {
+		strncpy(copy, options, sizeof(copy) - 1);
+		for (c = strtok(copy, " \t"); (c != NULL) && (n < MAX_ARGS - 16); c = strtok(NULL, " \t"))
+			argv[n++] = c;
+	}
+	while ((*args != NULL) && (n < MAX_ARGS - 1))
+		argv[n++] = *args++;
+	argv[n] = NULL;
+
+	return n;
+}
+
+/*
+ * the programs are started by a small process forked before the data is
+ * built, the peak memory the kernel reports for each is then its own and
+ * not what it shared with the benchmark when it was forked
+ */
+static struct {
+	pid_t pid;
+	int requests; /* the input file and arguments, nul separated */
+	int replies; /* the pid, then the status and usage once it exits */
+} launcher = {-1, -1, -1};
+
+typedef struct bench_exit_s {
+	int status;
+	struct rusage ru;
+} bench_exit_t;
+
+static int readn(int fd, void *buf, size_t len) {
+	char *b = (char *) buf;
+	ssize_t n;
+
+	while (len > 0) {
+		if ((n = read(fd, b, len)) <= 0)
+			return -1;
+		b += n; len -= (size_t) n;
+	}
+
+	return 0;
+}
+
+static void launch_one(char *request, int replies) {
+	char *argv[MAX_ARGS], *input = request;
+	bench_exit_t done;
+	pid_t pid;
+	int n = 0, fd;
+
+	for (request += strlen(request) + 1; (*request != '\0') && (n < MAX_ARGS - 1); request += strlen(request) + 1)
+		argv[n++] = request;
+	argv[n] = NULL;
+
+	if ((pid = fork()) == 0) {
+		if (((fd = open((*input) ? input : "/dev/null", O_RDONLY)) < 0) || (dup2(fd, 0) < 0))
+			_exit(127);
+		if (((fd = open("/dev/null", O_WRONLY)) < 0) || (dup2(fd, 1) < 0) || ((!verbose) && (dup2(fd, 2) < 0)))
+			_exit(127);
+		signal(SIGPIPE, SIG_DFL);
+		execv(argv[0], argv);
+		_exit(127);
+	}
+	if ((write(replies, &pid, sizeof(pid)) != (ssize_t) sizeof(pid)) || (pid < 0))
+		return;
+
+	memset(&done, 0, sizeof(done));
+	if (wait4(pid, &done.status, 0, &done.ru) < 0)
+		done.status = -1;
+	(void) write(replies, &done, sizeof(done));
+}
+
+static int launcher_start(void) {
+	char request[8192];
+	int requests[2], replies[2];
+	size_t len;
+
+	if ((pipe(requests) < 0) || (pipe(replies) < 0)) {
+		ms_log(2, "unable to start launcher: %s\n", strerror(errno)); return -1;
+	}
+	if ((launcher.pid = fork()) < 0) {
+		ms_log(2, "unable to start launcher: %s\n", strerror(errno)); return -1;
+	}
+	if (launcher.pid == 0) {
+		close(requests[1]);
+		close(replies[0]);
+		while ((readn(requests[0], &len, sizeof(len)) == 0) && (len < sizeof(request)) && (readn(requests[0], request, len) == 0))
+			launch_one(request, replies[1]);
+		_exit(0);
+	}
+
+	close(requests[0]);
+	close(replies[1]);
+	launcher.requests = requests[1];
+	launcher.replies = replies[0];
+
+	return 0;
+}
+
+static void launcher_stop(void) {
+	if (launcher.pid <= 0)
+		return;
+
+	close(launcher.requests);
+	close(launcher.replies);
+	(void) waitpid(launcher.pid, NULL, 0);
+	launcher.pid = -1;
+}
+
+/* run a program with stdin from a file, or /dev/null, and its output thrown away */
+static pid_t spawn(char **argv, const char *input) {
+	char request[8192];
+	size_t len = 0, n;
+	pid_t pid;
+	char **a;
+
+	if (verbose) {
+		char line[4096];
+
+		line[0] = '\0';
+		for (a = argv; (*a != NULL) && (len < sizeof(line)); a++)
+			len += (size_t) snprintf(line + len, sizeof(line) - len, " %s", *a);
+		ms_log(0, "running%s\n", line);
+	}
+
+	/* the input first, empty for none, an empty argument ends the list */
+	len = strlen((input) ? input : "") + 1;
+	memcpy(request, (input) ? input : "", len);
+	for (a = argv; *a != NULL; a++) {
+		if (len + (n = strlen(*a) + 1) >= sizeof(request)) {
+			ms_log(2, "too many arguments for [%s]\n", argv[0]); return -1;
+		}
+		memcpy(request + len, *a, n);
+		len += n;
+	}
+	request[len++] = '\0';
+
+	if ((write(launcher.requests, &len, sizeof(len)) != (ssize_t) sizeof(len)) ||
+			(write(launcher.requests, request, len) != (ssize_t) len) || (readn(launcher.replies, &pid, sizeof(pid)) < 0) || (pid < 0)) {
+		ms_log(2, "unable to run [%s]\n", argv[0]); return -1;
+	}
+
+	return pid;
+}
+
+/* how the last program started finished, zero if it is still running and not waited for */
+static int reaped(bench_exit_t *done, int wait) {
+	struct pollfd pfd;
+
+	pfd.fd = launcher.replies;
+	pfd.events = POLLIN;
+	pfd.revents = 0;
+	if ((!wait) && (poll(&pfd, 1, 0) <= 0))
+		return 0;
+
+	if (readn(launcher.replies, done, sizeof(bench_exit_t)) < 0) {
+		ms_log(2, "lost the launcher\n"); return -1;
+	}
+
+	return 1;
+}
+
+static void usage_of(bench_result_t *result, struct rusage *ru) {
+	result->cpu = (double) ru->ru_utime.tv_sec + ru->ru_utime.tv_usec / 1.0e6 + (double) ru->ru_stime.tv_sec + ru->ru_stime.tv_usec / 1.0e6;
+	result->rss = ru->ru_maxrss;
+}
+
+/* wait for the datalink client to go and its last records to be taken in */
+static void drained(fakedl_t *dl) {
+	int n, fd = -1;
+
+	for (n = 0; n < 100; n++) {
+		pthread_mutex_lock(&dl->lock);
+		fd = dl->fd;
+		pthread_mutex_unlock(&dl->lock);
+		if (fd < 0)
+			break;
+		usleep(10000);
+	}
+}
+
+/* run slcrex until every packet allowed has been sent and the records have stopped */
+static int slcrex_run(fakesl_t *sl, fakedl_t *dl, char **args, bench_result_t *result) {
+	char *argv[MAX_ARGS], *own[MAX_ARGS];
+	uint64_t start, now, idle = 0, last;
+	unsigned long before = atomic_load(&sl->next);
+	unsigned long records = atomic_load(&dl->records);
+	unsigned long drops = atomic_load(&dl->drops);
+	bench_exit_t done;
+	int rc, n = 0;
+	pid_t pid;
+
+	own[n++] = "-l"; own[n++] = streamfile;
+	if (latency > 0)
+		own[n++] = "-w";
+	while ((*args != NULL) && (n < MAX_ARGS - 3))
+		own[n++] = *args++;
+	own[n++] = sl->address;
+	own[n++] = dl->address;
+	own[n] = NULL;
+	(void) arguments(argv, "slcrex", own);
+
+	memset(result, 0, sizeof(bench_result_t));
+	start = metrics_now();
+	if ((pid = spawn(argv, NULL)) < 0)
+		return -1;
+
+	for (;;) {
+		usleep(10000);
+		if ((rc = reaped(&done, 0)) != 0) {
+			if (rc > 0)
+				ms_log(2, "slcrex stopped early, status %d\n", (WIFEXITED(done.status)) ? WEXITSTATUS(done.status) : -1);
+			return -1;
+		}
+		now = metrics_now();
+		if ((atomic_load(&sl->done)) && (atomic_load(&sl->next) >= atomic_load(&limit))) {
+			if (idle == 0)
+				idle = now;
+			last = atomic_load(&seen.last);
+			if (now - ((last > idle) ? last : idle) >= BENCH_IDLE)
+				break;
+		}
+		else {
+			idle = 0;
+		}
+		if (now - start > (uint64_t) timeout * 1000000) {
+			ms_log(1, "run timed out after %d seconds\n", timeout); break;
+		}
+	}
+
+	kill(pid, SIGTERM);
+	if (reaped(&done, 1) < 0)
+		return -1;
+	drained(dl);
+
+	usage_of(result, &done.ru);
+	result->packets = atomic_load(&sl->next) - before;
+	result->records = atomic_load(&dl->records) - records;
+	result->drops = atomic_load(&dl->drops) - drops;
+	result->start = (before < total) ? sent[before] : start;
+	result->end = atomic_load(&seen.last);
+	if (result->end < result->start)
+		result->end = metrics_now();
+
+	return 0;
+}
+
+static double percentile(uint64_t *values, unsigned long count, double p) {
+	if (count == 0)
+		return 0.0;
+
+	return (double) values[(unsigned long) (p * (double) (count - 1))] / 1000.0;
+}
+
+static void slcrex_report(const char *label, bench_result_t *result) {
+	double elapsed = (double) (result->end - result->start) / 1.0e6;
+
+	pthread_mutex_lock(&seen.lock);
+	qsort(seen.latencies, seen.nlatencies, sizeof(uint64_t), compare_time);
+	printf("%-24s %8lu packets %10.1f packets/s %8lu records  latency ms p50 %.1f p90 %.1f p99 %.1f max %.1f  cpu %.2f s  rss %ld KB\n",
+		label, result->packets, (elapsed > 0.0) ? (double) result->packets / elapsed : 0.0, result->records,
+		percentile(seen.latencies, seen.nlatencies, 0.5), percentile(seen.latencies, seen.nlatencies, 0.9),
+		percentile(seen.latencies, seen.nlatencies, 0.99), percentile(seen.latencies, seen.nlatencies, 1.0),
+		result->cpu, result->rss);
+	if (result->drops > 0)
+		printf("%-24s %lu datalink connections dropped\n", label, result->drops);
+	if ((verbose) && (seen.unmatched > 0))
+		ms_log(0, "%lu records not matched to a packet\n", seen.unmatched);
+	pthread_mutex_unlock(&seen.lock);
+	fflush(stdout);
+}
+
+/* fresh servers, all the packets, and one slcrex */
+static int slcrex_once(const char *label, double pace, char **args) {
+	bench_result_t result;
+	fakesl_t sl;
+	fakedl_t dl;
+	int rc;
+
+	bench_reset();
+	memset(sent, 0, total * sizeof(uint64_t));
+	atomic_store(&limit, total);
+	if (fakesl_start(&sl, bench_source, NULL, pace) < 0)
+		return -1;
+	if (fakedl_start(&dl, bench_record, NULL, latency) < 0) {
+		fakesl_stop(&sl); return -1;
+	}
+
+	if ((rc = slcrex_run(&sl, &dl, args, &result)) == 0)
+		slcrex_report(label, &result);
+
+	fakedl_stop(&dl);
+	fakesl_stop(&sl);
+
+	return rc;
+}
+
+/* the replay as asked for */
+static int bench_slcrex(void) {
+	char *args[] = {NULL};
+
+	printf("slcrex, %lu packets from %d stations, %s%s\n", total, nstations, (rate > 0.0) ? "paced" : "as fast as taken",
+		(dropevery > 0) ? ", dropping datalink connections" : "");
+
+	return slcrex_once("slcrex", rate, args);
+}
+
+/* the same data through each number of processing threads */
+static int bench_threads(void) {
+	char list[256], label[64], count[16], *c;
+	char *args[] = {"-n", count, NULL};
+	int failed = 0;
+
+	printf("slcrex thread scaling, %lu packets from %d stations\n", total, nstations);
+
+	strncpy(list, threadlist, sizeof(list) - 1);
+	list[sizeof(list) - 1] = '\0';
+	for (c = strtok(list, ","); c != NULL; c = strtok(NULL, ",")) {
+		snprintf(count, sizeof(count), "%d", atoi(c));
+		snprintf(label, sizeof(label), "-n %s", count);
+		if (slcrex_once(label, rate, args) < 0)
+			failed = 1;
+	}
+
+	return (failed) ? -1 : 0;
+}
+
+/* latency at a steady rate, with and without saving the seedlink state */
+static int bench_checkpoint(void) {
+	char *none[] = {NULL};
+	char *rare[] = {"-x", statefile, "-u", "1000", NULL};
+	char *often[] = {"-x", statefile, "-u", "100", NULL};
+	double pace = (rate > 0.0) ? rate : BENCH_RATE;
+	int failed = 0;
+
+	printf("slcrex checkpointing, %lu packets from %d stations at %g packets/s\n", total, nstations, pace);
+
+	(void) unlink(statefile);
+	if (slcrex_once("no statefile", pace, none) < 0)
+		failed = 1;
+	(void) unlink(statefile);
+	if (slcrex_once("-x -u 1000", pace, rare) < 0)
+		failed = 1;
+	(void) unlink(statefile);
+	if (slcrex_once("-x -u 100", pace, often) < 0)
+		failed = 1;
+
+	return (failed) ? -1 : 0;
+}
+
+/* stop halfway, then time the second slcrex coming back up, with and without the stream snapshot */
+static int bench_restart(void) {
+	char *plain[] = {"-x", statefile, "-u", "100", NULL};
+	char *saved[] = {"-x", statefile, "-u", "100", "-P", snapshotfile, NULL};
+	char **variants[] = {plain, saved};
+	const char *labels[] = {"restart", "restart -P"};
+	bench_result_t result;
+	uint64_t start;
+	fakesl_t sl;
+	fakedl_t dl;
+	int n, failed = 0;
+
+	printf("slcrex restart, %lu packets from %d stations, stopped after %lu\n", total, nstations, total / 2);
+
+	for (n = 0; n < 2; n++) {
+		(void) unlink(statefile);
+		(void) unlink(snapshotfile);
+
+		bench_reset();
+		memset(sent, 0, total * sizeof(uint64_t));
+		atomic_store(&limit, total / 2);
+		if (fakesl_start(&sl, bench_source, NULL, rate) < 0)
+			return -1;
+		if (fakedl_start(&dl, bench_record, NULL, latency) < 0) {
+			fakesl_stop(&sl); return -1;
+		}
+
+		if (slcrex_run(&sl, &dl, variants[n], &result) == 0) {
+			bench_reset();
+			atomic_store(&limit, total);
+			start = metrics_now();
+			if (slcrex_run(&sl, &dl, variants[n], &result) == 0) {
+				slcrex_report(labels[n], &result);
+				printf("%-24s connected after %.1f ms, first record after %.1f ms\n", labels[n],
+					(atomic_load(&sl.connected) > start) ? (double) (atomic_load(&sl.connected) - start) / 1000.0 : 0.0,
+					(atomic_load(&seen.first) > start) ? (double) (atomic_load(&seen.first) - start) / 1000.0 : 0.0);
+			}
+			else {
+				failed = 1;
+			}
+		}
+		else {
+			failed = 1;
+		}
+
+		fakedl_stop(&dl);
+		fakesl_stop(&sl);
+	}
+
+	return (failed) ? -1 : 0;
+}
+
+/* run mscrex over files, reading stdin from the given file if any */
+static int mscrex_once(const char *label, char **args, const char *input, unsigned long count) {
+	char *argv[MAX_ARGS];
+	bench_result_t result;
+	bench_exit_t done;
+	uint64_t start;
+	double elapsed;
+
+	(void) arguments(argv, "mscrex", args);
+
+	memset(&result, 0, sizeof(bench_result_t));
+	start = metrics_now();
+	if ((spawn(argv, input) < 0) || (reaped(&done, 1) < 0))
+		return -1;
+	elapsed = (double) (metrics_now() - start) / 1.0e6;
+	usage_of(&result, &done.ru);
+
+	if ((!WIFEXITED(done.status)) || (WEXITSTATUS(done.status) != 0)) {
+		ms_log(2, "%s: mscrex failed, status %d\n", label, (WIFEXITED(done.status)) ? WEXITSTATUS(done.status) : -1); return -1;
+	}
+
+	printf("%-24s %8lu records %8.3f s %12.1f records/s  cpu %.2f s  rss %ld KB\n",
+		label, count, elapsed, (elapsed > 0.0) ? (double) count / elapsed : 0.0, result.cpu, result.rss);
+	fflush(stdout);
+
+	return 0;
+}
+
+/* a single file mapped or streamed, the same data over several files and threads, and a selection scanned or indexed */
+static int bench_mscrex(void) {
+	char *files[BENCH_FILES], name[PATH_MAX], label[64], count[16], list[256], pattern[64], *c;
+	char *args[MAX_ARGS];
+	unsigned long selected = 0, n;
+	int f, a, failed = 0;
+
+	if (write_file(datafile, 0, 1) < 0)
+		return -1;
+	for (f = 0; f < BENCH_FILES; f++) {
+		snprintf(name, sizeof(name), "%s/part%d.ms", workdir, f);
+		if ((files[f] = strdup(name)) == NULL) {
+			ms_log(2, "memory error!\n"); return -1;
+		}
+		if (write_file(files[f], f, BENCH_FILES) < 0)
+			return -1;
+	}
+
+	printf("mscrex, %lu records from %d stations\n", total, nstations);
+
+	args[0] = datafile; args[1] = NULL;
+	if (mscrex_once("mapped", args, NULL, total) < 0)
+		failed = 1;
+	args[0] = "-"; args[1] = NULL;
+	if (mscrex_once("stdin", args, datafile, total) < 0)
+		failed = 1;
+
+	strncpy(list, threadlist, sizeof(list) - 1);
+	list[sizeof(list) - 1] = '\0';
+	for (c = strtok(list, ","); c != NULL; c = strtok(NULL, ",")) {
+		snprintf(count, sizeof(count), "%d", atoi(c));
+		snprintf(label, sizeof(label), "%d files -n %s", BENCH_FILES, count);
+		a = 0;
+		args[a++] = "-n"; args[a++] = count;
+		for (f = 0; f < BENCH_FILES; f++)
+			args[a++] = files[f];
+		args[a] = NULL;
+		if (mscrex_once(label, args, NULL, total) < 0)
+			failed = 1;
+	}
+
+	/* one station, found in one file */
+	snprintf(pattern, sizeof(pattern), "%s_*", stations[0]);
+	for (n = 0; n < total; n++)
+		selected += (packets[n].station == 0) ? 1 : 0;
+	for (a = 0; a < 2; a++) {
+		int i = 0;
+
+		if (a > 0)
+			args[i++] = "-X";
+		args[i++] = "-S"; args[i++] = pattern;
+		for (f = 0; f < BENCH_FILES; f++)
+			args[i++] = files[f];
+		args[i] = NULL;
+		if (a == 0) {
+			if (mscrex_once("-S scanned", args, NULL, selected) < 0)
+				failed = 1;
+		}
+		else {
+			if (mscrex_once("-S indexing", args, NULL, selected) < 0)
+				failed = 1;
+			if (mscrex_once("-S indexed", args, NULL, selected) < 0)
+				failed = 1;
+		}
+	}
+
+	for (f = 0; f < BENCH_FILES; f++)
+		free(files[f]);
+
+	return (failed) ? -1 : 0;
+}
+
+/* the registry against walking a list, as the streams used to be found */
+typedef struct bench_node_s {
+	char srcname[100];
+	struct bench_node_s *next;
+} bench_node_t;
+
+static int bench_registry(void) {
+	int sizes[] = {10, 100, 1000, 10000, 0};
+	char (*names)[32];
+	bench_node_t *nodes, *list, *node;
+	unsigned int *picks, pick = 1;
+	unsigned long found;
+	registry_t reg;
+	int walks;
+	uint64_t start;
+	double hashed, walked;
+	int s, n, size, created;
+
+	printf("stream lookup, time per lookup\n");
+
+	for (s = 0; (size = sizes[s]) > 0; s++) {
+		if (((names = calloc(size, sizeof(names[0]))) == NULL) || ((nodes = (bench_node_t *) calloc(size, sizeof(bench_node_t))) == NULL) ||
+				((picks = (unsigned int *) malloc(BENCH_REPEAT * sizeof(unsigned int))) == NULL) || (registry_init(&reg, 0) < 0)) {
+			ms_log(2, "memory error!\n"); return -1;
+		}
+
+		list = NULL;
+		for (n = 0; n < size; n++) {
+			snprintf(names[n], sizeof(names[0]), "NZ_B%04d_40_BTT", n);
+			if (registry_lookup(&reg, names[n], &created) == NULL) {
+				ms_log(2, "memory error!\n"); return -1;
+			}
+			strcpy(nodes[n].srcname, names[n]);
+			nodes[n].next = list;
+			list = &nodes[n];
+		}
+		for (n = 0; n < BENCH_REPEAT; n++) {
+			pick = pick * 1103515245 + 12345;
+			picks[n] = (pick >> 8) % size;
+		}
+
+		found = 0;
+		start = metrics_now();
+		for (n = 0; n < BENCH_REPEAT; n++)
+			found += (registry_find(&reg, names[picks[n]]) != NULL) ? 1 : 0;
+		hashed = (double) (metrics_now() - start) * 1000.0 / BENCH_REPEAT;
+
+		/* fewer walks of the longer lists, they take a while */
+		walks = (size > 10) ? (BENCH_REPEAT / size) * 10 : BENCH_REPEAT;
+		if (walks < 1000)
+			walks = 1000;
+		start = metrics_now();
+		for (n = 0; n < walks; n++) {
+			for (node = list; node != NULL; node = node->next) {
+				if (strcmp(node->srcname, names[picks[n]]) == 0)
+					break;
+			}
+			found += (node != NULL) ? 1 : 0;
+		}
+		walked = (double) (metrics_now() - start) * 1000.0 / walks;
+
+		if (found != (unsigned long) (BENCH_REPEAT + walks))
+			ms_log(1, "%d streams: only %lu of %d lookups found\n", size, found, BENCH_REPEAT + walks);
+		printf("%6d streams  registry %8.1f ns  list %10.1f ns\n", size, hashed, walked);
+		fflush(stdout);
+
+		registry_free(&reg);
+		free(picks);
+		free((char *) nodes);
+		free(names);
+	}
+
+	return 0;
+}
+
+/* the fixed header read directly against a full unpack, to route each record */
+static int bench_header(void) {
+	char srcname[100];
+	MSRecord *msr = NULL;
+	msheader_t hdr;
+	hptime_t end = 0;
+	uint64_t start;
+	double unpacked, parsed;
+	unsigned long n;
+	int failed = 0;
+
+	printf("record headers, %d records\n", BENCH_REPEAT);
+
+	start = metrics_now();
+	for (n = 0; n < BENCH_REPEAT; n++) {
+		if (msr_unpack(records + (n % total) * FAKESL_RECLEN, FAKESL_RECLEN, &msr, 0, 0) != MS_NOERROR) {
+			failed = 1; break;
+		}
+		msr_srcname(msr, srcname, 0);
+		end += msr_endtime(msr);
+	}
+	unpacked = (double) (metrics_now() - start) / 1.0e6;
+	msr_free(&msr);
+
+	start = metrics_now();
+	for (n = 0; n < BENCH_REPEAT; n++) {
+		if (msheader_parse(records + (n % total) * FAKESL_RECLEN, FAKESL_RECLEN, &hdr) < 0) {
+			failed = 1; break;
+		}
+		end -= hdr.endtime;
+	}
+	parsed = (double) (metrics_now() - start) / 1.0e6;
+
+	if (failed) {
+		ms_log(2, "unable to read record headers\n"); return -1;
+	}
+	if (end != 0)
+		ms_log(1, "msheader_parse and msr_endtime disagree\n");
+
+	printf("msr_unpack  %12.1f records/s\n", (unpacked > 0.0) ? BENCH_REPEAT / unpacked : 0.0);
+	printf("msheader    %12.1f records/s\n", (parsed > 0.0) ? BENCH_REPEAT / parsed : 0.0);
+	fflush(stdout);
+
+	return 0;
+}
+
+typedef struct bench_section_s {
+	const char *name;
+	int (*run)(void);
+	const char *what;
+} bench_section_t;
+
+static bench_section_t sections[] = {
+	{"registry", bench_registry, "stream lookup by hash against a list walk"},
+	{"header", bench_header, "record header parsing against msr_unpack"},
+	{"slcrex", bench_slcrex, "replay through slcrex, with any -r, -L and -D"},
+	{"threads", bench_threads, "slcrex with each -t thread count"},
+	{"checkpoint", bench_checkpoint, "slcrex latency with and without a statefile"},
+	{"restart", bench_restart, "slcrex restarting with and without -P"},
+	{"mscrex", bench_mscrex, "mscrex mapped, streamed, in parallel and indexed"},
+	{NULL, NULL, NULL}
+};
+
+int main(int argc, char **argv) {
+	bench_section_t *section;
+	int rc, n, failed = 0;
+	int option_index = 0;
+	struct option long_options[] = {
+		{"help", 0, 0, 'h'},
+		{"verbose", 0, 0, 'v'},
+		{"streams", 1, 0, 's'},
+		{"packets", 1, 0, 'p'},
+		{"rate", 1, 0, 'r'},
+		{"replay", 1, 0, 'R'},
+		{"latency", 1, 0, 'L'},
+		{"drop", 1, 0, 'D'},
+		{"threads", 1, 0, 't'},
+		{"timeout", 1, 0, 'T'},
+		{"bindir", 1, 0, 'b'},
+		{"options", 1, 0, 'O'},
+		{0, 0, 0, 0}
+	};
+
+	ms_loginit (log_print, program_prefix, err_print, program_prefix);
+
+	while ((rc = getopt_long(argc, argv, "hvs:p:r:R:L:D:t:T:b:O:", long_options, &option_index)) != EOF) {
+		switch(rc) {
+		case '?':
+			(void) fprintf(stderr, "usage: %s\n", program_usage);
+			exit(-1); /*NOTREACHED*/
+		case 'h':
+			(void) fprintf(stderr, "\n[%s] slcrex and mscrex benchmarks\n\n", program_name);
+			(void) fprintf(stderr, "usage:\n\t%s\n", program_usage);
+			(void) fprintf(stderr, "options:\n");
+			(void) fprintf(stderr, "\t-h --help\tcommand line help (this)\n");
+			(void) fprintf(stderr, "\t-v --verbose\tshow the commands run and their output\n");
+			(void) fprintf(stderr, "\t-s --streams\tsynthetic stations [%d]\n", nstreams);
+			(void) fprintf(stderr, "\t-p --packets\tsynthetic packets from each station [%d]\n", npackets);
+			(void) fprintf(stderr, "\t-r --rate\tseedlink packets per second, zero as fast as taken [%g]\n", rate);
+			(void) fprintf(stderr, "\t-R --replay\treplay the 512 byte records in this file instead [%s]\n", (replay) ? replay : "<null>");
+			(void) fprintf(stderr, "\t-L --latency\tmicroseconds before each datalink acknowledgement, turns on -w [%d]\n", latency);
+			(void) fprintf(stderr, "\t-D --drop\tdrop the datalink connection every so many records, zero never [%lu]\n", dropevery);
+			(void) fprintf(stderr, "\t-t --threads\tthread counts to compare [%s]\n", threadlist);
+			(void) fprintf(stderr, "\t-T --timeout\tlongest a run may take in seconds [%d]\n", timeout);
+			(void) fprintf(stderr, "\t-b --bindir\twhere to find slcrex and mscrex [%s]\n", bindir);
+			(void) fprintf(stderr, "\t-O --options\textra options for slcrex and mscrex, e.g. the tidal constants [%s]\n", (options) ? options : "<null>");
+			(void) fprintf(stderr, "sections, all by default:\n");
+			for (section = sections; section->name != NULL; section++)
+				(void) fprintf(stderr, "\t%s\t%s\n", section->name, section->what);
+			exit(0); /*NOTREACHED*/
+		case 'v':
+			verbose++;
+			break;
+		case 's':
+			nstreams = atoi(optarg);
+			break;
+		case 'p':
+			npackets = atoi(optarg);
+			break;
+		case 'r':
+			rate = atof(optarg);
+			break;
+		case 'R':
+			replay = optarg;
+			break;
+		case 'L':
+			latency = atoi(optarg);
+			break;
+		case 'D':
+			dropevery = strtoul(optarg, NULL, 10);
+			break;
+		case 't':
+			threadlist = optarg;
+			break;
+		case 'T':
+			timeout = atoi(optarg);
+			break;
+		case 'b':
+			bindir = optarg;
+			break;
+		case 'O':
+			options = optarg;
+			break;
+		}
+	}
+
+	for (n = optind; n < argc; n++) {
+		for (section = sections; section->name != NULL; section++) {
+			if (strcmp(section->name, argv[n]) == 0)
+				break;
+		}
+		if (section->name == NULL) {
+			ms_log(2, "unknown section [%s]\n", argv[n]); exit(-1);
+		}
+	}
+	if ((nstreams < 1) || (nstreams > 10000) || (npackets < 1)) {
+		ms_log(2, "need one to 10000 stations and at least one packet\n"); exit(-1);
+	}
+
+	signal(SIGPIPE, SIG_IGN);
+
+	if (launcher_start() < 0)
+		exit(-1);
+	if ((((replay) ? load(replay) : synthesise()) < 0) || (index_packets() < 0)) {
+		launcher_stop(); exit(-1);
+	}
+
+	if (mkdtemp(workdir) == NULL) {
+		ms_log(2, "unable to create a work directory: %s\n", strerror(errno)); launcher_stop(); exit(-1);
+	}
+	snprintf(streamfile, sizeof(streamfile), "%s/streams", workdir);
+	snprintf(statefile, sizeof(statefile), "%s/state", workdir);
+	snprintf(snapshotfile, sizeof(snapshotfile), "%s/snapshot", workdir);
+	snprintf(datafile, sizeof(datafile), "%s/all.ms", workdir);
+	if (write_streamlist(streamfile) < 0) {
+		tidy(); launcher_stop(); exit(-1);
+	}
+
+	for (section = sections; section->name != NULL; section++) {
+		if (optind < argc) {
+			for (n = optind; n < argc; n++) {
+				if (strcmp(section->name, argv[n]) == 0)
+					break;
+			}
+			if (n == argc)
+				continue;
+		}
+		if (section->run() < 0)
+			failed = 1;
+		printf("\n");
+	}
+
+	tidy();
+	launcher_stop();
+
+	return (failed) ? 1 : 0;
+}
@@ -0,0 +1,223 @@
+/*
+ * Copyright (c) 2014 Institute of Geological & Nuclear Sciences Ltd.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *		notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *		notice, this list of conditions and the following disclaimer in the
+ *		documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+/* system includes */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <poll.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+
+#include <libmseed.h>
+
+#include "fakedl.h"
+
+static int fakedl_readn(int fd, char *buf, size_t len) {
+	ssize_t n;
+
+	while (len > 0) {
+		if ((n = read(fd, buf, len)) <= 0)
+			return -1;
+		buf += n; len -= (size_t) n;
+	}
+
+	return 0;
+}
+
+/* one datalink packet, "DL", the header length, the header and no data */
+static int fakedl_reply(int fd, const char *header) {
+	char buf[260];
+	size_t len = strlen(header);
+
+	buf[0] = 'D'; buf[1] = 'L'; buf[2] = (char) len;
+	memcpy(buf + 3, header, len);
+
+	return (write(fd, buf, len + 3) == (ssize_t) (len + 3)) ? 0 : -1;
+}
+
+/*
+ * stop answering, letting everything already answered reach the client,
+ * then close once it has gone quiet, or after a second of it carrying on
+ * regardless, so later writes fail as they would
+ */
+static void fakedl_hangup(int fd) {
+	struct pollfd pfd;
+	char buf[4096];
+	int n;
+
+	(void) shutdown(fd, SHUT_WR);
+
+	pfd.fd = fd;
+	pfd.events = POLLIN;
+	pfd.revents = 0;
+	for (n = 0; n < 100; n++) {
+		if ((poll(&pfd, 1, 100) <= 0) || (read(fd, buf, sizeof(buf)) <= 0))
+			break;
+		usleep(10000);
+	}
+}
+
+static void fakedl_serve(fakedl_t *dl, int fd) {
+	char header[256], streamid[100], flags[8];
+	long long start, end;
+	int size, rc;
+
+	for (;;) {
+		if ((fakedl_readn(fd, header, 3) < 0) || (header[0] != 'D') || (header[1] != 'L'))
+			return;
+		size = (unsigned char) header[2];
+		if (fakedl_readn(fd, header, (size_t) size) < 0)
+			return;
+		header[size] = '\0';
+
+		if (strncmp(header, "ID ", 3) == 0) {
+			if (fakedl_reply(fd, "ID DataLink 2014.269 :: DLPROTO:1.0 PACKETSIZE:512 WRITE") < 0)
+				return;
+			continue;
+		}
+		if ((sscanf(header, "WRITE %99s %lld %lld %7s %d", streamid, &start, &end, flags, &size) != 5) ||
+				(size < 0) || (size > FAKEDL_MAXDATA) || (fakedl_readn(fd, dl->data, (size_t) size) < 0))
+			return;
+
+		if ((rc = dl->handler(streamid, start, end, dl->data, size, dl->arg)) != FAKEDL_OK) {
+			atomic_fetch_add(&dl->drops, 1);
+			if (rc == FAKEDL_HANG) {
+				pthread_mutex_lock(&dl->lock);
+				dl->hung = 1;
+				pthread_cond_broadcast(&dl->cond);
+				while ((!dl->release) && (!dl->stop))
+					pthread_cond_wait(&dl->cond, &dl->lock);
+				dl->hung = 0; dl->release = 0;
+				pthread_mutex_unlock(&dl->lock);
+			}
+			fakedl_hangup(fd);
+			return;
+		}
+		atomic_fetch_add(&dl->records, 1);
+
+		if (strchr(flags, 'A') != NULL) {
+			if (dl->latency > 0)
+				usleep((useconds_t) dl->latency);
+			if (fakedl_reply(fd, "OK 0 0") < 0)
+				return;
+		}
+	}
+}
+
+static void *fakedl_thread(void *arg) {
+	fakedl_t *dl = (fakedl_t *) arg;
+	int fd;
+
+	while ((fd = accept(dl->listener, NULL, NULL)) >= 0) {
+		pthread_mutex_lock(&dl->lock);
+		if (dl->stop) {
+			pthread_mutex_unlock(&dl->lock);
+			close(fd); break;
+		}
+		dl->fd = fd;
+		pthread_mutex_unlock(&dl->lock);
+
+		atomic_fetch_add(&dl->connections, 1);
+		fakedl_serve(dl, fd);
+
+		pthread_mutex_lock(&dl->lock);
+		dl->fd = -1;
+		pthread_mutex_unlock(&dl->lock);
+		close(fd);
+	}
+
+	return NULL;
+}
+
+/* listen on a free loopback port, the address to connect to is left in dl->address */
+int fakedl_start(fakedl_t *dl, fakedl_handler_t handler, void *arg, int latency) {
+	struct sockaddr_in addr;
+	socklen_t len = sizeof(addr);
+
+	memset(dl, 0, sizeof(fakedl_t));
+	dl->handler = handler;
+	dl->arg = arg;
+	dl->latency = latency;
+	dl->fd = -1;
+	pthread_mutex_init(&dl->lock, NULL);
+	pthread_cond_init(&dl->cond, NULL);
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	if (((dl->listener = socket(AF_INET, SOCK_STREAM, 0)) < 0) ||
+			(bind(dl->listener, (struct sockaddr *) &addr, sizeof(addr)) < 0) ||
+			(listen(dl->listener, 4) < 0) || (getsockname(dl->listener, (struct sockaddr *) &addr, &len) < 0)) {
+		ms_log (2, "unable to listen: %s\n", strerror(errno));
+		if (dl->listener >= 0)
+			close(dl->listener);
+		return -1;
+	}
+	snprintf(dl->address, sizeof(dl->address), "127.0.0.1:%d", ntohs(addr.sin_port));
+
+	if (pthread_create(&dl->thread, NULL, fakedl_thread, dl) != 0) {
+		ms_log (2, "unable to start datalink server\n");
+		close(dl->listener); return -1;
+	}
+
+	return 0;
+}
+
+/* wait for a write to be hung */
+void fakedl_hung(fakedl_t *dl) {
+	pthread_mutex_lock(&dl->lock);
+	while (!dl->hung)
+		pthread_cond_wait(&dl->cond, &dl->lock);
+	pthread_mutex_unlock(&dl->lock);
+}
+
+/* let a hung write go on to drop its connection */
+void fakedl_release(fakedl_t *dl) {
+	pthread_mutex_lock(&dl->lock);
+	dl->release = 1;
+	pthread_cond_broadcast(&dl->cond);
+	pthread_mutex_unlock(&dl->lock);
+}
+
+void fakedl_stop(fakedl_t *dl) {
+	pthread_mutex_lock(&dl->lock);
+	dl->stop = 1;
+	pthread_cond_broadcast(&dl->cond);
+	if (dl->fd >= 0)
+		(void) shutdown(dl->fd, SHUT_RDWR);
+	pthread_mutex_unlock(&dl->lock);
+
+	(void) shutdown(dl->listener, SHUT_RDWR);
+	pthread_join(dl->thread, NULL);
+	close(dl->listener);
+
+	pthread_mutex_destroy(&dl->lock);
+	pthread_cond_destroy(&dl->cond);
+}
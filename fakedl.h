@@ -0,0 +1,77 @@
+/*
+ * Copyright (c) 2014 Institute of Geological & Nuclear Sciences Ltd.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *		notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *		notice, this list of conditions and the following disclaimer in the
+ *		documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#ifndef _FAKEDL_H
+#define _FAKEDL_H
+
+/*
+ * fakedl: a stand-in datalink server on the loopback interface, taking
+ * one client at a time. Each write is handed to a callback which can
+ * accept it, drop the connection there, or hang until released, as a
+ * stalled server would. Acknowledgements can be held back to mimic a
+ * slow or distant server.
+ *
+ */
+
+#include <stdatomic.h>
+#include <pthread.h>
+
+/* what to do with a write, as returned by the handler */
+#define FAKEDL_OK 0
+#define FAKEDL_HANG 1 /* stop answering until released, then drop the connection */
+#define FAKEDL_DROP 2
+
+#define FAKEDL_MAXDATA 16384
+
+typedef int (*fakedl_handler_t)(const char *streamid, long long start, long long end, const char *data, int size, void *arg);
+
+typedef struct fakedl_s {
+	int listener;
+	char address[64]; /* host:port to give the client */
+	pthread_t thread;
+
+	fakedl_handler_t handler;
+	void *arg;
+	int latency; /* microseconds before each acknowledgement */
+
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	int hung, release;
+	int fd; /* the current client */
+	int stop;
+	char data[FAKEDL_MAXDATA]; /* the write being handled */
+
+	atomic_ulong records;
+	atomic_ulong drops;
+	atomic_ulong connections;
+} fakedl_t;
+
+extern int fakedl_start(fakedl_t *dl, fakedl_handler_t handler, void *arg, int latency);
+extern void fakedl_hung(fakedl_t *dl);
+extern void fakedl_release(fakedl_t *dl);
+extern void fakedl_stop(fakedl_t *dl);
+
+#endif /* _FAKEDL_H */
@@ -0,0 +1,270 @@
+/*
+ * Copyright (c) 2014 Institute of Geological & Nuclear Sciences Ltd.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *		notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *		notice, this list of conditions and the following disclaimer in the
+ *		documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+/* system includes */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <poll.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+
+#include <libmseed.h>
+
+#include "fakesl.h"
+
+/* commands from the client, one per line */
+typedef struct fakesl_reader_s {
+	char buf[1024];
+	size_t have;
+} fakesl_reader_t;
+
+static uint64_t fakesl_now(void) {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static int fakesl_send(int fd, const char *buf, size_t len) {
+	ssize_t n;
+
+	while (len > 0) {
+		if ((n = send(fd, buf, len, MSG_NOSIGNAL)) <= 0)
+			return -1;
+		buf += n; len -= (size_t) n;
+	}
+
+	return 0;
+}
+
+/* the next non empty line, ended by a carriage return or a newline */
+static int fakesl_readline(fakesl_reader_t *reader, int fd, char *line, size_t size) {
+	size_t n;
+	ssize_t got;
+
+	for (;;) {
+		for (n = 0; n < reader->have; n++) {
+			if ((reader->buf[n] != '\r') && (reader->buf[n] != '\n'))
+				continue;
+			if (n > 0) {
+				if (n >= size)
+					return -1;
+				memcpy(line, reader->buf, n);
+				line[n] = '\0';
+			}
+			memmove(reader->buf, reader->buf + n + 1, reader->have - n - 1);
+			reader->have -= n + 1;
+			if (n > 0)
+				return 0;
+			n = (size_t) -1;
+		}
+		if (reader->have == sizeof(reader->buf))
+			return -1;
+		if ((got = read(fd, reader->buf + reader->have, sizeof(reader->buf) - reader->have)) <= 0)
+			return -1;
+		reader->have += (size_t) got;
+	}
+}
+
+/* hello, then stations, selectors and data requests, until END */
+static int fakesl_negotiate(int fd) {
+	fakesl_reader_t reader;
+	char line[256];
+
+	reader.have = 0;
+	for (;;) {
+		if (fakesl_readline(&reader, fd, line, sizeof(line)) < 0)
+			return -1;
+		if (strncasecmp(line, "HELLO", 5) == 0) {
+			if (fakesl_send(fd, "SeedLink v3.0 (fakesl) :: SLPROTO:3.0\r\nfakesl\r\n", 47) < 0)
+				return -1;
+		}
+		else if (strncasecmp(line, "END", 3) == 0) {
+			return 0;
+		}
+		else if (strncasecmp(line, "BYE", 3) == 0) {
+			return -1;
+		}
+		else if (strncasecmp(line, "INFO", 4) != 0) {
+			if (fakesl_send(fd, "OK\r\n", 4) < 0)
+				return -1;
+		}
+	}
+}
+
+/* wait up to the given microseconds, -1 once the client has gone */
+static int fakesl_idle(int fd, uint64_t wait) {
+	struct pollfd pfd;
+	char buf[256];
+
+	pfd.fd = fd;
+	pfd.events = POLLIN;
+	pfd.revents = 0;
+	if (poll(&pfd, 1, (int) (wait / 1000)) <= 0)
+		return 0;
+
+	/* keepalives and the like are read and ignored */
+	if (read(fd, buf, sizeof(buf) - 1) <= 0)
+		return -1;
+
+	return 0;
+}
+
+static void fakesl_serve(fakesl_t *sl, int fd) {
+	char packet[8 + FAKESL_RECLEN + 1];
+	uint64_t start, due, now;
+	unsigned long n, sent = 0;
+
+	if (fakesl_negotiate(fd) < 0)
+		return;
+	start = fakesl_now();
+	atomic_store(&sl->connected, start);
+
+	for (;;) {
+		pthread_mutex_lock(&sl->lock);
+		if (sl->stop) {
+			pthread_mutex_unlock(&sl->lock); return;
+		}
+		pthread_mutex_unlock(&sl->lock);
+
+		/* keep to the rate, listening to the client in between */
+		if (sl->rate > 0.0) {
+			due = start + (uint64_t) ((double) sent * 1.0e6 / sl->rate);
+			if ((now = fakesl_now()) < due) {
+				if (due - now >= 1000) {
+					if (fakesl_idle(fd, (due - now > 100000) ? 100000 : due - now) < 0)
+						return;
+				}
+				else {
+					usleep((useconds_t) (due - now));
+				}
+				continue;
+			}
+		}
+		else if (fakesl_idle(fd, 0) < 0) {
+			return;
+		}
+
+		/* with nothing to send, look again in a while */
+		n = atomic_load(&sl->next);
+		if (sl->source(n, packet + 8, sl->arg) < 0) {
+			atomic_store(&sl->done, 1);
+			if (fakesl_idle(fd, 100000) < 0)
+				return;
+			continue;
+		}
+		atomic_store(&sl->done, 0);
+		snprintf(packet, 9, "SL%06lX", (n + 1) & 0xFFFFFF);
+		if (fakesl_send(fd, packet, 8 + FAKESL_RECLEN) < 0)
+			return;
+		atomic_store(&sl->next, n + 1);
+		sent++;
+	}
+}
+
+static void *fakesl_thread(void *arg) {
+	fakesl_t *sl = (fakesl_t *) arg;
+	int fd;
+
+	while ((fd = accept(sl->listener, NULL, NULL)) >= 0) {
+		pthread_mutex_lock(&sl->lock);
+		if (sl->stop) {
+			pthread_mutex_unlock(&sl->lock);
+			close(fd); break;
+		}
+		sl->fd = fd;
+		pthread_mutex_unlock(&sl->lock);
+
+		atomic_fetch_add(&sl->connections, 1);
+		fakesl_serve(sl, fd);
+
+		pthread_mutex_lock(&sl->lock);
+		sl->fd = -1;
+		pthread_mutex_unlock(&sl->lock);
+		close(fd);
+	}
+
+	return NULL;
+}
+
+/* listen on a free loopback port, the address to connect to is left in sl->address */
+int fakesl_start(fakesl_t *sl, fakesl_source_t source, void *arg, double rate) {
+	struct sockaddr_in addr;
+	socklen_t len = sizeof(addr);
+
+	memset(sl, 0, sizeof(fakesl_t));
+	sl->source = source;
+	sl->arg = arg;
+	sl->rate = rate;
+	sl->fd = -1;
+	pthread_mutex_init(&sl->lock, NULL);
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	if (((sl->listener = socket(AF_INET, SOCK_STREAM, 0)) < 0) ||
+			(bind(sl->listener, (struct sockaddr *) &addr, sizeof(addr)) < 0) ||
+			(listen(sl->listener, 4) < 0) || (getsockname(sl->listener, (struct sockaddr *) &addr, &len) < 0)) {
+		ms_log (2, "unable to listen: %s\n", strerror(errno));
+		if (sl->listener >= 0)
+			close(sl->listener);
+		return -1;
+	}
+	snprintf(sl->address, sizeof(sl->address), "127.0.0.1:%d", ntohs(addr.sin_port));
+
+	if (pthread_create(&sl->thread, NULL, fakesl_thread, sl) != 0) {
+		ms_log (2, "unable to start seedlink server\n");
+		close(sl->listener); return -1;
+	}
+
+	return 0;
+}
+
+/* start again from the first packet, for the next client */
+void fakesl_rewind(fakesl_t *sl) {
+	atomic_store(&sl->next, 0);
+	atomic_store(&sl->done, 0);
+}
+
+void fakesl_stop(fakesl_t *sl) {
+	pthread_mutex_lock(&sl->lock);
+	sl->stop = 1;
+	if (sl->fd >= 0)
+		(void) shutdown(sl->fd, SHUT_RDWR);
+	pthread_mutex_unlock(&sl->lock);
+
+	(void) shutdown(sl->listener, SHUT_RDWR);
+	pthread_join(sl->thread, NULL);
+	close(sl->listener);
+
+	pthread_mutex_destroy(&sl->lock);
+}
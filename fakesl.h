@@ -0,0 +1,75 @@
+/*
+ * Copyright (c) 2014 Institute of Geological & Nuclear Sciences Ltd.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *		notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *		notice, this list of conditions and the following disclaimer in the
+ *		documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#ifndef _FAKESL_H
+#define _FAKESL_H
+
+/*
+ * fakesl: a stand-in seedlink server on the loopback interface, taking
+ * one client at a time in multi-station mode. Once the client has sent
+ * END it is fed packets from a callback, at a given rate or as fast as
+ * it will take them, each with the next sequence number. The station
+ * and selector requests are acknowledged but not applied, and where a
+ * client resumes is ignored, a new connection carries on from the last
+ * packet sent. With nothing more to send the server keeps the
+ * connection open and idle, as a real one would, and carries on should
+ * the callback come to have more.
+ *
+ */
+
+#include <stdint.h>
+#include <stdatomic.h>
+#include <pthread.h>
+
+#define FAKESL_RECLEN 512
+
+/* fill in packet n, or return -1 once there are no more */
+typedef int (*fakesl_source_t)(unsigned long n, char *record, void *arg);
+
+typedef struct fakesl_s {
+	int listener;
+	char address[64]; /* host:port to give the client */
+	pthread_t thread;
+
+	fakesl_source_t source;
+	void *arg;
+	double rate; /* packets per second, zero as fast as possible */
+
+	pthread_mutex_t lock;
+	int fd; /* the current client */
+	int stop;
+
+	atomic_ulong next; /* packet to send */
+	atomic_int done; /* the callback had nothing more to send */
+	atomic_ulong connections;
+	_Atomic uint64_t connected; /* when the last client started streaming, monotonic microseconds */
+} fakesl_t;
+
+extern int fakesl_start(fakesl_t *sl, fakesl_source_t source, void *arg, double rate);
+extern void fakesl_rewind(fakesl_t *sl);
+extern void fakesl_stop(fakesl_t *sl);
+
+#endif /* _FAKESL_H */
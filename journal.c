@@ -0,0 +1,301 @@
+/*
+ * Copyright (c) 2014 Institute of Geological & Nuclear Sciences Ltd.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *		notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *		notice, this list of conditions and the following disclaimer in the
+ *		documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+/* system includes */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <libmseed.h>
+
+#include "journal.h"
+
+#define JOURNAL_ALIGN(x) (((x) + 7) & ~((uint64_t) 7))
+
+/*
+ * open, or recover, a journal file. Anything appended after the last
+ * checkpoint is discarded, seedlink will resend the packets it came from.
+ * Those records already delivered are remembered, so that when they are
+ * produced again they are matched against what was sent and skipped.
+ * If a save was begun but not known to be written, which statefile seedlink
+ * resumes from is only told by the first record produced, see journal_resolve.
+ */
+int journal_open(journal_t *journal, const char *path, uint64_t size) {
+	struct stat st;
+	journal_header_t *hdr;
+	uint64_t head, tail, delivered;
+
+	memset(journal, 0, sizeof(journal_t));
+
+	size = JOURNAL_ALIGN(size);
+	if (size < 2 * (sizeof(journal_entry_t) + MAXRECLEN)) {
+		ms_log (2, "journal size too small: %llu\n", (unsigned long long) size); return -1;
+	}
+
+	if ((journal->fd = open(path, O_RDWR | O_CREAT, 0644)) < 0) {
+		ms_log (2, "unable to open journal [%s]: %s\n", path, strerror(errno)); return -1;
+	}
+	if (fstat(journal->fd, &st) < 0) {
+		ms_log (2, "unable to stat journal [%s]: %s\n", path, strerror(errno)); close(journal->fd); return -1;
+	}
+
+	journal->mapsize = JOURNAL_HEADER + size;
+	if ((st.st_size != (off_t) journal->mapsize) && (ftruncate(journal->fd, (off_t) journal->mapsize) < 0)) {
+		ms_log (2, "unable to size journal [%s]: %s\n", path, strerror(errno)); close(journal->fd); return -1;
+	}
+
+	if ((journal->map = mmap(NULL, journal->mapsize, PROT_READ | PROT_WRITE, MAP_SHARED, journal->fd, 0)) == MAP_FAILED) {
+		ms_log (2, "unable to map journal [%s]: %s\n", path, strerror(errno)); close(journal->fd); return -1;
+	}
+
+	hdr = journal->hdr = (journal_header_t *) journal->map;
+	journal->data = journal->map + JOURNAL_HEADER;
+
+	if ((st.st_size == (off_t) journal->mapsize) && (memcmp(hdr->magic, JOURNAL_MAGIC, 8) == 0) && (hdr->size == size)) {
+		head = atomic_load(&hdr->checkpoint);
+		tail = atomic_load(&hdr->tail);
+		delivered = atomic_load(&hdr->delivered);
+		if (atomic_load(&hdr->saving) > head) {
+			journal->saving = atomic_load(&hdr->saving);
+			journal->lasthead = atomic_load(&hdr->head);
+			journal->lasttail = tail;
+		}
+		if (tail > delivered)
+			delivered = tail;
+		atomic_store(&hdr->delivered, (delivered > head) ? delivered : 0);
+		if (tail > head)
+			atomic_store(&hdr->tail, head);
+		atomic_store(&hdr->head, head);
+		if (msync(journal->map, JOURNAL_HEADER, MS_SYNC) < 0) {
+			ms_log (2, "unable to sync journal header [%s]: %s\n", path, strerror(errno)); journal_close(journal); return -1;
+		}
+	}
+	else {
+		if (st.st_size > 0)
+			ms_log (1, "journal [%s] unrecognised or resized, starting afresh\n", path);
+		memcpy(hdr->magic, JOURNAL_MAGIC, 8);
+		hdr->size = size;
+		atomic_store(&hdr->head, 0);
+		atomic_store(&hdr->tail, 0);
+		atomic_store(&hdr->checkpoint, 0);
+		atomic_store(&hdr->delivered, 0);
+		atomic_store(&hdr->saving, 0);
+	}
+
+	journal->next = atomic_load(&hdr->tail);
+
+	return 0;
+}
+
+void journal_close(journal_t *journal) {
+	if (journal->map != NULL) {
+		(void) msync(journal->map, journal->mapsize, MS_SYNC);
+		(void) munmap(journal->map, journal->mapsize);
+	}
+	if (journal->fd >= 0)
+		close(journal->fd);
+
+	memset(journal, 0, sizeof(journal_t));
+	journal->fd = -1;
+}
+
+/* is the entry already at this position the same record, one delivered before a restart */
+static int journal_same(const journal_entry_t *entry, uint64_t length, const char *streamid, hptime_t starttime, hptime_t endtime, const char *record, int reclen) {
+	return ((entry->length == (uint32_t) length) && (entry->reclen == reclen) &&
+		(strncmp(entry->streamid, streamid, JOURNAL_STREAMID - 1) == 0) &&
+		(entry->starttime == starttime) && (entry->endtime == endtime) &&
+		(memcmp((const char *) entry + sizeof(journal_entry_t), record, reclen) == 0));
+}
+
+/*
+ * after a restart with a save that may not have been written, the first record
+ * produced is the one following whichever statefile seedlink resumed from. If it
+ * is the record at the checkpoint the save was lost, and everything after the
+ * checkpoint is produced again. Otherwise the save was written, and the records
+ * up to where it began are kept, sending those not yet delivered, as is done too
+ * when the entry at the checkpoint has since been overwritten and cannot tell.
+ */
+static void journal_resolve(journal_t *journal, const char *streamid, hptime_t starttime, hptime_t endtime, const char *record, int reclen) {
+	journal_header_t *hdr = journal->hdr;
+	journal_entry_t *entry;
+	uint64_t head = atomic_load(&hdr->head);
+	uint64_t length = JOURNAL_ALIGN(sizeof(journal_entry_t) + reclen);
+	uint64_t offset = head % hdr->size;
+
+	entry = (journal_entry_t *) (journal->data + offset);
+	if ((entry->reclen < 0) && (entry->length == hdr->size - offset))
+		entry = (journal_entry_t *) journal->data;
+
+	if ((journal->lasthead > hdr->size + head) || (!journal_same(entry, length, streamid, starttime, endtime, record, reclen))) {
+		/* the records delivered before the restart need not be read again, the consumer moves on past them */
+		if (journal->lasttail > head)
+			atomic_store(&hdr->tail, (journal->lasttail < journal->saving) ? journal->lasttail : journal->saving);
+		atomic_store(&hdr->checkpoint, journal->saving);
+		atomic_store(&hdr->head, journal->saving);
+	}
+	atomic_store(&hdr->saving, atomic_load(&hdr->checkpoint));
+	(void) msync(journal->map, JOURNAL_HEADER, MS_SYNC);
+
+	journal->saving = 0;
+}
+
+/* add a record, returns 1 if there is no room for it, producer only */
+int journal_append(journal_t *journal, const char *streamid, hptime_t starttime, hptime_t endtime, hptime_t queued, const char *record, int reclen) {
+	journal_header_t *hdr = journal->hdr;
+	journal_entry_t *entry;
+	uint64_t head, tail, length, offset, pad = 0;
+
+	if ((reclen < 0) || (reclen > MAXRECLEN))
+		return -1;
+
+	if (journal->saving > 0)
+		journal_resolve(journal, streamid, starttime, endtime, record, reclen);
+
+	head = atomic_load(&hdr->head);
+	tail = atomic_load(&hdr->tail);
+	length = JOURNAL_ALIGN(sizeof(journal_entry_t) + reclen);
+	offset = head % hdr->size;
+
+	/* records never wrap, pad out the end of the data area */
+	if (offset + length > hdr->size)
+		pad = hdr->size - offset;
+
+	if ((head + pad + length) - tail > hdr->size)
+		return 1;
+
+	/* while records delivered before a restart are being produced again, stop skipping at the first that differs */
+	if ((head < atomic_load(&hdr->delivered)) && ((head + pad + length > atomic_load(&hdr->delivered)) ||
+			((pad > 0) && (((journal_entry_t *) (journal->data + offset))->length != (uint32_t) pad)) ||
+			(!journal_same((journal_entry_t *) (journal->data + (head + pad) % hdr->size), length, streamid, starttime, endtime, record, reclen))))
+		atomic_store(&hdr->delivered, head);
+
+	if (pad > 0) {
+		entry = (journal_entry_t *) (journal->data + offset);
+		entry->length = (uint32_t) pad;
+		entry->reclen = -1;
+		head += pad;
+		offset = 0;
+	}
+
+	entry = (journal_entry_t *) (journal->data + offset);
+	entry->length = (uint32_t) length;
+	entry->reclen = reclen;
+	strncpy(entry->streamid, streamid, JOURNAL_STREAMID - 1);
+	entry->streamid[JOURNAL_STREAMID - 1] = '\0';
+	entry->starttime = starttime;
+	entry->endtime = endtime;
+	entry->queued = queued;
+	memcpy((char *) entry + sizeof(journal_entry_t), record, reclen);
+
+	/* publish only once the entry is complete */
+	atomic_store(&hdr->head, head + length);
+
+	return 0;
+}
+
+/*
+ * the next undelivered record, valid until it is released, sets the
+ * position to release once delivered, consumer only
+ */
+const journal_entry_t *journal_next(journal_t *journal, uint64_t *end) {
+	journal_header_t *hdr = journal->hdr;
+	journal_entry_t *entry;
+
+	while (journal->next < atomic_load(&hdr->head)) {
+		/* moved on past records delivered before a restart, see journal_resolve */
+		if (journal->next < atomic_load(&hdr->tail)) {
+			journal->next = atomic_load(&hdr->tail);
+			continue;
+		}
+		entry = (journal_entry_t *) (journal->data + (journal->next % hdr->size));
+		journal->next += entry->length;
+		if (entry->reclen < 0)
+			continue;
+		/* delivered before a restart, these all come before anything still to send */
+		if (journal->next <= atomic_load(&hdr->delivered)) {
+			atomic_store(&hdr->tail, journal->next);
+			journal->skipped++;
+			continue;
+		}
+		*end = journal->next;
+		return entry;
+	}
+
+	return NULL;
+}
+
+/* mark everything before the given position as delivered */
+void journal_release(journal_t *journal, uint64_t end) {
+	atomic_store(&journal->hdr->tail, end);
+}
+
+/*
+ * flush appended records to disk, called just before the seedlink state is
+ * saved, setting the mark to pass to journal_checkpoint once it is written
+ */
+int journal_flush(journal_t *journal, uint64_t *mark) {
+	uint64_t head = atomic_load(&journal->hdr->head);
+
+	if (msync(journal->map, journal->mapsize, MS_SYNC) < 0) {
+		ms_log (2, "unable to sync journal: %s\n", strerror(errno)); return -1;
+	}
+
+	atomic_store(&journal->hdr->saving, head);
+	if (msync(journal->map, JOURNAL_HEADER, MS_SYNC) < 0) {
+		ms_log (2, "unable to sync journal header: %s\n", strerror(errno)); return -1;
+	}
+	*mark = head;
+
+	return 0;
+}
+
+/* the seedlink state saved at a mark has been written, records before it will not be produced again */
+int journal_checkpoint(journal_t *journal, uint64_t mark) {
+	if (mark <= atomic_load(&journal->hdr->checkpoint))
+		return 0;
+
+	atomic_store(&journal->hdr->checkpoint, mark);
+	if (msync(journal->map, JOURNAL_HEADER, MS_SYNC) < 0) {
+		ms_log (2, "unable to sync journal header: %s\n", strerror(errno)); return -1;
+	}
+
+	return 0;
+}
+
+/* bytes not yet delivered */
+uint64_t journal_pending(journal_t *journal) {
+	return atomic_load(&journal->hdr->head) - atomic_load(&journal->hdr->tail);
+}
+
+/* bytes not yet read, consumer only */
+uint64_t journal_unread(journal_t *journal) {
+	return atomic_load(&journal->hdr->head) - journal->next;
+}
@@ -0,0 +1,88 @@
+/*
+ * Copyright (c) 2014 Institute of Geological & Nuclear Sciences Ltd.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *		notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *		notice, this list of conditions and the following disclaimer in the
+ *		documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#ifndef _JOURNAL_H
+#define _JOURNAL_H
+
+/*
+ * journal: a memory mapped, circular, append only log of packed records
+ * waiting to be delivered, which survives restarts of the program.
+ *
+ */
+
+#include <stdint.h>
+#include <stdatomic.h>
+
+#include <libmseed.h>
+
+#define JOURNAL_MAGIC "SLCREXJ1"
+#define JOURNAL_HEADER 4096 /* header page, data follows */
+#define JOURNAL_STREAMID 100
+
+typedef struct journal_header_s {
+	char magic[8];
+	uint64_t size; /* bytes of data following the header */
+	_Atomic uint64_t head; /* end of the last appended record */
+	_Atomic uint64_t tail; /* end of the last delivered record */
+	_Atomic uint64_t checkpoint; /* head when the seedlink state was last saved */
+	_Atomic uint64_t delivered; /* end of the records delivered beyond the checkpoint before a restart, zero if none */
+	_Atomic uint64_t saving; /* head when a seedlink state save began, beyond the checkpoint until it is written */
+} journal_header_t;
+
+typedef struct journal_entry_s {
+	uint32_t length; /* entry length, including this header and padding */
+	int32_t reclen; /* record length, or -1 for wrap padding */
+	char streamid[JOURNAL_STREAMID];
+	hptime_t starttime;
+	hptime_t endtime;
+	hptime_t queued;
+} journal_entry_t;
+
+typedef struct journal_s {
+	int fd;
+	char *map;
+	size_t mapsize;
+	journal_header_t *hdr;
+	char *data;
+	uint64_t next; /* next record to read, consumer only */
+	uint64_t skipped; /* records found already delivered, consumer only */
+	uint64_t saving; /* a save begun before a restart that may or may not have been written, producer only */
+	uint64_t lasthead; /* head and tail before the restart */
+	uint64_t lasttail;
+} journal_t;
+
+extern int journal_open(journal_t *journal, const char *path, uint64_t size);
+extern void journal_close(journal_t *journal);
+
+extern int journal_append(journal_t *journal, const char *streamid, hptime_t starttime, hptime_t endtime, hptime_t queued, const char *record, int reclen);
+extern const journal_entry_t *journal_next(journal_t *journal, uint64_t *end);
+extern void journal_release(journal_t *journal, uint64_t end);
+extern int journal_flush(journal_t *journal, uint64_t *mark);
+extern int journal_checkpoint(journal_t *journal, uint64_t mark);
+extern uint64_t journal_pending(journal_t *journal);
+extern uint64_t journal_unread(journal_t *journal);
+
+#endif /* _JOURNAL_H */
@@ -0,0 +1,249 @@
+/*
+ * Copyright (c) 2014 Institute of Geological & Nuclear Sciences Ltd.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *		notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *		notice, this list of conditions and the following disclaimer in the
+ *		documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+/*
+ * journal_test: replay a journal against a fake datalink server, with
+ * a crash after records beyond the last checkpoint have been delivered
+ * and a dropped connection while the replay is being sent. The crash
+ * also comes while a save is under way, either before its statefile is
+ * written or after, with the checkpoint not yet moved on. Every record
+ * must reach the server once, in order.
+ *
+ * Run by "make test".
+ */
+
+/* system includes */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <signal.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/wait.h>
+
+#include <libmseed.h>
+#include <libdali.h>
+
+#include "journal.h"
+#include "writer.h"
+#include "fakedl.h"
+
+#define TEST_RECORDS 100
+#define TEST_DROP 90 /* the server drops the connection here during the replay */
+#define TEST_RECLEN 512
+#define TEST_JOURNAL (4 << 20)
+
+/* records covered by each save, where the client is killed, and where seedlink resumes */
+typedef struct test_case_s {
+	int saved; /* statefile written and checkpoint moved on */
+	int saving; /* a later save begun, not known to be written */
+	int crash; /* the server stops answering here */
+	int resume;
+	const char *what;
+} test_case_t;
+
+static test_case_t cases[] = {
+	{50, 0, 80, 50, "crash after the checkpoint"},
+	{30, 50, 80, 30, "crash before the statefile is written"},
+	{30, 50, 40, 50, "crash after the statefile is written"},
+	{0, 0, 0, 0, NULL}
+};
+
+/* the fault to inject at a given record */
+static struct {
+	pthread_mutex_t lock;
+	int fault, at;
+	int received[TEST_RECORDS];
+	int order[TEST_RECORDS * 2];
+	int count;
+} server = {PTHREAD_MUTEX_INITIALIZER, FAKEDL_OK, 0, {0}, {0}, 0};
+
+static fakedl_t dl;
+
+static int handler(const char *streamid, long long start, long long end, const char *data, int size, void *arg) {
+	int seq, fault = FAKEDL_OK;
+
+	if (size != TEST_RECLEN)
+		return FAKEDL_DROP;
+	seq = atoi(data);
+
+	pthread_mutex_lock(&server.lock);
+	if ((server.fault != FAKEDL_OK) && (seq == server.at)) {
+		fault = server.fault;
+		server.fault = FAKEDL_OK;
+	}
+	else {
+		if ((seq >= 0) && (seq < TEST_RECORDS))
+			server.received[seq]++;
+		if (server.count < TEST_RECORDS * 2)
+			server.order[server.count++] = seq;
+	}
+	pthread_mutex_unlock(&server.lock);
+
+	return fault;
+}
+
+/* what a converter would produce for the given record, the same each time */
+static void produce(const char *address, const char *path, int first, int window, int saved, int saving) {
+	char record[TEST_RECLEN];
+	journal_t journal;
+	writer_t writer;
+	uint64_t mark;
+	DLCP *dlconn;
+	int n;
+
+	if (((dlconn = dl_newdlcp((char *) address, "journal_test")) == NULL) || (dl_connect(dlconn) < 0)) {
+		ms_log (2, "unable to connect to [%s]\n", address); _exit(1);
+	}
+	if ((journal_open(&journal, path, TEST_JOURNAL) < 0) ||
+			(writer_start(&writer, dlconn, 1, WRITER_BLOCK, NULL, &journal, 1, window, 0) < 0))
+		_exit(1);
+
+	for (n = first; n < TEST_RECORDS; n++) {
+		memset(record, 0, sizeof(record));
+		snprintf(record, sizeof(record), "%d", n);
+		if (writer_push(&writer, record, TEST_RECLEN, "NZ_TEST_40_BTT/MSEED", (hptime_t) n * HPTMODULUS, (hptime_t) (n + 1) * HPTMODULUS) < 0)
+			_exit(1);
+		if ((n + 1 == saved) && (journal_flush(&journal, &mark) == 0))
+			(void) journal_checkpoint(&journal, mark);
+		if (n + 1 == saving)
+			(void) journal_flush(&journal, &mark);
+	}
+
+	writer_stop(&writer);
+	journal_close(&journal);
+	dl_disconnect(dlconn);
+
+	_exit(0);
+}
+
+/*
+ * wait for the client to take in every acknowledgement sent before the
+ * server stopped, a record whose acknowledgement never arrived is sent
+ * again, and for every record to have been journalled
+ */
+static int acknowledged(const char *path, int records) {
+	uint64_t length = (sizeof(journal_entry_t) + TEST_RECLEN + 7) & ~((uint64_t) 7);
+	uint64_t end = (uint64_t) records * length;
+	journal_header_t hdr;
+	int fd, n;
+
+	for (n = 0; n < 1000; n++) {
+		if ((fd = open(path, O_RDONLY)) < 0)
+			return -1;
+		if (pread(fd, &hdr, sizeof(hdr), 0) != (ssize_t) sizeof(hdr)) {
+			close(fd); return -1;
+		}
+		close(fd);
+		if ((atomic_load(&hdr.tail) >= end) && (atomic_load(&hdr.head) == TEST_RECORDS * length))
+			return 0;
+		usleep(10000);
+	}
+
+	return -1;
+}
+
+static void inject(int fault, int at) {
+	pthread_mutex_lock(&server.lock);
+	server.fault = fault;
+	server.at = at;
+	pthread_mutex_unlock(&server.lock);
+}
+
+static int run(const char *address, test_case_t *test, int window) {
+	char path[] = "/tmp/journal_testXXXXXX";
+	int n, fd, status, failed = 0;
+	pid_t pid;
+
+	if ((fd = mkstemp(path)) < 0) {
+		ms_log (2, "unable to create journal: %s\n", strerror(errno)); return -1;
+	}
+	close(fd);
+
+	pthread_mutex_lock(&server.lock);
+	memset(server.received, 0, sizeof(server.received));
+	server.count = 0;
+	pthread_mutex_unlock(&server.lock);
+
+	/* deliver up to the crash, then crash while waiting on the server */
+	inject(FAKEDL_HANG, test->crash);
+	if ((pid = fork()) == 0)
+		produce(address, path, 0, window, test->saved, test->saving);
+	fakedl_hung(&dl);
+	if (acknowledged(path, test->crash) < 0) {
+		ms_log (2, "%s, window %d: acknowledgements not taken in\n", test->what, window); failed = 1;
+	}
+	kill(pid, SIGKILL);
+	(void) waitpid(pid, &status, 0);
+	fakedl_release(&dl);
+
+	/* restart from the statefile, as seedlink would, and lose the connection once */
+	inject(FAKEDL_DROP, TEST_DROP);
+	if ((pid = fork()) == 0)
+		produce(address, path, test->resume, window, 0, 0);
+	if ((waitpid(pid, &status, 0) < 0) || (!WIFEXITED(status)) || (WEXITSTATUS(status) != 0)) {
+		ms_log (2, "%s, window %d: replay did not finish\n", test->what, window); failed = 1;
+	}
+	unlink(path);
+
+	for (n = 0; n < TEST_RECORDS; n++) {
+		if (server.received[n] != 1) {
+			ms_log (2, "%s, window %d: record %d received %d times\n", test->what, window, n, server.received[n]); failed = 1;
+		}
+	}
+	for (n = 1; n < server.count; n++) {
+		if (server.order[n] <= server.order[n - 1]) {
+			ms_log (2, "%s, window %d: record %d received after %d\n", test->what, window, server.order[n], server.order[n - 1]); failed = 1; break;
+		}
+	}
+
+	ms_log (0, "%s, window %d: %d records received, %s\n", test->what, window, server.count, (failed) ? "FAILED" : "ok");
+
+	return (failed) ? -1 : 0;
+}
+
+int main(void) {
+	test_case_t *test;
+	int failed = 0;
+
+	signal(SIGPIPE, SIG_IGN);
+
+	if (fakedl_start(&dl, handler, NULL, 0) < 0)
+		exit(-1);
+
+	for (test = cases; test->what != NULL; test++) {
+		if (run(dl.address, test, 1) < 0)
+			failed = 1;
+		if (run(dl.address, test, 4) < 0)
+			failed = 1;
+	}
+
+	fakedl_stop(&dl);
+
+	return (failed) ? 1 : 0;
+}
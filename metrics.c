@@ -0,0 +1,236 @@
+/*
+ * Copyright (c) 2014 Institute of Geological & Nuclear Sciences Ltd.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *		notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *		notice, this list of conditions and the following disclaimer in the
+ *		documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+/* system includes */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <poll.h>
+#include <netdb.h>
+#include <sys/socket.h>
+
+#include <libmseed.h>
+
+#include "metrics.h"
+
+uint64_t metrics_now(void) {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+/* resident set size of the process, in bytes, or -1 if unknown */
+long metrics_resident(void) {
+	long pages, resident = -1;
+	FILE *fp;
+
+	if ((fp = fopen("/proc/self/statm", "r")) == NULL)
+		return -1;
+	if (fscanf(fp, "%ld %ld", &pages, &resident) != 2)
+		resident = -1;
+	fclose(fp);
+
+	return (resident < 0) ? -1 : resident * sysconf(_SC_PAGESIZE);
+}
+
+/* four buckets per power of two, the first four are a microsecond wide */
+static int metrics_bucket(uint64_t usec) {
+	int e, b;
+
+	if (usec < 4)
+		return (int) usec;
+
+	e = 63 - __builtin_clzll(usec);
+	b = (e - 1) * 4 + (int) ((usec >> (e - 2)) & 3);
+
+	return (b < METRICS_BUCKETS) ? b : METRICS_BUCKETS - 1;
+}
+
+/* the exclusive upper bound of a bucket */
+static uint64_t metrics_upper(int b) {
+	int e = b / 4 + 1;
+
+	if (b < 4)
+		return (uint64_t) b + 1;
+
+	return ((uint64_t) (4 + b % 4) + 1) << (e - 2);
+}
+
+void metrics_observe(metrics_histogram_t *hist, uint64_t usec) {
+	atomic_fetch_add_explicit(&hist->buckets[metrics_bucket(usec)], 1, memory_order_relaxed);
+	atomic_fetch_add_explicit(&hist->count, 1, memory_order_relaxed);
+	atomic_fetch_add_explicit(&hist->sum, (unsigned long) usec, memory_order_relaxed);
+}
+
+void metrics_counter(FILE *fp, const char *name, const char *help, unsigned long value) {
+	fprintf(fp, "# HELP %s %s\n# TYPE %s counter\n%s %lu\n", name, help, name, name, value);
+}
+
+void metrics_gauge(FILE *fp, const char *name, const char *help, double value) {
+	fprintf(fp, "# HELP %s %s\n# TYPE %s gauge\n%s %g\n", name, help, name, name, value);
+}
+
+/*
+ * the buckets are summed over every copy, and reported at each power
+ * of two, along with the finer grained quantiles.
+ */
+void metrics_histogram(FILE *fp, const char *name, const char *help, metrics_histogram_t **hists, int nhists) {
+	static const double quantiles[] = { 0.5, 0.9, 0.99, 0.999 };
+	unsigned long buckets[METRICS_BUCKETS];
+	unsigned long count = 0, sum = 0, total = 0;
+	uint64_t le = 1;
+	int n, b, q;
+
+	memset(buckets, 0, sizeof(buckets));
+	for (n = 0; n < nhists; n++) {
+		for (b = 0; b < METRICS_BUCKETS; b++)
+			buckets[b] += atomic_load_explicit(&hists[n]->buckets[b], memory_order_relaxed);
+		sum += atomic_load_explicit(&hists[n]->sum, memory_order_relaxed);
+	}
+	for (b = 0; b < METRICS_BUCKETS; b++)
+		count += buckets[b];
+
+	fprintf(fp, "# HELP %s_seconds %s\n# TYPE %s_seconds histogram\n", name, help, name);
+	for (b = 0; b < METRICS_BUCKETS; b++) {
+		total += buckets[b];
+		/* the last bucket also holds anything larger */
+		if ((metrics_upper(b) == le) && (b < METRICS_BUCKETS - 1)) {
+			fprintf(fp, "%s_seconds_bucket{le=\"%g\"} %lu\n", name, (double) le / 1.0e6, total);
+			le *= 2;
+		}
+	}
+	fprintf(fp, "%s_seconds_bucket{le=\"+Inf\"} %lu\n", name, count);
+	fprintf(fp, "%s_seconds_sum %g\n%s_seconds_count %lu\n", name, (double) sum / 1.0e6, name, count);
+
+	fprintf(fp, "# HELP %s_quantile_seconds %s, bucket upper bound\n# TYPE %s_quantile_seconds gauge\n", name, help, name);
+	for (q = 0; q < (int) (sizeof(quantiles) / sizeof(double)); q++) {
+		for (b = 0, total = 0; b < METRICS_BUCKETS - 1; b++) {
+			total += buckets[b];
+			if ((double) total >= quantiles[q] * (double) count)
+				break;
+		}
+		fprintf(fp, "%s_quantile_seconds{quantile=\"%g\"} %g\n", name, quantiles[q], (count > 0) ? (double) metrics_upper(b) / 1.0e6 : 0.0);
+	}
+}
+
+/* answer each connection with the current metrics, the request itself is not looked at */
+static void metrics_reply(metrics_server_t *server, int fd) {
+	static const char header[] = "HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\nConnection: close\r\n\r\n";
+	char request[1024];
+	char *body = NULL;
+	size_t size = 0, done;
+	struct pollfd pfd;
+	ssize_t len;
+	FILE *fp;
+
+	/* give the client a moment to send its request */
+	pfd.fd = fd; pfd.events = POLLIN;
+	if (poll(&pfd, 1, 1000) > 0)
+		(void) read(fd, request, sizeof(request));
+
+	if ((fp = open_memstream(&body, &size)) == NULL)
+		return;
+	fputs(header, fp);
+	server->render(fp, server->data);
+	fclose(fp);
+
+	for (done = 0; done < size; done += (size_t) len) {
+		if ((len = write(fd, body + done, size - done)) <= 0)
+			break;
+	}
+	free(body);
+}
+
+static void *metrics_thread(void *arg) {
+	metrics_server_t *server = (metrics_server_t *) arg;
+	struct pollfd pfd;
+	int fd;
+
+	pfd.fd = server->fd; pfd.events = POLLIN;
+	while (!atomic_load(&server->stop)) {
+		if (poll(&pfd, 1, 500) <= 0)
+			continue;
+		if ((fd = accept(server->fd, NULL, NULL)) < 0)
+			continue;
+		metrics_reply(server, fd);
+		close(fd);
+	}
+
+	return NULL;
+}
+
+/* listen on [host:]port, just a port means the loopback address and :port any address */
+int metrics_serve(metrics_server_t *server, const char *address, void (*render)(FILE *, void *), void *data) {
+	struct addrinfo hints, *res = NULL;
+	char host[256], *node, *port;
+	int on = 1, rc;
+
+	memset(server, 0, sizeof(metrics_server_t));
+	server->render = render;
+	server->data = data;
+
+	strncpy(host, address, sizeof(host) - 1); host[sizeof(host) - 1] = '\0';
+	if ((port = strrchr(host, ':')) != NULL) {
+		*port++ = '\0';
+		node = (strlen(host) > 0) ? host : NULL; /* any address */
+	}
+	else {
+		port = host;
+		node = "127.0.0.1";
+	}
+
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	hints.ai_flags = AI_PASSIVE;
+	if ((rc = getaddrinfo(node, port, &hints, &res)) != 0) {
+		ms_log (2, "unable to resolve metrics address [%s]: %s\n", address, gai_strerror(rc)); return -1;
+	}
+
+	if ((server->fd = socket(res->ai_family, res->ai_socktype, res->ai_protocol)) < 0) {
+		ms_log (2, "unable to open metrics socket\n"); freeaddrinfo(res); return -1;
+	}
+	(void) setsockopt(server->fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+	if ((bind(server->fd, res->ai_addr, res->ai_addrlen) < 0) || (listen(server->fd, 8) < 0)) {
+		ms_log (2, "unable to listen on metrics address [%s]\n", address); close(server->fd); freeaddrinfo(res); return -1;
+	}
+	freeaddrinfo(res);
+
+	if (pthread_create(&server->thread, NULL, metrics_thread, server) != 0) {
+		ms_log (2, "unable to start metrics thread\n"); close(server->fd); return -1;
+	}
+
+	return 0;
+}
+
+void metrics_stop(metrics_server_t *server) {
+	atomic_store(&server->stop, 1);
+	pthread_join(server->thread, NULL);
+	close(server->fd);
+}
@@ -0,0 +1,74 @@
+/*
+ * Copyright (c) 2014 Institute of Geological & Nuclear Sciences Ltd.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *		notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *		notice, this list of conditions and the following disclaimer in the
+ *		documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#ifndef _METRICS_H
+#define _METRICS_H
+
+/*
+ * metrics: cheap counters and log bucketed latency histograms, written
+ * out in the prometheus text format, either on request over http or to
+ * a file when asked.
+ *
+ * Histogram buckets split each power of two microseconds into four, so
+ * any value is within 25% of its bucket bounds. Updates are relaxed
+ * atomic adds, each thread is expected to have its own copy where it
+ * matters, and copies are summed when written out.
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <pthread.h>
+
+#define METRICS_BUCKETS 128 /* up to a couple of hours */
+
+typedef struct metrics_histogram_s {
+	atomic_ulong buckets[METRICS_BUCKETS];
+	atomic_ulong count;
+	atomic_ulong sum; /* microseconds */
+} metrics_histogram_t;
+
+typedef struct metrics_server_s {
+	int fd;
+	pthread_t thread;
+	atomic_int stop;
+
+	void (*render)(FILE *fp, void *data);
+	void *data;
+} metrics_server_t;
+
+extern uint64_t metrics_now(void);
+extern void metrics_observe(metrics_histogram_t *hist, uint64_t usec);
+extern long metrics_resident(void);
+
+extern void metrics_counter(FILE *fp, const char *name, const char *help, unsigned long value);
+extern void metrics_gauge(FILE *fp, const char *name, const char *help, double value);
+extern void metrics_histogram(FILE *fp, const char *name, const char *help, metrics_histogram_t **hists, int nhists);
+
+extern int metrics_serve(metrics_server_t *server, const char *address, void (*render)(FILE *, void *), void *data);
+extern void metrics_stop(metrics_server_t *server);
+
+#endif /* _METRICS_H */
@@ -35,12 +35,24 @@
 #include <errno.h>
 #include <time.h>
 #include <math.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <fnmatch.h>
+#include <sys/stat.h>
 
 /* libmseed library includes */
 #include <libmseed.h>
 #include <libtidal.h>
 #include <libcrex.h>
 
+#include "registry.h"
+#include "msmap.h"
+#include "msindex.h"
+#include "msheader.h"
+#include "sink.h"
+
 #define PROGRAM "msdetide" /* program name */
 
 #ifndef FIRFILTERS
@@ -59,7 +71,7 @@
 /* program variables */
 static char *program_name = PROGRAM;
 static char *program_version = PROGRAM " (" PACKAGE_VERSION ") (c) GNS 2012 (m.chadwick@gns.cri.nz)";
-static char *program_usage = PROGRAM " [-hv][-A <alpha>][-B <beta>][-O <orient>][-L <latitude>][-Z <zone>][-T <label/amp/lag> ...][<files> ... ]";
+static char *program_usage = PROGRAM " [-hv][-n <threads>][-X][-S <stream> ...][-b <start>][-e <end>][-a <archive>][-A <alpha>][-B <beta>][-O <orient>][-L <latitude>][-Z <zone>][-T <label/amp/lag> ...][<files> ... ]";
 static char *program_prefix = "[" PROGRAM "] ";
 
 static int verbose = 0; /* program verbosity */
@@ -73,6 +85,81 @@ static double latitude = 0.0;
 
 static char *firfile = FIRFILTERS;
 
+static crex_tidal_t tidal;
+
+static int threads = 1; /* parallel batch workers */
+
+#define MAX_SELECTS 32
+static char *selects[MAX_SELECTS]; /* stream patterns, all streams if none */
+static int nselects = 0;
+static hptime_t starttime = HPTERROR; /* and the time window, open if not given */
+static hptime_t endtime = HPTERROR;
+
+static int useindex = 0; /* seek using sidecar indexes */
+
+#define OUTPUT_SIZE (4 << 20) /* records gathered before writing */
+static char *archive = NULL; /* day file archive in place of stdout */
+static sinks_t sinks;
+
+/*
+ * batch mode: the input records are indexed, grouped by stream and each
+ * stream converted on a worker thread. Output is tagged with the input
+ * record that produced it and merged back into the serial order.
+ */
+typedef struct batch_record_s {
+	char srcname[50];
+	int file;
+	int reclen;
+	off_t offset;
+	int stream;
+} batch_record_t;
+
+typedef struct batch_output_s {
+	long seq; /* input record that produced it */
+	int count; /* and which of its outputs it was */
+	int worker;
+	size_t offset;
+	int reclen;
+} batch_output_t;
+
+typedef struct batch_worker_s {
+	pthread_t thread;
+	int id;
+	crex_tidal_t tidal; /* own copy, process_crex is not promised to leave it alone */
+
+	long seq;
+	int count;
+	long records;
+
+	char *data; /* captured output records */
+	size_t len;
+	size_t max;
+
+	batch_output_t *outputs;
+	long noutputs;
+	long maxoutputs;
+} batch_worker_t;
+
+static struct batch_s {
+	char **files;
+	int nfiles;
+	int *fds;
+	msmap_t *maps;
+
+	batch_record_t **filerecords; /* per file, while indexing */
+	long *filecounts;
+
+	batch_record_t *records; /* in serial order */
+	long nrecords;
+
+	registry_t streams;
+	long *order; /* record indexes grouped by stream */
+	long *first; /* start of each stream in order */
+
+	atomic_int next;
+	batch_worker_t *workers;
+} batch;
+
 static void log_print(char *message) {
 	if (verbose)
 		fprintf(stderr, "%s", message);
@@ -83,28 +170,451 @@ static void err_print(char *message) {
 }
 
 static void record_handler (char *record, int reclen, void *extra) {
-    if (fwrite(record, reclen, 1, stdout) != 1) {
-		ms_log (2, "error writing mseed record to stdout\n");
-	}
+    (void) sinks_push(&sinks, record, reclen);
 }
 
-int main(int argc, char **argv) {
+static void stream_init (crex_stream_t *stream) {
     int n;
 
+    /* Insert passed ctd values. */
+    strncpy(stream->ctd.id, tag, 24);
+
+    stream->alpha = alpha;
+    stream->beta = beta;
+
+    /* Insert default ctd values. */
+    stream->ctd.time = 0;
+    stream->ctd.temp = -1;
+    stream->ctd.autoQC = 11;
+    stream->ctd.manualQC = 7;
+    stream->ctd.offset = 0;
+    stream->ctd.increment = 1;
+
+    /* reset the CREX data arrays */
+    for (n = 0; n < CREX_BUF_SIZE; n++) {
+        stream->ctd.mes[n] = CREX_NO_DATA;
+        stream->ctd.res[n] = CREX_NO_DATA;
+    }
+}
+
+/* is a stream wanted */
+static int select_stream (const char *srcname) {
+	int n;
+
+	if (nselects == 0)
+		return 1;
+	for (n = 0; n < nselects; n++) {
+		if (fnmatch(selects[n], srcname, 0) == 0)
+			return 1;
+	}
+
+	return 0;
+}
+
+/* does a span of data overlap the time window */
+static int select_time (hptime_t start, hptime_t end) {
+	if ((starttime != HPTERROR) && (end < starttime))
+		return 0;
+	if ((endtime != HPTERROR) && (start > endtime))
+		return 0;
+
+	return 1;
+}
+
+static int select_record (MSRecord *msr, const char *srcname) {
+	return (select_stream(srcname) && select_time(msr->starttime, msr_endtime(msr)));
+}
+
+/* the sidecar index of a file, built if it is missing or out of date, zero to scan instead */
+static int index_open (msindex_t *idx, const char *path) {
+	char index[PATH_MAX];
+
+	if (snprintf(index, sizeof(index), "%s.idx", path) >= (int) sizeof(index))
+		return 0;
+	if (msindex_open(idx, path, index) > 0)
+		return 1;
+	if (msindex_build(path, index, (verbose > 1) ? 1 : 0) < 0)
+		return 0;
+
+	return (msindex_open(idx, path, index) > 0) ? 1 : 0;
+}
+
+static double batch_now (void) {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (double) ts.tv_sec + (double) ts.tv_nsec / 1.0e9;
+}
+
+/* keep a copy of each output record for the final merge */
+static void batch_handler (char *record, int reclen, void *extra) {
+	batch_worker_t *worker = (batch_worker_t *) extra;
+	batch_output_t *output;
+
+	while (worker->len + reclen > worker->max) {
+		worker->max = (worker->max > 0) ? 2 * worker->max : 1 << 20;
+		if ((worker->data = (char *) realloc(worker->data, worker->max)) == NULL) {
+			ms_log(1, "memory error!\n"); exit(-1);
+		}
+	}
+	if (worker->noutputs >= worker->maxoutputs) {
+		worker->maxoutputs = (worker->maxoutputs > 0) ? 2 * worker->maxoutputs : 1024;
+		if ((worker->outputs = (batch_output_t *) realloc(worker->outputs, worker->maxoutputs * sizeof(batch_output_t))) == NULL) {
+			ms_log(1, "memory error!\n"); exit(-1);
+		}
+	}
+
+	output = &worker->outputs[worker->noutputs++];
+	output->seq = worker->seq;
+	output->count = worker->count++;
+	output->worker = worker->id;
+	output->offset = worker->len;
+	output->reclen = reclen;
+
+	memcpy(worker->data + worker->len, record, reclen);
+	worker->len += reclen;
+}
+
+static batch_record_t *batch_append (batch_record_t **records, long *nrecords, long *maxrecords) {
+	if (*nrecords >= *maxrecords) {
+		*maxrecords = (*maxrecords > 0) ? 2 * (*maxrecords) : 1024;
+		if ((*records = (batch_record_t *) realloc(*records, (*maxrecords) * sizeof(batch_record_t))) == NULL) {
+			ms_log(1, "memory error!\n"); exit(-1);
+		}
+	}
+
+	return &(*records)[(*nrecords)++];
+}
+
+/* read the headers of each file, or its index, noting where every wanted record is */
+static void *batch_index (void *arg) {
+	MSRecord *msr = NULL;
+	const msindex_run_t *run;
+	batch_record_t *records, *record;
+	long nrecords, maxrecords;
+	char srcname[50];
+	msindex_t idx;
+	int64_t r;
+	uint32_t n;
+	off_t fpos;
+	int file, rc;
+
+	while ((file = atomic_fetch_add(&batch.next, 1)) < batch.nfiles) {
+		records = NULL; nrecords = maxrecords = 0;
+		if ((useindex) && (batch.maps[file].map != NULL) && (index_open(&idx, batch.files[file]) > 0)) {
+			for (n = 0; n < idx.header->nruns; n++) {
+				run = &idx.runs[n];
+				if ((!select_stream(msindex_name(&idx, run))) || (!select_time(run->start, run->end)))
+					continue;
+				for (r = 0; r < run->count; r++) {
+					record = batch_append(&records, &nrecords, &maxrecords);
+					strncpy(record->srcname, msindex_name(&idx, run), sizeof(record->srcname) - 1);
+					record->srcname[sizeof(record->srcname) - 1] = '\0';
+					record->file = file;
+					record->reclen = run->reclen;
+					record->offset = (off_t) (run->offset + r * run->reclen);
+				}
+			}
+			msindex_close(&idx);
+		}
+		else {
+			while ((rc = msmap_next (&batch.maps[file], &msr, &fpos, 0, (verbose > 1) ? 1 : 0)) == MS_NOERROR) {
+				msr_srcname(msr, srcname, 0);
+				if (!select_record(msr, srcname))
+					continue;
+				record = batch_append(&records, &nrecords, &maxrecords);
+				strcpy(record->srcname, srcname);
+				record->file = file;
+				record->reclen = msr->reclen;
+				record->offset = fpos;
+			}
+			if (rc != MS_ENDOFFILE)
+				ms_log (2, "error reading %s: %s\n", batch.files[file], ms_errorstr(rc));
+		}
+
+		batch.filerecords[file] = records;
+		batch.filecounts[file] = nrecords;
+	}
+
+	msr_free(&msr);
+
+	return NULL;
+}
+
+/* convert whole streams, one at a time, in their input order */
+static void *batch_process (void *arg) {
+	batch_worker_t *worker = (batch_worker_t *) arg;
+	crex_stream_t *stream;
+	batch_record_t *record;
+	MSRecord *msr = NULL;
+	char *buf, *rec;
+	int psamples = 0;
+	int s, rc;
+	long n;
+
+	if ((buf = (char *) malloc(MAXRECLEN)) == NULL) {
+		ms_log(1, "memory error!\n"); exit(-1);
+	}
+
+	while ((s = atomic_fetch_add(&batch.next, 1)) < batch.streams.nstreams) {
+		stream = &batch.streams.streams[s];
+		stream_init(stream);
+
+		for (n = batch.first[s]; n < batch.first[s + 1]; n++) {
+			record = &batch.records[batch.order[n]];
+			/* straight from the mapping when there is one */
+			if ((rec = msmap_record(&batch.maps[record->file], record->offset, record->reclen)) == NULL) {
+				if (pread(batch.fds[record->file], buf, record->reclen, record->offset) != record->reclen) {
+					ms_log (2, "error reading %s\n", batch.files[record->file]); continue;
+				}
+				rec = buf;
+			}
+			if ((rc = msr_unpack (rec, record->reclen, &msr, 1, (verbose > 1) ? 1 : 0)) != MS_NOERROR) {
+				ms_log (2, "error unpacking record: %s\n", ms_errorstr(rc)); continue;
+			}
+			/* an indexed run may reach outside the window */
+			if (!select_time(msr->starttime, msr_endtime(msr)))
+				continue;
+			if (verbose > 1)
+				msr_print(msr, (verbose > 2) ? 1 : 0);
+
+			worker->seq = batch.order[n];
+			worker->count = 0;
+			worker->records++;
+			if (process_crex(msr, &worker->tidal, stream, batch_handler, worker, &psamples, -1.0, verbose) < 0) {
+				ms_log (1, "error processing mseed block\n"); break;
+			}
+		}
+	}
+
+	msr_free(&msr);
+	free(buf);
+
+	return NULL;
+}
+
+static int batch_compare (const void *a, const void *b) {
+	const batch_output_t *x = (const batch_output_t *) a;
+	const batch_output_t *y = (const batch_output_t *) b;
+
+	if (x->seq != y->seq)
+		return (x->seq < y->seq) ? -1 : 1;
+	return x->count - y->count;
+}
+
+/* can every input be read at any offset, stdin, pipes and devices are streamed instead */
+static int batch_files (char **files, int nfiles) {
+	struct stat st;
+	int n;
+
+	for (n = 0; n < nfiles; n++) {
+		if ((strcmp(files[n], "-") == 0) || (stat(files[n], &st) < 0) || (!S_ISREG(st.st_mode))) {
+			if (verbose)
+				ms_log (0, "%s is not a regular file, processing serially\n", files[n]);
+			return 0;
+		}
+	}
+
+	return 1;
+}
+
+/* process the given files in parallel, writing exactly what a serial run would */
+static int batch_run (char **files, int nfiles) {
+	batch_worker_t *worker;
+	batch_output_t *outputs;
+	crex_stream_t *stream;
+	long noutputs, n, *fill;
+	double start, elapsed;
+	int created, w;
+
+	start = batch_now();
+
+	memset(&batch, 0, sizeof(batch));
+	batch.files = files;
+	batch.nfiles = nfiles;
+
+	if (((batch.fds = (int *) calloc(nfiles, sizeof(int))) == NULL) ||
+			((batch.filerecords = (batch_record_t **) calloc(nfiles, sizeof(batch_record_t *))) == NULL) ||
+			((batch.filecounts = (long *) calloc(nfiles, sizeof(long))) == NULL) ||
+			((batch.maps = (msmap_t *) calloc(nfiles, sizeof(msmap_t))) == NULL) ||
+			((batch.workers = (batch_worker_t *) calloc(threads, sizeof(batch_worker_t))) == NULL)) {
+		ms_log(1, "memory error!\n"); return -1;
+	}
+	for (n = 0; n < nfiles; n++) {
+		if ((batch.fds[n] = open(files[n], O_RDONLY)) < 0) {
+			ms_log(1, "unable to open %s: %s\n", files[n], strerror(errno)); return -1;
+		}
+		(void) msmap_open(&batch.maps[n], files[n]);
+	}
+
+	/* index every file */
+	atomic_store(&batch.next, 0);
+	for (w = 0; w < threads; w++)
+		pthread_create(&batch.workers[w].thread, NULL, batch_index, NULL);
+	for (w = 0; w < threads; w++)
+		pthread_join(batch.workers[w].thread, NULL);
+
+	for (n = 0; n < nfiles; n++)
+		batch.nrecords += batch.filecounts[n];
+	if ((batch.records = (batch_record_t *) malloc((batch.nrecords + 1) * sizeof(batch_record_t))) == NULL) {
+		ms_log(1, "memory error!\n"); return -1;
+	}
+	for (n = 0, batch.nrecords = 0; n < nfiles; n++) {
+		if (batch.filecounts[n] > 0)
+			memcpy(&batch.records[batch.nrecords], batch.filerecords[n], batch.filecounts[n] * sizeof(batch_record_t));
+		batch.nrecords += batch.filecounts[n];
+		free((char *) batch.filerecords[n]);
+	}
+
+	/* group the records by stream, keeping their order */
+	if (registry_init(&batch.streams, 0) < 0) {
+		ms_log(1, "memory error!\n"); return -1;
+	}
+	for (n = 0; n < batch.nrecords; n++) {
+		if ((stream = registry_lookup(&batch.streams, batch.records[n].srcname, &created)) == NULL) {
+			ms_log(1, "memory error!\n"); return -1;
+		}
+		batch.records[n].stream = (int) (stream - batch.streams.streams);
+	}
+	if (((batch.first = (long *) calloc(batch.streams.nstreams + 1, sizeof(long))) == NULL) ||
+			((fill = (long *) calloc(batch.streams.nstreams + 1, sizeof(long))) == NULL) ||
+			((batch.order = (long *) malloc((batch.nrecords + 1) * sizeof(long))) == NULL)) {
+		ms_log(1, "memory error!\n"); return -1;
+	}
+	for (n = 0; n < batch.nrecords; n++)
+		batch.first[batch.records[n].stream + 1]++;
+	for (n = 0; n < batch.streams.nstreams; n++) {
+		batch.first[n + 1] += batch.first[n];
+		fill[n] = batch.first[n];
+	}
+	for (n = 0; n < batch.nrecords; n++)
+		batch.order[fill[batch.records[n].stream]++] = n;
+	free((char *) fill);
+
+	/* convert the streams */
+	atomic_store(&batch.next, 0);
+	for (w = 0; w < threads; w++) {
+		batch.workers[w].id = w;
+		memcpy(&batch.workers[w].tidal, &tidal, sizeof(crex_tidal_t));
+		pthread_create(&batch.workers[w].thread, NULL, batch_process, &batch.workers[w]);
+	}
+	for (w = 0, noutputs = 0; w < threads; w++) {
+		pthread_join(batch.workers[w].thread, NULL);
+		noutputs += batch.workers[w].noutputs;
+	}
+
+	/* and merge their output back into input order */
+	if ((outputs = (batch_output_t *) malloc((noutputs + 1) * sizeof(batch_output_t))) == NULL) {
+		ms_log(1, "memory error!\n"); return -1;
+	}
+	for (w = 0, noutputs = 0; w < threads; w++) {
+		worker = &batch.workers[w];
+		if (worker->noutputs > 0)
+			memcpy(&outputs[noutputs], worker->outputs, worker->noutputs * sizeof(batch_output_t));
+		noutputs += worker->noutputs;
+	}
+	qsort(outputs, noutputs, sizeof(batch_output_t), batch_compare);
+
+	for (n = 0; n < noutputs; n++)
+		record_handler(batch.workers[outputs[n].worker].data + outputs[n].offset, outputs[n].reclen, NULL);
+	(void) sinks_flush(&sinks);
+
+	elapsed = batch_now() - start;
+	if (verbose)
+		ms_log(0, "%ld records, %d streams, %ld crex records, %d threads, %.3f s, %.1f records/s\n",
+			batch.nrecords, batch.streams.nstreams, noutputs, threads, elapsed, (elapsed > 0.0) ? (double) batch.nrecords / elapsed : 0.0);
+
+	/* tidy up */
+	free((char *) outputs);
+	for (w = 0; w < threads; w++) {
+		free(batch.workers[w].data);
+		free((char *) batch.workers[w].outputs);
+	}
+	for (n = 0; n < nfiles; n++) {
+		msmap_close(&batch.maps[n]);
+		close(batch.fds[n]);
+	}
+	registry_free(&batch.streams);
+	free((char *) batch.order);
+	free((char *) batch.first);
+	free((char *) batch.records);
+	free((char *) batch.filecounts);
+	free((char *) batch.filerecords);
+	free((char *) batch.fds);
+	free((char *) batch.maps);
+	free((char *) batch.workers);
+
+	return 0;
+}
+
+/* convert a record on its own stream */
+static int serial_record (registry_t *streams, MSRecord *msr, const char *srcname) {
+    crex_stream_t *stream;
+    int psamples = 0;
+    int created = 0;
+
+    if (verbose > 1)
+        msr_print(msr, (verbose > 2) ? 1 : 0);
+    if ((stream = registry_lookup(streams, srcname, &created)) == NULL) {
+        ms_log(1, "memory error!\n"); exit(-1);
+    }
+    if (created)
+        stream_init(stream);
+
+    if (process_crex(msr, &tidal, stream, record_handler, NULL, &psamples, -1.0, verbose) < 0) {
+        ms_log (1, "error processing mseed block\n"); return -1;
+    }
+
+    if (verbose)
+        ms_log(0, "packed: %d samples\n", psamples);
+
+    return 0;
+}
+
+/* only the records the index points at are read */
+static long serial_indexed (registry_t *streams, msmap_t *msmap, msindex_t *idx, MSRecord **ppmsr) {
+    const msindex_run_t *run;
+    long records = 0;
+    char *rec;
+    int64_t r;
+    uint32_t n;
+    int rc;
+
+    for (n = 0; n < idx->header->nruns; n++) {
+        run = &idx->runs[n];
+        if ((!select_stream(msindex_name(idx, run))) || (!select_time(run->start, run->end)))
+            continue;
+        for (r = 0; r < run->count; r++) {
+            if ((rec = msmap_record(msmap, (off_t) (run->offset + r * run->reclen), run->reclen)) == NULL)
+                return records;
+            if ((rc = msr_unpack (rec, run->reclen, ppmsr, 1, (verbose > 1) ? 1 : 0)) != MS_NOERROR) {
+                ms_log (2, "error unpacking record: %s\n", ms_errorstr(rc)); continue;
+            }
+            if (!select_time((*ppmsr)->starttime, msr_endtime(*ppmsr)))
+                continue;
+            records++;
+            if (serial_record(streams, *ppmsr, msindex_name(idx, run)) < 0)
+                return records;
+        }
+    }
+
+    return records;
+}
+
+int main(int argc, char **argv) {
 	MSRecord *msr = NULL;
+	msmap_t msmap;
 
     char srcname[100];
-    crex_tidal_t tidal;
 
-    crex_stream_t *sp = NULL;
-    crex_stream_t *stream = NULL;
-    crex_stream_t *streams = NULL;
+    registry_t streams;
+    msindex_t idx;
+    long records = 0;
+    double start;
 
     int nfirs = 0;
     char *firnames[FIR_MAX_FILTERS];
 
-    int psamples = 0;
-
 	int rc;
 	int option_index = 0;
 	struct option long_options[] = {
@@ -119,6 +629,12 @@ int main(int argc, char **argv) {
 		{"latitude", 1, 0, 'L'},
 		{"zone", 1, 0, 'Z'},
 		{"tide", 1, 0, 'T'},
+		{"threads", 1, 0, 'n'},
+		{"index", 0, 0, 'X'},
+		{"stream", 1, 0, 'S'},
+		{"start", 1, 0, 'b'},
+		{"end", 1, 0, 'e'},
+		{"archive", 1, 0, 'a'},
 		{0, 0, 0, 0}
 	};
 
@@ -127,7 +643,7 @@ int main(int argc, char **argv) {
 
     memset(&tidal, 0, sizeof(crex_tidal_t));
 
-	while ((rc = getopt_long(argc, argv, "hvN:F:I:F:A:B:T:L:Z:", long_options, &option_index)) != EOF) {
+	while ((rc = getopt_long(argc, argv, "hvXn:N:F:I:F:A:B:T:L:Z:S:b:e:a:", long_options, &option_index)) != EOF) {
 		switch(rc) {
 		case '?':
 			(void) fprintf(stderr, "usage: %s\n", program_usage);
@@ -139,6 +655,12 @@ int main(int argc, char **argv) {
 			(void) fprintf(stderr, "options:\n");
 			(void) fprintf(stderr, "\t-h --help\tcommand line help (this)\n");
 			(void) fprintf(stderr, "\t-v --verbose\trun program in verbose mode\n");
+			(void) fprintf(stderr, "\t-n --threads\tprocess files in parallel on this many threads [%d]\n", threads);
+			(void) fprintf(stderr, "\t-X --index\tseek using a sidecar index of each file, built if needed [%s]\n", (useindex) ? "on" : "off");
+			(void) fprintf(stderr, "\t-S --stream\tonly convert streams matching a NET_STA_LOC_CHA pattern\n");
+			(void) fprintf(stderr, "\t-b --start\tonly convert records ending after this time [<null>]\n");
+			(void) fprintf(stderr, "\t-e --end\tonly convert records starting before this time [<null>]\n");
+			(void) fprintf(stderr, "\t-a --archive\twrite records into day files under this directory, not stdout [%s]\n", (archive) ? archive : "<null>");
             (void) fprintf(stderr, "\t-N --firfile\tprovide an alternative fir-filters file [%s]\n", firfile);
             (void) fprintf(stderr, "\t-F --filter\tadd a decimation firfilter\n");
 			(void) fprintf(stderr, "\t-I --tag\tprovide CREX ID tag [%s]\n", tag);
@@ -151,6 +673,29 @@ int main(int argc, char **argv) {
 		case 'v':
 			verbose++;
 			break;
+		case 'n':
+			threads = atoi(optarg);
+			break;
+		case 'X':
+			useindex = 1;
+			break;
+		case 'a':
+			archive = optarg;
+			break;
+		case 'S':
+			if (nselects < MAX_SELECTS)
+				selects[nselects++] = optarg;
+			break;
+		case 'b':
+			if ((starttime = ms_timestr2hptime(optarg)) == HPTERROR) {
+				ms_log(1, "invalid start time [%s]\n", optarg); exit(-1);
+			}
+			break;
+		case 'e':
+			if ((endtime = ms_timestr2hptime(optarg)) == HPTERROR) {
+				ms_log(1, "invalid end time [%s]\n", optarg); exit(-1);
+			}
+			break;
 		case 'I':
 			tag = optarg;
 			break;
@@ -196,74 +741,66 @@ int main(int argc, char **argv) {
         ms_log(1, "could not load fir filter file [%s]\n", firfile); exit(-1);
     }
 
+    /* records are gathered and written in large batches */
+    if (sinks_init(&sinks, OUTPUT_SIZE, 0.0) < 0) {
+        ms_log(1, "memory error!\n"); exit(-1);
+    }
+    if ((archive) ? (sinks_archive(&sinks, archive) < 0) : (sinks_stream(&sinks, fileno(stdout)) < 0))
+        exit(-1);
+
+    /* parallel batch mode, files only as records are read back by offset */
+    if ((threads > 1) && (optind < argc) && (batch_files(&argv[optind], argc - optind))) {
+        if (batch_run(&argv[optind], argc - optind) < 0)
+            exit(-1);
+        sinks_free(&sinks);
+        return(0);
+    }
+
+    /* stream state lookup */
+    if (registry_init(&streams, 0) < 0) {
+        ms_log(1, "memory error!\n"); exit(-1);
+    }
+
+    start = batch_now();
+
     do {
         if (verbose)
 		  ms_log (0, "process miniseed data from %s\n", (optind < argc) ? argv[optind] : "<stdin>");
 
-		while ((rc = ms_readmsr (&msr, (optind < argc) ? argv[optind] : "-", 0, NULL, NULL, 1, 1, (verbose > 1) ? 1 : 0)) == MS_NOERROR) {
-			if (verbose > 1)
-				msr_print(msr, (verbose > 2) ? 1 : 0);
-            msr_srcname(msr, srcname, 0);
-            for (stream = streams; stream != NULL; stream = stream->next) {
-                if (strcmp(stream->srcname, srcname) == 0)
-                    break;
-            }
-            if (stream == NULL) {
-                if ((stream = (crex_stream_t *) malloc(sizeof(crex_stream_t))) == NULL) {
-                    ms_log(1, "memory error!\n"); exit(-1);
-                }
-                memset(stream, 0, sizeof(crex_stream_t));
-                strcpy(stream->srcname, srcname);
-
-                /* Insert passed ctd values. */
-                strncpy(stream->ctd.id, tag, 24);
-
-                stream->alpha = alpha;
-                stream->beta = beta;
-
-                /* Insert default ctd values. */
-                stream->ctd.time = 0;
-                stream->ctd.temp = -1;
-                stream->ctd.autoQC = 11;
-                stream->ctd.manualQC = 7;
-                stream->ctd.offset = 0;
-                stream->ctd.increment = 1;
-
-                /* reset the CREX data arrays */
-                for (n = 0; n < CREX_BUF_SIZE; n++) {
-                    stream->ctd.mes[n] = CREX_NO_DATA;
-                    stream->ctd.res[n] = CREX_NO_DATA;
-                }
-
-                if (streams != NULL) {
-                    stream->next = streams;
-                }
-                streams = stream;
-            }
-
-			if (process_crex(msr, &tidal, stream, record_handler, NULL, &psamples, -1.0, verbose) < 0) {
-		        ms_log (1, "error processing mseed block\n"); break;
-            }
+		/* files are mapped, stdin and pipes are streamed */
+		(void) msmap_open (&msmap, (optind < argc) ? argv[optind] : "-");
 
-            if (verbose)
-                ms_log(0, "packed: %d samples\n", psamples);
+		/* an index needs the mapping to seek in */
+		if ((useindex) && (msmap.map != NULL) && (index_open(&idx, argv[optind]) > 0)) {
+			records += serial_indexed(&streams, &msmap, &idx, &msr);
+			msindex_close (&idx);
+		}
+		else {
+			while ((rc = msmap_next (&msmap, &msr, NULL, 1, (verbose > 1) ? 1 : 0)) == MS_NOERROR) {
+				msr_srcname(msr, srcname, 0);
+				if (!select_record(msr, srcname))
+					continue;
+				records++;
+				if (serial_record(&streams, msr, srcname) < 0)
+					break;
+			}
+			if (rc != MS_ENDOFFILE )
+			    ms_log (2, "error reading stdin: %s\n", ms_errorstr(rc));
 		}
-		if (rc != MS_ENDOFFILE )
-		    ms_log (2, "error reading stdin: %s\n", ms_errorstr(rc));
 
 		/* Cleanup memory and close file */
-		ms_readmsr (&msr, NULL, 0, NULL, NULL, 0, 0, (verbose > 1) ? 1 : 0);
+		msmap_close (&msmap);
+		msr_free (&msr);
     } while((++optind) < argc);
 
-    stream = streams;
-    while (stream != NULL) {
-        sp = stream; stream = stream->next;
-        free((char *) sp);
-    }
+    registry_free(&streams);
+    sinks_free(&sinks);
 
 	/* closing down */
-	if (verbose)
+	if (verbose) {
+		ms_log (0, "%ld records converted in %.3f s\n", records, batch_now() - start);
 		ms_log (0, "terminated\n");
+	}
 
 	/* done */
 	return(0);
@@ -0,0 +1,143 @@
+/*
+ * Copyright (c) 2014 Institute of Geological & Nuclear Sciences Ltd.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *		notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *		notice, this list of conditions and the following disclaimer in the
+ *		documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+/* system includes */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <libmseed.h>
+
+#include "msheader.h"
+
+/* fixed section of data header offsets */
+#define FSDH_NETWORK 18
+#define FSDH_STATION 8
+#define FSDH_LOCATION 13
+#define FSDH_CHANNEL 15
+#define FSDH_START 20
+#define FSDH_NUMSAMPLES 30
+#define FSDH_FACTOR 32
+#define FSDH_MULTIPLIER 34
+#define FSDH_ACTFLAGS 36
+#define FSDH_CORRECTION 40
+#define FSDH_BLOCKETTE 46
+#define FSDH_SIZE 48
+
+static int get16(const unsigned char *p, int swap) {
+	return (int) (short) ((swap) ? (p[1] << 8 | p[0]) : (p[0] << 8 | p[1]));
+}
+
+static int get32(const unsigned char *p, int swap) {
+	return (swap) ? (int) ((unsigned int) p[3] << 24 | p[2] << 16 | p[1] << 8 | p[0])
+		: (int) ((unsigned int) p[0] << 24 | p[1] << 16 | p[2] << 8 | p[3]);
+}
+
+static float getfloat(const unsigned char *p, int swap) {
+	union { int i; float f; } u;
+	u.i = get32(p, swap);
+	return u.f;
+}
+
+/* copy a space padded header field, dropping the padding */
+static char *copyfield(char *dst, const unsigned char *src, int len) {
+	while ((len > 0) && (src[len - 1] == ' '))
+		len--;
+	memcpy(dst, src, len);
+	return dst + len;
+}
+
+/*
+ * decode the source name, start and end times of a packed record,
+ * following the same rules as msr_unpack, msr_srcname and msr_endtime.
+ */
+int msheader_parse(const char *record, int reclen, msheader_t *hdr) {
+	const unsigned char *r = (const unsigned char *) record;
+	int year, day, usec, swap = 0;
+	int factor, multiplier;
+	int offset, type, n;
+	char *p;
+
+	if (reclen < FSDH_SIZE)
+		return -1;
+
+	/* byte order is decided by a sane year, as libmseed does */
+	year = get16(r + FSDH_START, 0);
+	day = get16(r + FSDH_START + 2, 0);
+	if ((year < 1900) || (year > 2100) || (day < 1) || (day > 366)) {
+		swap = 1;
+		year = get16(r + FSDH_START, swap);
+		day = get16(r + FSDH_START + 2, swap);
+		if ((year < 1900) || (year > 2100) || (day < 1) || (day > 366))
+			return -1;
+	}
+
+	p = copyfield(hdr->srcname, r + FSDH_NETWORK, 2); *p++ = '_';
+	p = copyfield(p, r + FSDH_STATION, 5); *p++ = '_';
+	p = copyfield(p, r + FSDH_LOCATION, 2); *p++ = '_';
+	p = copyfield(p, r + FSDH_CHANNEL, 3); *p = '\0';
+
+	usec = get16(r + FSDH_START + 8, swap) * 100;
+
+	hdr->numsamples = get16(r + FSDH_NUMSAMPLES, swap) & 0xffff;
+
+	factor = get16(r + FSDH_FACTOR, swap);
+	multiplier = get16(r + FSDH_MULTIPLIER, swap);
+	if ((factor > 0) && (multiplier > 0))
+		hdr->samprate = (double) factor * (double) multiplier;
+	else if ((factor > 0) && (multiplier < 0))
+		hdr->samprate = -1.0 * (double) factor / (double) multiplier;
+	else if ((factor < 0) && (multiplier > 0))
+		hdr->samprate = -1.0 * (double) multiplier / (double) factor;
+	else if ((factor < 0) && (multiplier < 0))
+		hdr->samprate = 1.0 / ((double) factor * (double) multiplier);
+	else
+		hdr->samprate = 0.0;
+
+	/* blockette 100 overrides the rate, blockette 1001 refines the time */
+	offset = get16(r + FSDH_BLOCKETTE, swap) & 0xffff;
+	for (n = 0; (offset >= FSDH_SIZE) && (offset + 4 <= reclen) && (n < 32); n++) {
+		type = get16(r + offset, swap) & 0xffff;
+		if ((type == 100) && (offset + 8 <= reclen))
+			hdr->samprate = (double) getfloat(r + offset + 4, swap);
+		else if ((type == 1001) && (offset + 6 <= reclen))
+			usec += (signed char) r[offset + 5];
+		offset = get16(r + offset + 2, swap) & 0xffff;
+	}
+
+	hdr->starttime = ms_time2hptime(year, day, r[FSDH_START + 4], r[FSDH_START + 5], r[FSDH_START + 6], 0);
+	hdr->starttime += (hptime_t) usec * (HPTMODULUS / 1000000);
+
+	/* apply any time correction not already applied */
+	if ((r[FSDH_ACTFLAGS] & 0x02) == 0)
+		hdr->starttime += (hptime_t) get32(r + FSDH_CORRECTION, swap) * (HPTMODULUS / 10000);
+
+	hdr->endtime = hdr->starttime;
+	if ((hdr->samprate > 0.0) && (hdr->numsamples > 0))
+		hdr->endtime += (hptime_t) (((double) (hdr->numsamples - 1) / hdr->samprate * HPTMODULUS) + 0.5);
+
+	return 0;
+}
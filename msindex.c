@@ -0,0 +1,215 @@
+/*
+ * Copyright (c) 2014 Institute of Geological & Nuclear Sciences Ltd.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *		notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *		notice, this list of conditions and the following disclaimer in the
+ *		documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+/* system includes */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <libmseed.h>
+
+#include "msmap.h"
+#include "msindex.h"
+
+static int64_t msindex_mtime(const struct stat *st) {
+	return (int64_t) st->st_mtim.tv_sec * 1000000000 + (int64_t) st->st_mtim.tv_nsec;
+}
+
+static size_t msindex_length(uint32_t nnames, uint32_t nruns) {
+	return sizeof(msindex_header_t) + (size_t) nnames * MSINDEX_NAMELEN + (size_t) nruns * sizeof(msindex_run_t);
+}
+
+/* write the whole index aside and then move it into place */
+static int msindex_write(const char *index, msindex_header_t *header, char (*names)[MSINDEX_NAMELEN], msindex_run_t *runs) {
+	char tmp[PATH_MAX];
+	FILE *fp;
+	int ok;
+
+	if (snprintf(tmp, sizeof(tmp), "%s.tmp", index) >= (int) sizeof(tmp))
+		return -1;
+	if ((fp = fopen(tmp, "w")) == NULL) {
+		ms_log (2, "unable to write index %s: %s\n", tmp, strerror(errno)); return -1;
+	}
+
+	ok = (fwrite(header, sizeof(msindex_header_t), 1, fp) == 1);
+	if (ok && (header->nnames > 0))
+		ok = (fwrite(names, MSINDEX_NAMELEN, header->nnames, fp) == header->nnames);
+	if (ok && (header->nruns > 0))
+		ok = (fwrite(runs, sizeof(msindex_run_t), header->nruns, fp) == header->nruns);
+	if (ok)
+		ok = ((fflush(fp) == 0) && (fsync(fileno(fp)) == 0));
+	if ((fclose(fp) != 0) || (!ok) || (rename(tmp, index) < 0)) {
+		ms_log (2, "unable to write index %s: %s\n", index, strerror(errno));
+		(void) unlink(tmp);
+		return -1;
+	}
+
+	return 0;
+}
+
+/* read every record header once, merging back to back records of a stream into runs */
+int msindex_build(const char *path, const char *index, flag verbose) {
+	char (*names)[MSINDEX_NAMELEN] = NULL;
+	msindex_run_t *runs = NULL, *run = NULL;
+	uint32_t maxnames = 0, maxruns = 0, name;
+	char srcname[MSINDEX_NAMELEN];
+	msindex_header_t header;
+	MSRecord *msr = NULL;
+	msmap_t msmap;
+	struct stat st;
+	hptime_t end;
+	off_t fpos;
+	int rc, ret = -1;
+
+	if (stat(path, &st) < 0) {
+		ms_log (2, "unable to index %s: %s\n", path, strerror(errno)); return -1;
+	}
+
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, MSINDEX_MAGIC, 8);
+	header.size = (int64_t) st.st_size;
+	header.mtime = msindex_mtime(&st);
+
+	(void) msmap_open(&msmap, path);
+	while ((rc = msmap_next(&msmap, &msr, &fpos, 0, verbose)) == MS_NOERROR) {
+		msr_srcname(msr, srcname, 0);
+		end = msr_endtime(msr);
+
+		if ((run != NULL) && (run->reclen == msr->reclen) && (run->offset + run->count * run->reclen == (int64_t) fpos) &&
+				(strcmp(names[run->name], srcname) == 0)) {
+			run->count++;
+			if (msr->starttime < run->start)
+				run->start = msr->starttime;
+			if (end > run->end)
+				run->end = end;
+			continue;
+		}
+
+		for (name = 0; name < header.nnames; name++) {
+			if (strcmp(names[name], srcname) == 0)
+				break;
+		}
+		if (name == header.nnames) {
+			if (header.nnames >= maxnames) {
+				maxnames = (maxnames > 0) ? 2 * maxnames : 64;
+				if ((names = realloc(names, maxnames * MSINDEX_NAMELEN)) == NULL) {
+					ms_log (2, "memory error!\n"); goto done;
+				}
+			}
+			memset(names[name], 0, MSINDEX_NAMELEN);
+			strncpy(names[name], srcname, MSINDEX_NAMELEN - 1);
+			header.nnames++;
+		}
+
+		if (header.nruns >= maxruns) {
+			maxruns = (maxruns > 0) ? 2 * maxruns : 1024;
+			if ((runs = (msindex_run_t *) realloc(runs, maxruns * sizeof(msindex_run_t))) == NULL) {
+				ms_log (2, "memory error!\n"); goto done;
+			}
+		}
+		run = &runs[header.nruns++];
+		run->name = name;
+		run->reclen = msr->reclen;
+		run->offset = (int64_t) fpos;
+		run->count = 1;
+		run->start = msr->starttime;
+		run->end = end;
+	}
+
+	/* a partial index would silently hide the rest of the file */
+	if (rc != MS_ENDOFFILE) {
+		ms_log (2, "error indexing %s: %s\n", path, ms_errorstr(rc)); goto done;
+	}
+	if ((ret = msindex_write(index, &header, names, runs)) == 0 && verbose)
+		ms_log (0, "indexed %s: %u streams, %u runs\n", path, header.nnames, header.nruns);
+
+done:
+	msmap_close(&msmap);
+	msr_free(&msr);
+	free(names);
+	free((char *) runs);
+
+	return ret;
+}
+
+/* map the index of a file, returns zero if there is none or it is out of date */
+int msindex_open(msindex_t *idx, const char *path, const char *index) {
+	const msindex_header_t *header;
+	struct stat st, data;
+	uint32_t n;
+	int fd;
+
+	memset(idx, 0, sizeof(msindex_t));
+
+	if (stat(path, &data) < 0)
+		return 0;
+	if ((fd = open(index, O_RDONLY)) < 0)
+		return 0;
+	if ((fstat(fd, &st) < 0) || ((size_t) st.st_size < sizeof(msindex_header_t))) {
+		close(fd); return 0;
+	}
+	if ((idx->map = (char *) mmap(NULL, (size_t) st.st_size, PROT_READ, MAP_PRIVATE, fd, 0)) == MAP_FAILED) {
+		ms_log (2, "unable to map index %s\n", index); idx->map = NULL; close(fd); return -1;
+	}
+	close(fd);
+	idx->size = (size_t) st.st_size;
+
+	header = (const msindex_header_t *) idx->map;
+	if ((memcmp(header->magic, MSINDEX_MAGIC, 8) != 0) || (header->size != (int64_t) data.st_size) ||
+			(header->mtime != msindex_mtime(&data)) || (msindex_length(header->nnames, header->nruns) != idx->size)) {
+		msindex_close(idx);
+		return 0;
+	}
+	idx->header = header;
+	idx->names = (const char (*)[MSINDEX_NAMELEN]) (idx->map + sizeof(msindex_header_t));
+	idx->runs = (const msindex_run_t *) (idx->map + sizeof(msindex_header_t) + (size_t) header->nnames * MSINDEX_NAMELEN);
+
+	for (n = 0; n < header->nruns; n++) {
+		if ((idx->runs[n].name >= header->nnames) || (idx->runs[n].reclen < MINRECLEN) || (idx->runs[n].count < 1) ||
+				(idx->runs[n].offset < 0) || (idx->runs[n].offset + idx->runs[n].count * idx->runs[n].reclen > header->size)) {
+			msindex_close(idx);
+			return 0;
+		}
+	}
+
+	return 1;
+}
+
+const char *msindex_name(msindex_t *idx, const msindex_run_t *run) {
+	return idx->names[run->name];
+}
+
+void msindex_close(msindex_t *idx) {
+	if (idx->map != NULL)
+		munmap(idx->map, idx->size);
+	memset(idx, 0, sizeof(msindex_t));
+}
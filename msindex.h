@@ -0,0 +1,78 @@
+/*
+ * Copyright (c) 2014 Institute of Geological & Nuclear Sciences Ltd.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *		notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *		notice, this list of conditions and the following disclaimer in the
+ *		documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#ifndef _MSINDEX_H
+#define _MSINDEX_H
+
+/*
+ * msindex: a sidecar index of a miniseed file, recording where each run
+ * of consecutive records from one stream starts and the time it covers,
+ * so selected streams or times can be read without scanning the file.
+ *
+ * The index holds a header, the stream names, and then the runs in file
+ * order, all fixed size so it can be used straight from a memory mapping.
+ * It notes the size and modification time of the file it describes and
+ * is treated as missing once they no longer match.
+ */
+
+#include <stdint.h>
+
+#include <libmseed.h>
+
+#define MSINDEX_MAGIC "MSINDEX1"
+#define MSINDEX_NAMELEN 56 /* a multiple of eight keeps the runs aligned */
+
+typedef struct msindex_header_s {
+	char magic[8];
+	int64_t size; /* of the indexed file */
+	int64_t mtime; /* in nanoseconds */
+	uint32_t nnames;
+	uint32_t nruns;
+} msindex_header_t;
+
+typedef struct msindex_run_s {
+	uint32_t name;
+	int32_t reclen;
+	int64_t offset; /* of the first record */
+	int64_t count; /* records, back to back */
+	int64_t start; /* hptime of the first sample */
+	int64_t end; /* and of the last */
+} msindex_run_t;
+
+typedef struct msindex_s {
+	char *map;
+	size_t size;
+	const msindex_header_t *header;
+	const char (*names)[MSINDEX_NAMELEN];
+	const msindex_run_t *runs;
+} msindex_t;
+
+extern int msindex_build(const char *path, const char *index, flag verbose);
+extern int msindex_open(msindex_t *idx, const char *path, const char *index);
+extern const char *msindex_name(msindex_t *idx, const msindex_run_t *run);
+extern void msindex_close(msindex_t *idx);
+
+#endif /* _MSINDEX_H */
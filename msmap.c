@@ -0,0 +1,130 @@
+/*
+ * Copyright (c) 2014 Institute of Geological & Nuclear Sciences Ltd.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *		notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *		notice, this list of conditions and the following disclaimer in the
+ *		documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+/* system includes */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <libmseed.h>
+
+#include "msmap.h"
+
+int msmap_open(msmap_t *msmap, const char *path) {
+	struct stat st;
+	void *map;
+	int fd;
+
+	memset(msmap, 0, sizeof(msmap_t));
+	msmap->path = path;
+
+	if ((path == NULL) || (strcmp(path, "-") == 0))
+		return 0;
+	if ((fd = open(path, O_RDONLY)) < 0)
+		return 0;
+
+	/* only regular, non empty, files are mapped */
+	if ((fstat(fd, &st) == 0) && (S_ISREG(st.st_mode)) && (st.st_size > 0)) {
+		/* private and writable, so libmseed can never touch the file itself */
+		map = mmap(NULL, (size_t) st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+		if (map != MAP_FAILED) {
+			(void) madvise(map, (size_t) st.st_size, MADV_SEQUENTIAL);
+			msmap->map = (char *) map;
+			msmap->size = (size_t) st.st_size;
+		}
+	}
+	close(fd);
+
+	return 0;
+}
+
+/* length of the record at offset, searching for the next header if it does not say */
+static int msmap_reclen(msmap_t *msmap, off_t offset) {
+	size_t left = msmap->size - (size_t) offset;
+	off_t next;
+	int reclen;
+
+	if ((reclen = ms_detect(msmap->map + offset, (left > MAXRECLEN) ? MAXRECLEN : (int) left)) != 0)
+		return reclen;
+
+	for (next = offset + MINRECLEN; (size_t) next + MINRECLEN <= msmap->size; next += MINRECLEN) {
+		if (ms_detect(msmap->map + next, MINRECLEN) >= 0)
+			return (int) (next - offset);
+	}
+
+	return (int) left;
+}
+
+/* unpack the next record in place, returns MS_ENDOFFILE when done */
+int msmap_next(msmap_t *msmap, MSRecord **ppmsr, off_t *fpos, flag dataflag, flag verbose) {
+	int reclen, rc;
+
+	if (msmap->map == NULL)
+		return ms_readmsr_r(&msmap->msfp, ppmsr, (msmap->path) ? msmap->path : "-", 0, fpos, NULL, 1, dataflag, verbose);
+
+	while ((size_t) msmap->offset + MINRECLEN <= msmap->size) {
+		if ((reclen = msmap_reclen(msmap, msmap->offset)) < 0) {
+			/* not miniseed, skip on as ms_readmsr would */
+			msmap->offset += MINRECLEN;
+			continue;
+		}
+		if ((size_t) msmap->offset + reclen > msmap->size)
+			break;
+
+		if (fpos != NULL)
+			*fpos = msmap->offset;
+
+		rc = msr_unpack(msmap->map + msmap->offset, reclen, ppmsr, dataflag, verbose);
+		msmap->offset += reclen;
+
+		return rc;
+	}
+
+	return MS_ENDOFFILE;
+}
+
+/* direct access to a record previously found by msmap_next */
+char *msmap_record(msmap_t *msmap, off_t offset, int reclen) {
+	if ((msmap->map == NULL) || (offset < 0) || ((size_t) offset + reclen > msmap->size))
+		return NULL;
+
+	return msmap->map + offset;
+}
+
+void msmap_close(msmap_t *msmap) {
+	MSRecord *msr = NULL;
+
+	if (msmap->map != NULL)
+		(void) munmap(msmap->map, msmap->size);
+	if (msmap->msfp != NULL)
+		(void) ms_readmsr_r(&msmap->msfp, &msr, NULL, 0, NULL, NULL, 0, 0, 0);
+
+	memset(msmap, 0, sizeof(msmap_t));
+}
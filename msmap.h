@@ -0,0 +1,53 @@
+/*
+ * Copyright (c) 2014 Institute of Geological & Nuclear Sciences Ltd.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *		notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *		notice, this list of conditions and the following disclaimer in the
+ *		documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#ifndef _MSMAP_H
+#define _MSMAP_H
+
+/*
+ * msmap: read miniseed records straight out of a memory mapped file,
+ * falling back to ms_readmsr_r for stdin, pipes and anything unmappable.
+ *
+ */
+
+#include <sys/types.h>
+
+#include <libmseed.h>
+
+typedef struct msmap_s {
+	const char *path;
+	char *map; /* NULL when streaming */
+	size_t size;
+	off_t offset; /* next record to read */
+	MSFileParam *msfp;
+} msmap_t;
+
+extern int msmap_open(msmap_t *msmap, const char *path);
+extern int msmap_next(msmap_t *msmap, MSRecord **ppmsr, off_t *fpos, flag dataflag, flag verbose);
+extern char *msmap_record(msmap_t *msmap, off_t offset, int reclen);
+extern void msmap_close(msmap_t *msmap);
+
+#endif /* _MSMAP_H */
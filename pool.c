@@ -0,0 +1,190 @@
+/*
+ * Copyright (c) 2014 Institute of Geological & Nuclear Sciences Ltd.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *		notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *		notice, this list of conditions and the following disclaimer in the
+ *		documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+/* system includes */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <libmseed.h>
+
+#include "pool.h"
+
+static uint64_t pool_now(void) {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static void pool_wait(pool_worker_t *worker) {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_REALTIME, &ts);
+	ts.tv_nsec += 100000000L;
+	if (ts.tv_nsec >= 1000000000L) {
+		ts.tv_sec++; ts.tv_nsec -= 1000000000L;
+	}
+	(void) pthread_cond_timedwait(&worker->cond, &worker->lock, &ts);
+}
+
+static void pool_signal(pool_worker_t *worker) {
+	pthread_mutex_lock(&worker->lock);
+	pthread_cond_broadcast(&worker->cond);
+	pthread_mutex_unlock(&worker->lock);
+}
+
+static void *pool_thread(void *arg) {
+	pool_worker_t *worker = (pool_worker_t *) arg;
+	pool_t *pool = worker->pool;
+	unsigned long tail;
+
+	for (;;) {
+		tail = atomic_load(&worker->tail);
+		if (tail != atomic_load(&worker->head)) {
+			worker->received = worker->stamps[tail % pool->depth];
+			if (pool->handler(worker, worker->packets + (tail % pool->depth) * pool->reclen, pool->reclen) < 0)
+				ms_log (2, "worker %d: error processing packet\n", worker->id);
+
+			/* the slot is only free, and the packet counted as done, from here */
+			atomic_store(&worker->tail, tail + 1);
+			pool_signal(worker);
+			continue;
+		}
+
+		pthread_mutex_lock(&worker->lock);
+		if (atomic_load(&worker->tail) == atomic_load(&worker->head)) {
+			if (atomic_load(&pool->stop)) {
+				pthread_mutex_unlock(&worker->lock);
+				break;
+			}
+			pool_wait(worker);
+		}
+		pthread_mutex_unlock(&worker->lock);
+	}
+
+	return NULL;
+}
+
+int pool_start(pool_t *pool, int nworkers, int depth, int reclen, int (*handler)(pool_worker_t *, char *, int), void **data) {
+	pool_worker_t *worker;
+	int n;
+
+	memset(pool, 0, sizeof(pool_t));
+
+	pool->nworkers = nworkers;
+	pool->depth = (depth > 0) ? (unsigned long) depth : 1UL;
+	pool->reclen = reclen;
+	pool->handler = handler;
+
+	if ((pool->workers = (pool_worker_t *) calloc(nworkers, sizeof(pool_worker_t))) == NULL) {
+		ms_log (2, "memory error!\n"); return -1;
+	}
+
+	for (n = 0; n < nworkers; n++) {
+		worker = &pool->workers[n];
+		worker->pool = pool;
+		worker->id = n;
+		worker->data = (data != NULL) ? data[n] : NULL;
+
+		if ((worker->packets = (char *) malloc(pool->depth * reclen)) == NULL) {
+			ms_log (2, "memory error!\n"); return -1;
+		}
+		if ((worker->stamps = (uint64_t *) malloc(pool->depth * sizeof(uint64_t))) == NULL) {
+			ms_log (2, "memory error!\n"); return -1;
+		}
+
+		pthread_mutex_init(&worker->lock, NULL);
+		pthread_cond_init(&worker->cond, NULL);
+
+		if (pthread_create(&worker->thread, NULL, pool_thread, worker) != 0) {
+			ms_log (2, "unable to start worker thread %d\n", n); return -1;
+		}
+	}
+
+	return 0;
+}
+
+/* copy a packet to the worker owning its key, waiting for room if needed */
+int pool_dispatch(pool_t *pool, unsigned int key, char *packet) {
+	pool_worker_t *worker = &pool->workers[key % (unsigned int) pool->nworkers];
+	unsigned long head = atomic_load(&worker->head);
+	uint64_t received = pool_now(); /* before any wait for room */
+
+	if (head - atomic_load(&worker->tail) >= pool->depth) {
+		pthread_mutex_lock(&worker->lock);
+		while (head - atomic_load(&worker->tail) >= pool->depth)
+			pool_wait(worker);
+		pthread_mutex_unlock(&worker->lock);
+	}
+
+	memcpy(worker->packets + (head % pool->depth) * pool->reclen, packet, pool->reclen);
+	worker->stamps[head % pool->depth] = received;
+	atomic_store(&worker->head, head + 1);
+
+	/* only wake the worker if it may be asleep */
+	if (head == atomic_load(&worker->tail))
+		pool_signal(worker);
+
+	return 0;
+}
+
+/* wait until every dispatched packet has been processed */
+void pool_sync(pool_t *pool) {
+	pool_worker_t *worker;
+	int n;
+
+	for (n = 0; n < pool->nworkers; n++) {
+		worker = &pool->workers[n];
+		pthread_mutex_lock(&worker->lock);
+		while (atomic_load(&worker->tail) != atomic_load(&worker->head))
+			pool_wait(worker);
+		pthread_mutex_unlock(&worker->lock);
+	}
+}
+
+/* finish outstanding packets and release the workers */
+void pool_stop(pool_t *pool) {
+	pool_worker_t *worker;
+	int n;
+
+	atomic_store(&pool->stop, 1);
+
+	for (n = 0; n < pool->nworkers; n++) {
+		worker = &pool->workers[n];
+		pool_signal(worker);
+		pthread_join(worker->thread, NULL);
+
+		pthread_cond_destroy(&worker->cond);
+		pthread_mutex_destroy(&worker->lock);
+		free((char *) worker->packets);
+		free((char *) worker->stamps);
+	}
+
+	free((char *) pool->workers);
+	pool->workers = NULL;
+}
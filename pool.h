@@ -0,0 +1,72 @@
+/*
+ * Copyright (c) 2014 Institute of Geological & Nuclear Sciences Ltd.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *		notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *		notice, this list of conditions and the following disclaimer in the
+ *		documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#ifndef _POOL_H
+#define _POOL_H
+
+/*
+ * pool: spread raw packets over worker threads, a stream always goes to
+ * the same worker so its state has a single owner and stays in order.
+ *
+ */
+
+#include <stdint.h>
+#include <stdatomic.h>
+#include <pthread.h>
+
+typedef struct pool_worker_s {
+	struct pool_s *pool;
+	int id;
+	void *data; /* per worker state, owned by the worker */
+
+	char *packets; /* depth slots of reclen bytes */
+	atomic_ulong head; /* next slot to fill, dispatcher only */
+	atomic_ulong tail; /* next slot to process, advanced once done */
+	uint64_t *stamps; /* when each slot was dispatched, monotonic microseconds */
+	uint64_t received; /* dispatch time of the packet being handled */
+
+	pthread_t thread;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+} pool_worker_t;
+
+typedef struct pool_s {
+	int nworkers;
+	unsigned long depth;
+	int reclen;
+
+	int (*handler)(pool_worker_t *worker, char *packet, int reclen);
+
+	atomic_int stop;
+	pool_worker_t *workers;
+} pool_t;
+
+extern int pool_start(pool_t *pool, int nworkers, int depth, int reclen, int (*handler)(pool_worker_t *, char *, int), void **data);
+extern int pool_dispatch(pool_t *pool, unsigned int key, char *packet);
+extern void pool_sync(pool_t *pool);
+extern void pool_stop(pool_t *pool);
+
+#endif /* _POOL_H */
@@ -0,0 +1,282 @@
+/*
+ * Copyright (c) 2014 Institute of Geological & Nuclear Sciences Ltd.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *		notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *		notice, this list of conditions and the following disclaimer in the
+ *		documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+/* system includes */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <libmseed.h>
+#include <libcrex.h>
+
+#include "registry.h"
+
+#define REGISTRY_MIN_SIZE 16
+
+/* FNV-1a, adequate for short NET_STA_LOC_CHAN keys */
+unsigned int registry_hash(const char *srcname) {
+	unsigned int h = 2166136261U;
+
+	while (*srcname != '\0') {
+		h ^= (unsigned char) *srcname++;
+		h *= 16777619U;
+	}
+
+	return h;
+}
+
+/* find the slot holding the given key, or the empty slot where it belongs */
+static int registry_probe(registry_t *reg, const char *srcname, unsigned int h) {
+	int mask = reg->nslots - 1;
+	int i = (int) (h & (unsigned int) mask);
+
+	while (reg->slots[i] != 0) {
+		int n = reg->slots[i] - 1;
+		if ((reg->hashes[n] == h) && (strcmp(reg->streams[n].srcname, srcname) == 0))
+			break;
+		i = (i + 1) & mask;
+	}
+
+	return i;
+}
+
+static int registry_grow(registry_t *reg) {
+	crex_stream_t *streams;
+	unsigned int *hashes;
+	crex_tidal_t **tidals;
+	registry_counts_t *counts;
+	registry_derived_t *derived;
+	int *slots;
+	int nslots;
+	int n, i, mask;
+
+	if (reg->nstreams >= reg->maxstreams) {
+		if ((streams = (crex_stream_t *) realloc(reg->streams, 2 * reg->maxstreams * sizeof(crex_stream_t))) == NULL)
+			return -1;
+		reg->streams = streams;
+		if ((hashes = (unsigned int *) realloc(reg->hashes, 2 * reg->maxstreams * sizeof(unsigned int))) == NULL)
+			return -1;
+		reg->hashes = hashes;
+		if ((tidals = (crex_tidal_t **) realloc(reg->tidals, 2 * reg->maxstreams * sizeof(crex_tidal_t *))) == NULL)
+			return -1;
+		reg->tidals = tidals;
+		if ((counts = (registry_counts_t *) realloc(reg->counts, 2 * reg->maxstreams * sizeof(registry_counts_t))) == NULL)
+			return -1;
+		reg->counts = counts;
+		if ((derived = (registry_derived_t *) realloc(reg->derived, 2 * reg->maxstreams * sizeof(registry_derived_t))) == NULL)
+			return -1;
+		reg->derived = derived;
+		reg->maxstreams *= 2;
+	}
+
+	/* keep the table at most half full */
+	if (2 * (reg->nstreams + 1) > reg->nslots) {
+		nslots = 2 * reg->nslots;
+		if ((slots = (int *) calloc(nslots, sizeof(int))) == NULL)
+			return -1;
+
+		mask = nslots - 1;
+		for (n = 0; n < reg->nstreams; n++) {
+			i = (int) (reg->hashes[n] & (unsigned int) mask);
+			while (slots[i] != 0)
+				i = (i + 1) & mask;
+			slots[i] = n + 1;
+		}
+
+		free((char *) reg->slots);
+		reg->slots = slots;
+		reg->nslots = nslots;
+	}
+
+	return 0;
+}
+
+int registry_init(registry_t *reg, int size) {
+	int nslots = REGISTRY_MIN_SIZE;
+
+	memset(reg, 0, sizeof(registry_t));
+
+	if (size < REGISTRY_MIN_SIZE)
+		size = REGISTRY_MIN_SIZE;
+	while (nslots < 2 * size)
+		nslots *= 2;
+
+	if ((reg->streams = (crex_stream_t *) malloc(size * sizeof(crex_stream_t))) == NULL)
+		return -1;
+	if ((reg->hashes = (unsigned int *) malloc(size * sizeof(unsigned int))) == NULL)
+		return -1;
+	if ((reg->tidals = (crex_tidal_t **) malloc(size * sizeof(crex_tidal_t *))) == NULL)
+		return -1;
+	if ((reg->counts = (registry_counts_t *) malloc(size * sizeof(registry_counts_t))) == NULL)
+		return -1;
+	if ((reg->derived = (registry_derived_t *) malloc(size * sizeof(registry_derived_t))) == NULL)
+		return -1;
+	if ((reg->slots = (int *) calloc(nslots, sizeof(int))) == NULL)
+		return -1;
+
+	reg->maxstreams = size;
+	reg->nslots = nslots;
+
+	return 0;
+}
+
+void registry_free(registry_t *reg) {
+	free((char *) reg->streams);
+	free((char *) reg->hashes);
+	free((char *) reg->tidals);
+	free((char *) reg->counts);
+	free((char *) reg->derived);
+	free((char *) reg->slots);
+
+	memset(reg, 0, sizeof(registry_t));
+}
+
+crex_stream_t *registry_find(registry_t *reg, const char *srcname) {
+	unsigned int h = registry_hash(srcname);
+	int i = registry_probe(reg, srcname, h);
+
+	return (reg->slots[i] != 0) ? &reg->streams[reg->slots[i] - 1] : NULL;
+}
+
+/*
+ * find the stream for a source name, adding a zeroed entry if it is new,
+ * the returned pointer is only valid until the next stream is added.
+ */
+crex_stream_t *registry_lookup(registry_t *reg, const char *srcname, int *created) {
+	crex_stream_t *stream;
+	unsigned int h = registry_hash(srcname);
+	int i = registry_probe(reg, srcname, h);
+
+	if (created != NULL)
+		*created = 0;
+
+	if (reg->slots[i] != 0)
+		return &reg->streams[reg->slots[i] - 1];
+
+	if ((reg->nstreams >= reg->maxstreams) || (2 * (reg->nstreams + 1) > reg->nslots)) {
+		if (registry_grow(reg) < 0)
+			return NULL;
+		i = registry_probe(reg, srcname, h);
+	}
+
+	stream = &reg->streams[reg->nstreams];
+	memset(stream, 0, sizeof(crex_stream_t));
+	strncpy(stream->srcname, srcname, sizeof(stream->srcname) - 1);
+
+	reg->hashes[reg->nstreams] = h;
+	reg->tidals[reg->nstreams] = NULL;
+	memset(&reg->counts[reg->nstreams], 0, sizeof(registry_counts_t));
+	memset(&reg->derived[reg->nstreams], 0, sizeof(registry_derived_t));
+	reg->slots[i] = ++reg->nstreams;
+
+	if (created != NULL)
+		*created = 1;
+
+	return stream;
+}
+
+/* where the tidal configuration of a stream is kept */
+crex_tidal_t **registry_tidal(registry_t *reg, crex_stream_t *stream) {
+	return &reg->tidals[stream - reg->streams];
+}
+
+/* and its activity counts */
+registry_counts_t *registry_counts(registry_t *reg, crex_stream_t *stream) {
+	return &reg->counts[stream - reg->streams];
+}
+
+/* and the traces derived from it, these must be released before it is removed */
+registry_derived_t *registry_derived(registry_t *reg, crex_stream_t *stream) {
+	return &reg->derived[stream - reg->streams];
+}
+
+/*
+ * drop a stream, the last stream is moved into its place so any pointers
+ * into the registry are no longer valid.
+ */
+void registry_remove(registry_t *reg, crex_stream_t *stream) {
+	int n = (int) (stream - reg->streams);
+	int last = reg->nstreams - 1;
+	int mask = reg->nslots - 1;
+	int i, j, k;
+
+	/* empty its slot, shifting back any later entries that probed past it */
+	i = registry_probe(reg, stream->srcname, reg->hashes[n]);
+	reg->slots[i] = 0;
+	for (j = (i + 1) & mask; reg->slots[j] != 0; j = (j + 1) & mask) {
+		k = (int) (reg->hashes[reg->slots[j] - 1] & (unsigned int) mask);
+		if ((i <= j) ? ((i < k) && (k <= j)) : ((i < k) || (k <= j)))
+			continue;
+		reg->slots[i] = reg->slots[j];
+		reg->slots[j] = 0;
+		i = j;
+	}
+
+	if (n != last) {
+		i = registry_probe(reg, reg->streams[last].srcname, reg->hashes[last]);
+		memcpy(&reg->streams[n], &reg->streams[last], sizeof(crex_stream_t));
+		memcpy(&reg->counts[n], &reg->counts[last], sizeof(registry_counts_t));
+		memcpy(&reg->derived[n], &reg->derived[last], sizeof(registry_derived_t));
+		reg->hashes[n] = reg->hashes[last];
+		reg->tidals[n] = reg->tidals[last];
+		reg->slots[i] = n + 1;
+	}
+	reg->nstreams--;
+}
+
+/* give back memory once most of the streams have gone */
+int registry_compact(registry_t *reg) {
+	crex_stream_t *streams;
+	unsigned int *hashes;
+	crex_tidal_t **tidals;
+	registry_counts_t *counts;
+	registry_derived_t *derived;
+	int size = reg->maxstreams;
+
+	while ((size > REGISTRY_MIN_SIZE) && (4 * reg->nstreams < size))
+		size /= 2;
+	if (size == reg->maxstreams)
+		return 0;
+
+	if ((streams = (crex_stream_t *) realloc(reg->streams, size * sizeof(crex_stream_t))) == NULL)
+		return -1;
+	reg->streams = streams;
+	if ((hashes = (unsigned int *) realloc(reg->hashes, size * sizeof(unsigned int))) == NULL)
+		return -1;
+	reg->hashes = hashes;
+	if ((tidals = (crex_tidal_t **) realloc(reg->tidals, size * sizeof(crex_tidal_t *))) == NULL)
+		return -1;
+	reg->tidals = tidals;
+	if ((counts = (registry_counts_t *) realloc(reg->counts, size * sizeof(registry_counts_t))) == NULL)
+		return -1;
+	reg->counts = counts;
+	if ((derived = (registry_derived_t *) realloc(reg->derived, size * sizeof(registry_derived_t))) == NULL)
+		return -1;
+	reg->derived = derived;
+	reg->maxstreams = size;
+
+	return 1;
+}
@@ -0,0 +1,82 @@
+/*
+ * Copyright (c) 2014 Institute of Geological & Nuclear Sciences Ltd.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *		notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *		notice, this list of conditions and the following disclaimer in the
+ *		documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#ifndef _REGISTRY_H
+#define _REGISTRY_H
+
+/*
+ * registry: constant time lookup of crex stream state keyed on the
+ * NET_STA_LOC_CHAN source name, shared by slcrex and mscrex.
+ *
+ */
+
+#include <stdint.h>
+#include <stdatomic.h>
+
+#include <libcrex.h>
+
+/* per stream activity, updated by the owning thread and read for metrics */
+typedef struct registry_counts_s {
+	atomic_ulong packets;
+	atomic_ulong samples;
+	atomic_ulong gaps;
+	atomic_ulong pending; /* arrival of the oldest data not yet in a record, monotonic microseconds, zero if none */
+	hptime_t next; /* expected start of the next packet */
+	uint64_t seen; /* arrival of the last packet, monotonic microseconds */
+} registry_counts_t;
+
+/* the measured and residual traces derived from a stream, created on first use */
+typedef struct registry_derived_s {
+	MSTrace *traces[2];
+	hptime_t last[2]; /* time of the latest value added to each, zero if none */
+} registry_derived_t;
+
+typedef struct registry_s {
+	crex_stream_t *streams; /* contiguous per-stream state */
+	unsigned int *hashes; /* cached source name hashes, one per stream */
+	crex_tidal_t **tidals; /* tidal configuration of each stream, may be shared */
+	registry_counts_t *counts; /* activity of each stream */
+	registry_derived_t *derived; /* derived traces of each stream */
+	int nstreams;
+	int maxstreams;
+
+	int *slots; /* open addressed table of stream index + 1, zero if empty */
+	int nslots; /* always a power of two */
+} registry_t;
+
+extern int registry_init(registry_t *reg, int size);
+extern void registry_free(registry_t *reg);
+
+extern unsigned int registry_hash(const char *srcname);
+extern crex_stream_t *registry_find(registry_t *reg, const char *srcname);
+extern crex_stream_t *registry_lookup(registry_t *reg, const char *srcname, int *created);
+extern crex_tidal_t **registry_tidal(registry_t *reg, crex_stream_t *stream);
+extern registry_counts_t *registry_counts(registry_t *reg, crex_stream_t *stream);
+extern registry_derived_t *registry_derived(registry_t *reg, crex_stream_t *stream);
+extern void registry_remove(registry_t *reg, crex_stream_t *stream);
+extern int registry_compact(registry_t *reg);
+
+#endif /* _REGISTRY_H */
@@ -0,0 +1,229 @@
+/*
+ * Copyright (c) 2014 Institute of Geological & Nuclear Sciences Ltd.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *		notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *		notice, this list of conditions and the following disclaimer in the
+ *		documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+/* system includes */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <libmseed.h>
+#include <libcrex.h>
+
+#include "metrics.h"
+#include "residual.h"
+
+/* count each packed record on its way out */
+static void residual_record(char *record, int reclen, void *data) {
+	residual_t *res = (residual_t *) data;
+
+	atomic_fetch_add_explicit(&res->stats.records, 1, memory_order_relaxed);
+	atomic_fetch_add_explicit(&res->stats.bytes, (unsigned long) reclen, memory_order_relaxed);
+
+	res->handler(record, reclen, res->data);
+}
+
+int residual_init(residual_t *res, const char *codes, void (*handler)(char *, int, void *), void *data) {
+	memset(res, 0, sizeof(residual_t));
+
+	if ((codes == NULL) || (strlen(codes) != 2)) {
+		ms_log (2, "residual channels need two orientation codes [%s]\n", (codes) ? codes : "<null>"); return -1;
+	}
+	if ((res->group = mst_initgroup(NULL)) == NULL) {
+		ms_log (2, "memory error!\n"); return -1;
+	}
+	memcpy(res->codes, codes, 2);
+	res->handler = handler;
+	res->data = data;
+
+	return 0;
+}
+
+/* pack what the trace holds, only whole records unless flushing */
+static int residual_pack(residual_t *res, MSTrace *mst, flag flush) {
+	int64_t packed = 0;
+	uint64_t start;
+
+	if (mst->numsamples == 0)
+		return 0;
+
+	start = metrics_now();
+	if (mst_pack(mst, residual_record, res, RESIDUAL_RECLEN, DE_STEIM2, 1, &packed, flush, 0, NULL) < 0) {
+		ms_log (2, "unable to pack residuals for %s_%s_%s_%s\n", mst->network, mst->station, mst->location, mst->channel);
+		return -1;
+	}
+	metrics_observe(&res->stats.encodes, metrics_now() - start);
+
+	return 0;
+}
+
+/* a new trace for a derived channel, NET_STA_LOC_CHAN with a new orientation */
+static MSTrace *residual_trace(residual_t *res, const char *srcname, char code) {
+	char names[4][11];
+	const char *p = srcname, *q;
+	MSTrace *mst;
+	int n;
+
+	for (n = 0; n < 4; n++) {
+		if ((q = (n < 3) ? strchr(p, '_') : p + strlen(p)) == NULL)
+			return NULL;
+		if (q - p > 10)
+			return NULL;
+		memcpy(names[n], p, (size_t) (q - p));
+		names[n][q - p] = '\0';
+		p = q + 1;
+	}
+	if (strlen(names[3]) != 3)
+		return NULL;
+	names[3][2] = code;
+
+	if ((mst = mst_init(NULL)) == NULL)
+		return NULL;
+	strcpy(mst->network, names[0]);
+	strcpy(mst->station, names[1]);
+	strcpy(mst->location, names[2]);
+	strcpy(mst->channel, names[3]);
+	mst->dataquality = 'D';
+	mst->sampletype = 'i';
+
+	mst->next = res->group->traces;
+	res->group->traces = mst;
+	res->group->numtraces++;
+
+	return mst;
+}
+
+/*
+ * append each unbroken run of values, a gap first flushes what came before,
+ * values no later than the last one added have been seen before and are skipped
+ */
+static int residual_series(residual_t *res, MSTrace *mst, hptime_t *last, hptime_t starttime, hptime_t step, const int *values, int nvalues) {
+	int32_t *samples;
+	hptime_t start;
+	int i = 0, j;
+
+	if ((*last != 0) && (starttime <= *last + step / 2))
+		i = (int) ((*last - starttime + step / 2) / step) + 1;
+
+	while (i < nvalues) {
+		if (values[i] == CREX_NO_DATA) {
+			i++; continue;
+		}
+		for (j = i; (j < nvalues) && (values[j] != CREX_NO_DATA); j++);
+
+		start = starttime + (hptime_t) i * step;
+		if ((mst->numsamples > 0) && ((mst->samprate != (double) HPTMODULUS / (double) step) ||
+				(llabs(start - (mst->endtime + step)) > step / 2))) {
+			if (residual_pack(res, mst, 1) < 0)
+				return -1;
+		}
+		if (mst->numsamples == 0) {
+			mst->starttime = start;
+			mst->samprate = (double) HPTMODULUS / (double) step;
+		}
+
+		if ((samples = (int32_t *) realloc(mst->datasamples, (size_t) (mst->numsamples + j - i) * sizeof(int32_t))) == NULL) {
+			ms_log (2, "memory error!\n"); return -1;
+		}
+		memcpy(samples + mst->numsamples, values + i, (size_t) (j - i) * sizeof(int32_t));
+		mst->datasamples = samples;
+		mst->numsamples += j - i;
+		mst->samplecnt += j - i;
+		mst->endtime = start + (hptime_t) (j - i - 1) * step;
+		*last = mst->endtime;
+		atomic_fetch_add_explicit(&res->stats.samples, (unsigned long) (j - i), memory_order_relaxed);
+
+		i = j;
+	}
+
+	return residual_pack(res, mst, 0);
+}
+
+/*
+ * add the values of the message a stream has just packed, they are still
+ * held in its ctd buffers, one every increment minutes from the start
+ * time of the packed record. It is called for each record, a message
+ * packed into several records only adds its values once.
+ */
+int residual_message(residual_t *res, const crex_stream_t *stream, registry_derived_t *derived, hptime_t starttime) {
+	hptime_t step = (hptime_t) stream->ctd.increment * 60 * HPTMODULUS;
+	const int *values[2] = {stream->ctd.mes, stream->ctd.res};
+	int n;
+
+	if (step <= 0)
+		return -1;
+
+	for (n = 0; n < 2; n++) {
+		if ((derived->traces[n] == NULL) && ((derived->traces[n] = residual_trace(res, stream->srcname, res->codes[n])) == NULL))
+			return -1;
+		if (residual_series(res, derived->traces[n], &derived->last[n], starttime, step, values[n], CREX_BUF_SIZE) < 0)
+			return -1;
+	}
+
+	return 0;
+}
+
+/* pack what is left of the traces of a stream that is going away, and free them */
+int residual_release(residual_t *res, registry_derived_t *derived) {
+	MSTrace **link;
+	int n, rc = 0;
+
+	for (n = 0; n < 2; n++) {
+		if (derived->traces[n] == NULL)
+			continue;
+		if (residual_pack(res, derived->traces[n], 1) < 0)
+			rc = -1;
+		for (link = &res->group->traces; *link != NULL; link = &(*link)->next) {
+			if (*link == derived->traces[n]) {
+				*link = derived->traces[n]->next;
+				res->group->numtraces--;
+				break;
+			}
+		}
+		derived->traces[n]->next = NULL;
+		mst_free(&derived->traces[n]);
+	}
+
+	return rc;
+}
+
+/* pack everything held, partly filled records included */
+int residual_flush(residual_t *res) {
+	MSTrace *mst;
+	int rc = 0;
+
+	for (mst = res->group->traces; mst != NULL; mst = mst->next) {
+		if (residual_pack(res, mst, 1) < 0)
+			rc = -1;
+	}
+
+	return rc;
+}
+
+void residual_free(residual_t *res) {
+	if (res->group != NULL)
+		mst_freegroup(&res->group);
+	memset(res, 0, sizeof(residual_t));
+}
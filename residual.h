@@ -0,0 +1,72 @@
+/*
+ * Copyright (c) 2014 Institute of Geological & Nuclear Sciences Ltd.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *		notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *		notice, this list of conditions and the following disclaimer in the
+ *		documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#ifndef _RESIDUAL_H
+#define _RESIDUAL_H
+
+/*
+ * residual: the measured and detided residual values of each crex
+ * message, repacked as Steim2 compressed miniseed on derived channels.
+ *
+ * A derived channel keeps the band and instrument codes of its source
+ * and takes a new orientation code, one for each series. Samples are
+ * held on a trace per channel until a whole record can be packed, or
+ * the trace is flushed, so a record usually spans many messages.
+ */
+
+#include <stdatomic.h>
+
+#include <libmseed.h>
+#include <libcrex.h>
+
+#include "metrics.h"
+#include "registry.h"
+
+#define RESIDUAL_RECLEN 512
+
+typedef struct residual_stats_s {
+	atomic_ulong records;
+	atomic_ulong bytes;
+	atomic_ulong samples;
+	metrics_histogram_t encodes; /* each time records are packed */
+} residual_stats_t;
+
+typedef struct residual_s {
+	MSTraceGroup *group; /* every derived trace, each also held with its stream */
+	char codes[2]; /* orientation of the measured and residual channels */
+	void (*handler)(char *, int, void *);
+	void *data;
+
+	residual_stats_t stats;
+} residual_t;
+
+extern int residual_init(residual_t *res, const char *codes, void (*handler)(char *, int, void *), void *data);
+extern int residual_message(residual_t *res, const crex_stream_t *stream, registry_derived_t *derived, hptime_t starttime);
+extern int residual_release(residual_t *res, registry_derived_t *derived);
+extern int residual_flush(residual_t *res);
+extern void residual_free(residual_t *res);
+
+#endif /* _RESIDUAL_H */
@@ -0,0 +1,447 @@
+/*
+ * Copyright (c) 2014 Institute of Geological & Nuclear Sciences Ltd.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *		notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *		notice, this list of conditions and the following disclaimer in the
+ *		documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+/* system includes */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+
+#include <libmseed.h>
+
+#include "msheader.h"
+#include "registry.h"
+#include "sink.h"
+
+#define SINK_IOV 256 /* records gathered into each writev */
+
+static uint64_t sink_now(void) {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * 1000000 + (uint64_t) ts.tv_nsec / 1000;
+}
+
+int sinks_init(sinks_t *sinks, size_t size, double interval) {
+	memset(sinks, 0, sizeof(sinks_t));
+
+	/* whole pages, and at least one */
+	size = ((size + SINK_ALIGN - 1) / SINK_ALIGN) * SINK_ALIGN;
+	if (size < SINK_ALIGN)
+		size = SINK_ALIGN;
+	if (posix_memalign((void **) &sinks->buffer, SINK_ALIGN, size) != 0) {
+		ms_log (2, "memory error!\n"); sinks->buffer = NULL; return -1;
+	}
+	sinks->size = size;
+	sinks->interval = (interval > 0.0) ? (uint64_t) (interval * 1.0e6) : 0;
+
+	pthread_mutex_init(&sinks->lock, NULL);
+
+	return 0;
+}
+
+static sink_t *sink_add(sinks_t *sinks, int type) {
+	sink_t *sink;
+
+	if (sinks->nsinks >= SINK_MAX) {
+		ms_log (2, "too many outputs, at most %d\n", SINK_MAX); return NULL;
+	}
+	sink = &sinks->sinks[sinks->nsinks++];
+	memset(sink, 0, sizeof(sink_t));
+	sink->type = type;
+	sink->fd = -1;
+
+	return sink;
+}
+
+int sinks_stream(sinks_t *sinks, int fd) {
+	sink_t *sink;
+
+	if ((sink = sink_add(sinks, SINK_STREAM)) == NULL)
+		return -1;
+	sink->fd = fd;
+
+	return 0;
+}
+
+int sinks_archive(sinks_t *sinks, const char *root) {
+	sink_t *sink;
+
+	if ((sink = sink_add(sinks, SINK_ARCHIVE)) == NULL)
+		return -1;
+	if ((sink->root = strdup(root)) == NULL) {
+		ms_log (2, "memory error!\n"); return -1;
+	}
+	sinks->headers = 1;
+
+	return 0;
+}
+
+int sinks_callback(sinks_t *sinks, sink_callback_t callback, void *data) {
+	sink_t *sink;
+
+	if ((sink = sink_add(sinks, SINK_CALLBACK)) == NULL)
+		return -1;
+	sink->callback = callback;
+	sink->data = data;
+	sinks->headers = 1;
+
+	return 0;
+}
+
+static int sink_compare(const void *a, const void *b) {
+	const sink_pending_t *x = (const sink_pending_t *) a;
+	const sink_pending_t *y = (const sink_pending_t *) b;
+
+	if (x->fd != y->fd)
+		return (x->fd < y->fd) ? -1 : 1;
+	return (x->seq < y->seq) ? -1 : (x->seq > y->seq);
+}
+
+/* write every vector, carrying on after short writes */
+static int sink_writev(sinks_t *sinks, int fd, struct iovec *iov, int n) {
+	ssize_t done;
+
+	while (n > 0) {
+		if ((done = writev(fd, iov, n)) < 0) {
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+		atomic_fetch_add_explicit(&sinks->stats.writes, 1, memory_order_relaxed);
+		atomic_fetch_add_explicit(&sinks->stats.bytes, (unsigned long) done, memory_order_relaxed);
+
+		while ((n > 0) && ((size_t) done >= iov->iov_len)) {
+			done -= (ssize_t) iov->iov_len;
+			iov++; n--;
+		}
+		if (n > 0) {
+			iov->iov_base = (char *) iov->iov_base + done;
+			iov->iov_len -= (size_t) done;
+		}
+	}
+
+	return 0;
+}
+
+/* write out the buffer, one pass per file in arrival order, with the lock held */
+static int sink_flush(sinks_t *sinks) {
+	struct iovec iov[SINK_IOV];
+	sink_pending_t *pending;
+	long n = 0;
+	int fd, count, rc = 0;
+
+	if (sinks->npending == 0)
+		return 0;
+
+	qsort(sinks->pending, sinks->npending, sizeof(sink_pending_t), sink_compare);
+
+	while (n < sinks->npending) {
+		fd = sinks->pending[n].fd;
+		for (count = 0; (n < sinks->npending) && (sinks->pending[n].fd == fd); n++) {
+			pending = &sinks->pending[n];
+			/* records that follow each other in the buffer go out as one */
+			if ((count > 0) && ((char *) iov[count - 1].iov_base + iov[count - 1].iov_len == sinks->buffer + pending->offset)) {
+				iov[count - 1].iov_len += (size_t) pending->reclen;
+				continue;
+			}
+			if (count == SINK_IOV)
+				break;
+			iov[count].iov_base = sinks->buffer + pending->offset;
+			iov[count].iov_len = (size_t) pending->reclen;
+			count++;
+		}
+		if (sink_writev(sinks, fd, iov, count) < 0) {
+			ms_log (2, "error writing records: %s\n", strerror(errno));
+			atomic_fetch_add_explicit(&sinks->stats.errors, 1, memory_order_relaxed);
+			rc = -1;
+			/* the rest for this file would only fail too */
+			while ((n < sinks->npending) && (sinks->pending[n].fd == fd))
+				n++;
+		}
+	}
+
+	sinks->npending = 0;
+	sinks->length = 0;
+	sinks->oldest = 0;
+	atomic_fetch_add_explicit(&sinks->stats.flushes, 1, memory_order_relaxed);
+
+	return rc;
+}
+
+/* create the directories leading to a file */
+static int sink_mkdirs(char *path) {
+	char *p;
+
+	for (p = path + 1; *p != '\0'; p++) {
+		if (*p != '/')
+			continue;
+		*p = '\0';
+		if ((mkdir(path, 0755) < 0) && (errno != EEXIST)) {
+			*p = '/'; return -1;
+		}
+		*p = '/';
+	}
+
+	return 0;
+}
+
+/* split NET_STA_LOC_CHAN, the location may be empty */
+static int sink_names(const char *srcname, char names[4][12]) {
+	const char *p = srcname, *q;
+	int n;
+
+	for (n = 0; n < 4; n++) {
+		if ((q = (n < 3) ? strchr(p, '_') : p + strlen(p)) == NULL)
+			return -1;
+		if (q - p > 11)
+			return -1;
+		memcpy(names[n], p, (size_t) (q - p));
+		names[n][q - p] = '\0';
+		p = q + 1;
+	}
+
+	return 0;
+}
+
+/* the slot holding, or that would hold, a stream's file */
+static int sink_slot(const sink_t *sink, const char *srcname, unsigned int hash) {
+	int n = (int) (hash & (unsigned int) (sink->nslots - 1));
+	const sink_file_t *file;
+
+	while (sink->slots[n] != 0) {
+		file = &sink->files[sink->slots[n] - 1];
+		if ((file->hash == hash) && (strcmp(file->srcname, srcname) == 0))
+			break;
+		n = (n + 1) & (sink->nslots - 1);
+	}
+
+	return n;
+}
+
+/* double the slots, kept at most half full */
+static int sink_rehash(sink_t *sink) {
+	int nslots = (sink->nslots > 0) ? 2 * sink->nslots : 128;
+	int n;
+
+	free((char *) sink->slots);
+	if ((sink->slots = (int *) calloc(nslots, sizeof(int))) == NULL) {
+		ms_log (2, "memory error!\n"); sink->nslots = 0; return -1;
+	}
+	sink->nslots = nslots;
+	for (n = 0; n < sink->nfiles; n++)
+		sink->slots[sink_slot(sink, sink->files[n].srcname, sink->files[n].hash)] = n + 1;
+
+	return 0;
+}
+
+/* the day file a record belongs in, moving the stream on to a new file as needed */
+static int sink_file(sinks_t *sinks, sink_t *sink, const msheader_t *hdr) {
+	char names[4][12], path[PATH_MAX];
+	unsigned int hash = registry_hash(hdr->srcname);
+	sink_file_t *file = NULL;
+	time_t epoch;
+	struct tm tm;
+	int slot;
+
+	epoch = (time_t) MS_HPTIME2EPOCH(hdr->starttime);
+	if (gmtime_r(&epoch, &tm) == NULL)
+		return -1;
+
+	if ((2 * (sink->nfiles + 1) > sink->nslots) && (sink_rehash(sink) < 0))
+		return -1;
+	slot = sink_slot(sink, hdr->srcname, hash);
+	if (sink->slots[slot] != 0)
+		file = &sink->files[sink->slots[slot] - 1];
+	if ((file != NULL) && (file->fd >= 0) && (file->year == tm.tm_year + 1900) && (file->day == tm.tm_yday + 1))
+		return file->fd;
+
+	if (file == NULL) {
+		if (sink->nfiles >= sink->maxfiles) {
+			sink->maxfiles = (sink->maxfiles > 0) ? 2 * sink->maxfiles : 64;
+			if ((sink->files = (sink_file_t *) realloc(sink->files, sink->maxfiles * sizeof(sink_file_t))) == NULL) {
+				ms_log (2, "memory error!\n"); return -1;
+			}
+		}
+		file = &sink->files[sink->nfiles++];
+		memset(file, 0, sizeof(sink_file_t));
+		strncpy(file->srcname, hdr->srcname, sizeof(file->srcname) - 1);
+		file->hash = registry_hash(file->srcname);
+		file->fd = -1;
+		sink->slots[sink_slot(sink, file->srcname, file->hash)] = sink->nfiles;
+	}
+	else if (file->fd >= 0) {
+		/* buffered records may still be headed for the old day */
+		(void) sink_flush(sinks);
+		close(file->fd);
+		file->fd = -1;
+	}
+
+	file->year = tm.tm_year + 1900;
+	file->day = tm.tm_yday + 1;
+
+	if (sink_names(hdr->srcname, names) < 0) {
+		ms_log (2, "unable to archive %s\n", hdr->srcname); return -1;
+	}
+	if (snprintf(path, sizeof(path), "%s/%04d/%s/%s/%s.D/%s.%s.%s.%s.D.%04d.%03d", sink->root, file->year,
+			names[0], names[1], names[3], names[0], names[1], names[2], names[3], file->year, file->day) >= (int) sizeof(path)) {
+		ms_log (2, "archive path too long for %s\n", hdr->srcname); return -1;
+	}
+	if ((sink_mkdirs(path) < 0) || ((file->fd = open(path, O_WRONLY | O_CREAT | O_APPEND, 0644)) < 0)) {
+		ms_log (2, "unable to open archive file %s: %s\n", path, strerror(errno)); return -1;
+	}
+
+	return file->fd;
+}
+
+/* hand a record to every output, the header is only decoded the once */
+int sinks_push(sinks_t *sinks, char *record, int reclen) {
+	int fds[SINK_MAX], nfds = 0;
+	sink_pending_t *pending;
+	msheader_t hdr;
+	uint64_t now;
+	int n, parsed = 0, rc = 0;
+
+	if ((sinks->headers) && ((parsed = (msheader_parse(record, reclen, &hdr) == 0)) == 0))
+		ms_log (2, "error parsing mseed record header\n");
+
+	/* callbacks may block, so are kept outside the lock */
+	for (n = 0; n < sinks->nsinks; n++) {
+		if ((sinks->sinks[n].type == SINK_CALLBACK) && (parsed))
+			sinks->sinks[n].callback(record, reclen, &hdr, sinks->sinks[n].data);
+	}
+	atomic_fetch_add_explicit(&sinks->stats.records, 1, memory_order_relaxed);
+
+	pthread_mutex_lock(&sinks->lock);
+
+	for (n = 0; n < sinks->nsinks; n++) {
+		switch (sinks->sinks[n].type) {
+		case SINK_STREAM:
+			fds[nfds++] = sinks->sinks[n].fd;
+			break;
+		case SINK_ARCHIVE:
+			if (!parsed)
+				break;
+			if ((fds[nfds] = sink_file(sinks, &sinks->sinks[n], &hdr)) < 0) {
+				atomic_fetch_add_explicit(&sinks->stats.errors, 1, memory_order_relaxed);
+				rc = -1; break;
+			}
+			nfds++;
+			break;
+		}
+	}
+
+	if ((nfds > 0) && ((size_t) reclen > sinks->size)) {
+		ms_log (2, "record too large to buffer, %d bytes\n", reclen);
+		nfds = 0; rc = -1;
+	}
+	if (nfds > 0) {
+		if ((sinks->length + (size_t) reclen > sinks->size) && (sink_flush(sinks) < 0))
+			rc = -1;
+		if (sinks->npending + nfds > sinks->maxpending) {
+			sinks->maxpending = (sinks->maxpending > 0) ? 2 * sinks->maxpending : 1024;
+			if ((pending = (sink_pending_t *) realloc(sinks->pending, sinks->maxpending * sizeof(sink_pending_t))) == NULL) {
+				ms_log (2, "memory error!\n"); pthread_mutex_unlock(&sinks->lock); return -1;
+			}
+			sinks->pending = pending;
+		}
+
+		memcpy(sinks->buffer + sinks->length, record, (size_t) reclen);
+		for (n = 0; n < nfds; n++) {
+			pending = &sinks->pending[sinks->npending];
+			pending->fd = fds[n];
+			pending->seq = sinks->npending++;
+			pending->offset = sinks->length;
+			pending->reclen = reclen;
+		}
+		sinks->length += (size_t) reclen;
+
+		now = sink_now();
+		if (sinks->oldest == 0)
+			sinks->oldest = now;
+		if ((sinks->length == sinks->size) || ((sinks->interval > 0) && (now - sinks->oldest >= sinks->interval))) {
+			if (sink_flush(sinks) < 0)
+				rc = -1;
+		}
+	}
+
+	pthread_mutex_unlock(&sinks->lock);
+
+	return rc;
+}
+
+/* flush records that have waited long enough, called regularly when the input is quiet */
+int sinks_poll(sinks_t *sinks) {
+	int rc = 0;
+
+	pthread_mutex_lock(&sinks->lock);
+	if ((sinks->interval > 0) && (sinks->npending > 0) && (sink_now() - sinks->oldest >= sinks->interval))
+		rc = sink_flush(sinks);
+	pthread_mutex_unlock(&sinks->lock);
+
+	return rc;
+}
+
+int sinks_flush(sinks_t *sinks) {
+	int rc;
+
+	pthread_mutex_lock(&sinks->lock);
+	rc = sink_flush(sinks);
+	pthread_mutex_unlock(&sinks->lock);
+
+	return rc;
+}
+
+/* flush and close, streams are left open */
+void sinks_free(sinks_t *sinks) {
+	int n, f;
+
+	if (sinks->buffer == NULL)
+		return;
+
+	(void) sinks_flush(sinks);
+
+	for (n = 0; n < sinks->nsinks; n++) {
+		for (f = 0; f < sinks->sinks[n].nfiles; f++) {
+			if (sinks->sinks[n].files[f].fd >= 0)
+				close(sinks->sinks[n].files[f].fd);
+		}
+		free((char *) sinks->sinks[n].files);
+		free((char *) sinks->sinks[n].slots);
+		free(sinks->sinks[n].root);
+	}
+	free(sinks->buffer);
+	free((char *) sinks->pending);
+
+	pthread_mutex_destroy(&sinks->lock);
+	memset(sinks, 0, sizeof(sinks_t));
+}
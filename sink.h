@@ -0,0 +1,126 @@
+/*
+ * Copyright (c) 2014 Institute of Geological & Nuclear Sciences Ltd.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *		notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *		notice, this list of conditions and the following disclaimer in the
+ *		documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#ifndef _SINK_H
+#define _SINK_H
+
+/*
+ * sink: where packed records go. Records are copied once into a large
+ * aligned buffer shared by every file target, and written out together
+ * with writev when the buffer fills or the oldest record has waited long
+ * enough. Callback targets, such as datalink, are handed each record as
+ * it arrives, with its already decoded header.
+ *
+ * An archive target keeps one file per stream and day under a directory,
+ * in the SDS layout YEAR/NET/STA/CHAN.D/NET.STA.LOC.CHAN.D.YEAR.DAY,
+ * moving on to a new file as the record times cross into the next day.
+ */
+
+#include <stdint.h>
+#include <stdatomic.h>
+#include <pthread.h>
+
+#include <libmseed.h>
+
+#include "msheader.h"
+
+#define SINK_MAX 8
+#define SINK_ALIGN 4096
+
+#define SINK_STREAM 0 /* an open file descriptor, e.g. stdout */
+#define SINK_ARCHIVE 1 /* day files under a directory */
+#define SINK_CALLBACK 2 /* handed on as it arrives */
+
+typedef void (*sink_callback_t)(char *record, int reclen, const msheader_t *hdr, void *data);
+
+/* an archive day file */
+typedef struct sink_file_s {
+	char srcname[50];
+	unsigned int hash;
+	int year, day;
+	int fd;
+} sink_file_t;
+
+typedef struct sink_s {
+	int type;
+	int fd; /* stream */
+	char *root; /* archive */
+	sink_file_t *files;
+	int nfiles;
+	int maxfiles;
+	int *slots; /* open addressed on the source name hash, file index plus one, zero if empty */
+	int nslots;
+	sink_callback_t callback; /* callback */
+	void *data;
+} sink_t;
+
+/* a buffered record waiting for its file */
+typedef struct sink_pending_s {
+	int fd;
+	long seq;
+	size_t offset;
+	int reclen;
+} sink_pending_t;
+
+typedef struct sink_stats_s {
+	atomic_ulong records;
+	atomic_ulong bytes; /* written to files */
+	atomic_ulong flushes;
+	atomic_ulong writes; /* writev calls */
+	atomic_ulong errors;
+} sink_stats_t;
+
+typedef struct sinks_s {
+	sink_t sinks[SINK_MAX];
+	int nsinks;
+	int headers; /* some output needs the decoded header */
+
+	char *buffer; /* each record once, for all file targets */
+	size_t size;
+	size_t length;
+
+	sink_pending_t *pending;
+	long npending;
+	long maxpending;
+
+	uint64_t interval; /* longest a record may wait, microseconds, zero to only flush when full */
+	uint64_t oldest; /* arrival of the oldest buffered record */
+
+	pthread_mutex_t lock;
+
+	sink_stats_t stats;
+} sinks_t;
+
+extern int sinks_init(sinks_t *sinks, size_t size, double interval);
+extern int sinks_stream(sinks_t *sinks, int fd);
+extern int sinks_archive(sinks_t *sinks, const char *root);
+extern int sinks_callback(sinks_t *sinks, sink_callback_t callback, void *data);
+extern int sinks_push(sinks_t *sinks, char *record, int reclen);
+extern int sinks_poll(sinks_t *sinks);
+extern int sinks_flush(sinks_t *sinks);
+extern void sinks_free(sinks_t *sinks);
+
+#endif /* _SINK_H */
@@ -27,6 +27,7 @@
 /* system includes */
 #include <stdio.h>
 #include <stdlib.h>
+#include <unistd.h>
 #include <stdarg.h>
 #include <getopt.h>
 #include <string.h>
@@ -36,6 +37,11 @@
 #include <errno.h>
 #include <time.h>
 #include <math.h>
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <sys/epoll.h>
 
 /* libmseed library includes */
 #include <libmseed.h>
@@ -44,6 +50,20 @@
 #include <libtidal.h>
 #include <libcrex.h>
 
+#include "registry.h"
+#include "msheader.h"
+#include "journal.h"
+#include "writer.h"
+#include "pool.h"
+#include "alloc.h"
+#include "tides.h"
+#include "config.h"
+#include "metrics.h"
+#include "state.h"
+#include "snapshot.h"
+#include "sink.h"
+#include "residual.h"
+
 #define PROGRAM "slcrex" /* program name */
 
 #ifndef FIRFILTERS
@@ -62,7 +82,7 @@
 /* program variables */
 static char *program_name = PROGRAM;
 static char *program_version = PROGRAM " (" PACKAGE_VERSION ") (c) GNS 2014 (m.chadwick@gns.cri.nz)";
-static char *program_usage = PROGRAM " [-hv][-w][-i <id>][-A <alpha>][-B <beta>][-L <latitude>][-Z <zone>][-T <label/amp/lag> ...][<seedlink_options>] [<server>] [<datalink>]";
+static char *program_usage = PROGRAM " [-hv][-w][-i <id>][-A <alpha>][-B <beta>][-L <latitude>][-Z <zone>][-T <label/amp/lag> ...][-c <config>][-m <[host:]port>][-D <seconds>][-R <seconds>][-E <seconds>][-P <file>][-a <archive>][-b <kbytes>][-f <seconds>][-r <codes>][-e <seconds>][-K <dir>][-C <servers>][<seedlink_options>] [<server>] [<datalink>]";
 static char *program_prefix = "[" PROGRAM "] ";
 
 static int verbose = 0; /* program verbosity */
@@ -78,6 +98,27 @@ static char *id = "slcrex"; /* configuration file */
 static char *seedlink = ":18000"; /* datalink server to use */
 static char *datalink = NULL; /* datalink server to use */
 static int writeack = 0; /* request for write acks */
+static int window = 1; /* unacknowledged writes allowed in flight */
+
+static int queuedepth = 0; /* datalink writer queue, zero to write inline */
+static char *overflow = "block"; /* what to do when the queue fills */
+static char *spillfile = NULL; /* where overflow records are kept */
+
+static char *archive = NULL; /* local day file archive */
+static int outputsize = 1024; /* kilobytes of records gathered before writing */
+static double outputint = 1.0; /* longest a record is held back, in seconds */
+static sinks_t sinks;
+
+static char *residuals = NULL; /* orientation codes of the derived measured and residual channels */
+static residual_t residual;
+
+static double evict = 0.0; /* seconds a stream may be idle before it is dropped, zero to keep them all */
+static char *evictdir = NULL; /* where the state of dropped streams is kept until they return */
+static snapshot_t parked;
+static atomic_ulong evicted;
+static atomic_ulong faulted; /* streams brought back from evictdir */
+static char *journalfile = NULL; /* persistent writer queue */
+static int journalsize = 64; /* journal size in megabytes */
 
 /* possible options */
 static int unimode = 0;
@@ -86,15 +127,117 @@ static char *selectors = "?TH";
 static char *statefile = NULL;
 static char *streamfile = NULL;
 static int stateint = 300;
+static int updatetime = 0; /* also save state after this many seconds */
+static state_t state; /* statefiles are written in the background */
+static char *streamstate = NULL; /* per stream processing state, saved with the statefiles */
+static snapshot_t snapshot;
 
 static char *firfile = FIRFILTERS;
 
-static SLCD *slconn = NULL;
+/* FIR filter config */
+static int nfirs = 0;
+static char *firnames[FIR_MAX_FILTERS];
+
+static crex_tidal_t tidal;
+
+static char *configfile = NULL; /* per stream settings */
+static config_t config; /* the current rules */
+static config_rule_t defaults; /* settings from the command line */
+static int firloaded = 0;
+static volatile sig_atomic_t reload = 0; /* re-read the config file */
+
+static int threads = 1; /* stream processing threads */
+static pthread_mutex_t output_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* per processing thread state */
+typedef struct context_s {
+	registry_t streams;
+	tides_t tides; /* tidal configurations shared between this thread's streams only */
+	MSRecord *msr; /* kept between packets so its header and sample buffers are reused */
+	pthread_mutex_t lock; /* held while streams are added, and while the metrics read them */
+
+	uint64_t received; /* arrival of the packet being processed */
+	registry_counts_t *counts; /* of the stream being processed */
+	crex_stream_t *stream;
+	int emitted; /* records have been written for the packet */
+	metrics_histogram_t latency; /* packet arrival to crex record out */
+	metrics_histogram_t hold; /* oldest waiting data arrival to crex record out */
+	metrics_histogram_t process; /* time spent converting each packet */
+	atomic_ulong packets;
+	atomic_ulong samples;
+	atomic_ulong records;
+	atomic_ulong bytes; /* of those records */
+	atomic_ulong late; /* records out after the deadline */
+} context_t;
+
+static double deadline = 0.0; /* how long data should wait for a record, in seconds */
+
+static char *metricsaddr = NULL; /* where to serve metrics from */
+static metrics_server_t metrics;
+static volatile sig_atomic_t dump = 0; /* write the metrics to stderr */
+
+/* datalink writes made without a writer queue */
+static metrics_histogram_t writes;
+static metrics_histogram_t reconnects;
+
+/* a seedlink server, with its own stream selection and state */
+typedef struct link_s {
+	SLCD *slconn;
+	char *statefile;
+	int packetcnt; /* packets since the state was saved */
+	int done; /* the connection has terminated */
+	int behind; /* catching up on a backlog */
+	int fd; /* socket the event loop is watching, -1 if none */
+	time_t saved; /* when the state was last saved */
+	atomic_long lag; /* of the last packet behind the clock, microseconds */
+	atomic_ulong packets;
+} link_t;
+
+#define MAX_LINKS 64
+
+static char *serversfile = NULL; /* seedlink servers to collect from */
+static link_t links[MAX_LINKS];
+static int nlinks = 0;
+static volatile sig_atomic_t terminating = 0;
+
+static double catchup = 0.0; /* lag in seconds that counts as a backlog, zero to never catch up */
+static int catchupint = 60; /* state save interval in seconds while catching up */
+static atomic_int catching; /* connections catching up, per packet logging is quiet while any are */
+
+/* per packet logging, none while working through a backlog */
+static int chatty(void) {
+	return (atomic_load_explicit(&catching, memory_order_relaxed) > 0) ? 0 : verbose;
+}
+static SLCD *slconn = NULL; /* the first link, and the defaults for the rest */
 static DLCP *dlconn = NULL;
+static writer_t writer;
+static journal_t journal;
 
 /* handle any KILL/TERM signals */
+static void terminate_links(void) {
+	int n;
+
+	terminating = 1;
+	if (nlinks == 0)
+		sl_terminate(slconn);
+	for (n = 0; n < nlinks; n++)
+		sl_terminate(links[n].slconn);
+}
+
 static void term_handler(int sig) {
-	sl_terminate(slconn); return;
+	if (queuedepth > 0)
+		writer_abort(&writer);
+	terminate_links(); return;
+}
+
+/* write out the metrics from the main loop */
+static void usr1_handler(int sig) {
+	dump = 1;
+}
+
+/* re-read the config file from the main loop */
+static void hup_handler(int sig) {
+	reload = 1;
 }
 
 static void dummy_handler (int sig) {
@@ -110,46 +253,756 @@ static void err_print(char *message) {
 	fprintf(stderr, "error: %s", message);
 }
 
-static void record_handler (char *record, int reclen, void *extra) {
-	static MSRecord *msr = NULL;
-	hptime_t endtime;
+/* the datalink output, only the fixed header is needed to route the record */
+static void datalink_record (char *record, int reclen, const msheader_t *hdr, void *data) {
+	uint64_t start, reconnect;
 	char streamid[100];
-	int rv;
 
 	/* logging */
-	if (verbose > 0)
+	if (chatty() > 0)
+		ms_log (0, "%s, %d samples, %g Hz\n", hdr->srcname, hdr->numsamples, hdr->samprate);
+
+	strcpy (streamid, hdr->srcname);
+	strcat (streamid, "/MSEED");
+
+	/* Hand over to the writer thread */
+	if (queuedepth > 0) {
+		(void) writer_push (&writer, record, reclen, streamid, hdr->starttime, hdr->endtime);
+		return;
+	}
+
+	/* Send record to server */
+	start = metrics_now();
+	while (dl_write (dlconn, record, reclen, streamid, hdr->starttime, hdr->endtime, writeack) < 0) {
+		if (verbose)
+			ms_log (1, "re-connecting to datalink server\n");
+		reconnect = metrics_now();
+		if (dlconn->link != -1)
+			dl_disconnect(dlconn);
+		if (dl_connect(dlconn) < 0) {
+			ms_log (2, "error re-connecting to datalink server, sleeping 10 seconds\n"); sleep (10);
+		}
+		else {
+			metrics_observe(&reconnects, metrics_now() - reconnect);
+		}
+		if (terminating)
+			break;
+		start = metrics_now();
+	}
+	metrics_observe(&writes, metrics_now() - start);
+}
+
+static void record_handler (char *record, int reclen, void *extra) {
+	context_t *context = (context_t *) extra;
+	msheader_t hdr;
+
+	uint64_t now = metrics_now(), pending;
+
+	metrics_observe(&context->latency, now - context->received);
+	atomic_fetch_add_explicit(&context->records, 1, memory_order_relaxed);
+	atomic_fetch_add_explicit(&context->bytes, (unsigned long) reclen, memory_order_relaxed);
+
+	/* how long the record held back its oldest data */
+	if ((pending = atomic_load_explicit(&context->counts->pending, memory_order_relaxed)) != 0) {
+		metrics_observe(&context->hold, now - pending);
+		if ((deadline > 0.0) && ((double) (now - pending) > deadline * 1.0e6))
+			atomic_fetch_add_explicit(&context->late, 1, memory_order_relaxed);
+		atomic_store_explicit(&context->counts->pending, 0, memory_order_relaxed);
+	}
+	context->emitted = 1;
+
+	/* worker threads share the output */
+	if (threads > 1)
+		pthread_mutex_lock(&output_lock);
+	(void) sinks_push(&sinks, record, reclen);
+	/* the message values are still held by the stream */
+	if ((residuals) && ((msheader_parse(record, reclen, &hdr) < 0) || (residual_message(&residual, context->stream, registry_derived(&context->streams, context->stream), hdr.starttime) < 0)))
+		ms_log (2, "unable to add residuals for %s\n", context->stream->srcname);
+	if (threads > 1)
+		pthread_mutex_unlock(&output_lock);
+}
+
+/* derived records go out alongside the crex records */
+static void residual_handler (char *record, int reclen, void *extra) {
+	(void) sinks_push(&sinks, record, reclen);
+}
+
+/* (re)initialise a stream from its configured settings */
+static void stream_setup (crex_stream_t *stream, const config_rule_t *rule, double samprate) {
+	char srcname[sizeof(stream->srcname)];
+	int n;
+
+	/* any partly filled message or filter history is dropped */
+	memcpy(srcname, stream->srcname, sizeof(srcname));
+	memset(stream, 0, sizeof(crex_stream_t));
+	memcpy(stream->srcname, srcname, sizeof(srcname));
+
+	/* Insert passed ctd values. */
+	strncpy(stream->ctd.id, rule->tag, 24);
+
+	stream->alpha = rule->alpha;
+	stream->beta = rule->beta;
+
+	/* Insert default ctd values. */
+	stream->ctd.time = 0;
+	stream->ctd.temp = -1;
+	stream->ctd.autoQC = 11;
+	stream->ctd.manualQC = 7;
+	stream->ctd.offset = 0;
+	stream->ctd.increment = 1;
+
+	/* reset the CREX data arrays */
+	for (n = 0; n < CREX_BUF_SIZE; n++) {
+		stream->ctd.mes[n] = CREX_NO_DATA;
+		stream->ctd.res[n] = CREX_NO_DATA;
+	}
+
+	/* and the fir filters themselves, already checked when the settings were loaded */
+	stream->nfirs = rule->nfirs;
+	for (n = 0; n < stream->nfirs; n++) {
+		if (firfilter_find((char *) rule->firnames[n], &stream->firs[n]) < 0) {
+			ms_log(1, "could not find fir filter [%s]\n", rule->firnames[n]); exit(-1);
+		}
+	}
+
+	stream->delay = 0LL;
+	stream->samprate = samprate;
+	for (n = 0; n < stream->nfirs; n++) {
+		stream->delay -= (hptime_t) MS_EPOCH2HPTIME(((stream->firs[n].minimum) ? 0.0 : ((double) stream->firs[n].length / 2.0 - 0.5) / stream->samprate));
+		stream->samprate /= (double) stream->firs[n].decimate;
+	}
+}
+
+/* set a stream up again from its configuration and carry on from its saved values, if they still fit */
+static int stream_resume (crex_stream_t *stream, const config_rule_t *rule, const snapshot_entry_t *entry) {
+	stream_setup(stream, rule, entry->samprate);
+
+	return snapshot_restore(entry, stream, rule);
+}
+
+/* load the fir definitions on first use and check every named filter exists */
+static int check_filters (const config_rule_t *rules, int nrules) {
+	static firfilter_t fir;
+	int n, f;
+
+	for (n = 0; n < nrules; n++) {
+		if ((rules[n].nfirs > 0) && (!firloaded)) {
+			if (firfilter_load(firfile) < 0) {
+				ms_log(2, "could not load fir filter file [%s]\n", firfile); return -1;
+			}
+			firloaded = 1;
+		}
+		for (f = 0; f < rules[n].nfirs; f++) {
+			if (firfilter_find((char *) rules[n].firnames[f], &fir) < 0) {
+				ms_log(2, "could not find fir filter [%s]\n", rules[n].firnames[f]); return -1;
+			}
+		}
+	}
+
+	return 0;
+}
+
+/* swap in a new config file, only streams whose settings change are reset */
+static void reload_config (context_t *contexts) {
+	const config_rule_t *before, *after;
+	registry_t *streams;
+	config_t update = {NULL, 0};
+	int n, s, changed = 0;
+
+	if ((config_load(&update, configfile, &defaults) < 0) || (check_filters(update.rules, update.nrules) < 0)) {
+		ms_log(2, "keeping the current configuration\n"); return;
+	}
+
+	for (n = 0; n < threads; n++) {
+		streams = &contexts[n].streams;
+		for (s = 0; s < streams->nstreams; s++) {
+			if (streams->tidals[s] == NULL)
+				continue;
+			before = config_match(&config, streams->streams[s].srcname, &defaults);
+			after = config_match(&update, streams->streams[s].srcname, &defaults);
+			if (config_equal(before, after))
+				continue;
+			/* picked up again with the new settings on its next packet */
+			tides_put(&contexts[n].tides, streams->tidals[s]);
+			streams->tidals[s] = NULL;
+			changed++;
+		}
+	}
+
+	config_free(&config);
+	config = update;
+
+	if (verbose)
+		ms_log(0, "reloaded config [%s], %d rules, %d streams reset\n", configfile, config.nrules, changed);
+}
+
+/* keep the state of a stream being dropped, as a single stream snapshot written by the statefile thread */
+static int park_stream (const crex_stream_t *stream) {
+	char path[PATH_MAX];
+
+	if (snprintf(path, sizeof(path), "%s/%s.state", evictdir, stream->srcname) >= (int) sizeof(path))
+		return -1;
+	if ((snapshot_begin(&parked) < 0) || (snapshot_stream(&parked, stream, config_match(&config, stream->srcname, &defaults)) < 0))
+		return -1;
+	snapshot_end(&parked);
+
+	return state_put(&state, path, parked.buffer, parked.length);
+}
+
+/* bring back the state of a returning stream, if it was kept and still fits its settings */
+static int unpark_stream (crex_stream_t *stream, const config_rule_t *rule) {
+	const snapshot_entry_t *saved;
+	char path[PATH_MAX];
+	snapshot_map_t map;
+	int rc = 0;
+
+	if (snprintf(path, sizeof(path), "%s/%s.state", evictdir, stream->srcname) >= (int) sizeof(path))
+		return 0;
+	/* parked only just now */
+	state_wait(&state, path);
+	if (snapshot_open(&map, path) <= 0)
+		return 0;
+	if ((map.header->nstreams == 1) && ((saved = snapshot_entry(&map, NULL)) != NULL) && (strcmp(saved->srcname, stream->srcname) == 0))
+		rc = stream_resume(stream, rule, saved);
+	snapshot_close(&map);
+	(void) unlink(path);
+
+	return rc;
+}
+
+/* drop streams that have gone quiet, the workers must be idle */
+static void evict_streams (context_t *contexts) {
+	uint64_t now = metrics_now(), idle = (uint64_t) (evict * 1.0e6);
+	registry_t *streams;
+	int n, s, count = 0;
+
+	for (n = 0; n < threads; n++) {
+		streams = &contexts[n].streams;
+		pthread_mutex_lock(&contexts[n].lock);
+		/* from the end, as each removal moves the last stream down */
+		for (s = streams->nstreams - 1; s >= 0; s--) {
+			if (now - streams->counts[s].seen < idle)
+				continue;
+			/* a stream reset by a reload has nothing to keep */
+			if ((evictdir) && (streams->tidals[s] != NULL) && (park_stream(&streams->streams[s]) < 0))
+				ms_log (1, "unable to keep state of %s\n", streams->streams[s].srcname);
+			if ((residuals) && (residual_release(&residual, &streams->derived[s]) < 0))
+				ms_log (1, "unable to pack residuals of %s\n", streams->streams[s].srcname);
+			tides_put(&contexts[n].tides, streams->tidals[s]);
+			registry_remove(streams, &streams->streams[s]);
+			count++;
+		}
+		(void) registry_compact(streams);
+		pthread_mutex_unlock(&contexts[n].lock);
+	}
+	atomic_fetch_add(&evicted, (unsigned long) count);
+
+	if ((count > 0) && (verbose))
+		ms_log (0, "evicted %d idle streams\n", count);
+}
+
+/* decode a seedlink packet and run it through the crex conversion for its stream */
+static int process_packet (context_t *context, char *record) {
+	crex_stream_t *stream = NULL;
+	crex_tidal_t **shared = NULL;
+	const config_rule_t *rule = NULL;
+	registry_counts_t *counts = NULL;
+	MSRecord *msr = context->msr;
+	char srcname[100];
+	uint64_t start;
+	int psamples = 0;
+	int created = 0;
+	int rc;
+
+	/* unpack record header and data samples */
+	rc = msr_unpack (record, SLRECSIZE, &context->msr, 1, 1);
+	msr = context->msr;
+	if (rc != MS_NOERROR) {
+		sl_log(2, 0, "error parsing record\n"); return 0;
+	}
+
+	if (chatty() > 1)
 		msr_print(msr, (verbose > 2) ? 1 : 0);
+    msr_srcname(msr, srcname, 0);
+    if ((stream = registry_find(&context->streams, srcname)) == NULL) {
+        /* adding a stream may move them all */
+        pthread_mutex_lock(&context->lock);
+        stream = registry_lookup(&context->streams, srcname, &created);
+        /* a stream returning after eviction carries on where it was, if it is still set up the same */
+        if ((stream != NULL) && (created) && (evictdir) && (unpark_stream(stream, (rule = config_match(&config, srcname, &defaults))))) {
+            atomic_fetch_add(&faulted, 1);
+            shared = registry_tidal(&context->streams, stream);
+            if ((*shared = tides_get(&context->tides, &rule->tidal)) == NULL) {
+                ms_log(1, "memory error!\n"); exit(-1);
+            }
+        }
+        pthread_mutex_unlock(&context->lock);
+        if (stream == NULL) {
+            ms_log(1, "memory error!\n"); exit(-1);
+        }
+    }
+
+    /* activity, a packet not following on from the last is counted as a gap */
+    counts = registry_counts(&context->streams, stream);
+    counts->seen = context->received;
+    atomic_fetch_add_explicit(&counts->packets, 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&counts->samples, (unsigned long) msr->samplecnt, memory_order_relaxed);
+    atomic_fetch_add_explicit(&context->packets, 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&context->samples, (unsigned long) msr->samplecnt, memory_order_relaxed);
+    if (msr->samprate > 0.0) {
+        if ((counts->next != 0) && (llabs(msr->starttime - counts->next) > (hptime_t) (0.5 * HPTMODULUS / msr->samprate)))
+            atomic_fetch_add_explicit(&counts->gaps, 1, memory_order_relaxed);
+        counts->next = msr_endtime(msr) + (hptime_t) (HPTMODULUS / msr->samprate);
+    }
+
+    /* new streams, or those whose settings have been reloaded, start over */
+    shared = registry_tidal(&context->streams, stream);
+    if (*shared == NULL) {
+        rule = config_match(&config, srcname, &defaults);
+        stream_setup(stream, rule, msr->samprate);
+        /* every stream with the same tidal constants uses the same copy */
+        if ((*shared = tides_get(&context->tides, &rule->tidal)) == NULL) {
+            ms_log(1, "memory error!\n"); exit(-1);
+        }
+    }
+
+    /* this packet's samples wait from now, unless older ones already are */
+    context->counts = counts;
+    context->stream = stream;
+    context->emitted = 0;
+    if (atomic_load_explicit(&counts->pending, memory_order_relaxed) == 0)
+        atomic_store_explicit(&counts->pending, context->received, memory_order_relaxed);
+
+    start = metrics_now();
+    if (process_crex(msr, *shared, stream, record_handler, context, &psamples, -1.0, chatty()) < 0) {
+        ms_log (1, "error processing mseed block\n"); return -1;
+    }
+    metrics_observe(&context->process, metrics_now() - start);
+
+    /* what is left of the packet may still be waiting */
+    if (context->emitted)
+        atomic_store_explicit(&counts->pending, context->received, memory_order_relaxed);
+
+    if ((chatty()) && (psamples > 0))
+         ms_log(0, "packed: %d samples\n", psamples);
 
-	if ((datalink == NULL) && (fwrite(record, reclen, 1, stdout) != 1)) {
-		ms_log (2, "error writing mseed record to stdout\n"); return;
+	return 0;
+}
+
+/* each worker owns the streams hashed to it */
+static int worker_handler (pool_worker_t *worker, char *packet, int reclen) {
+	context_t *context = (context_t *) worker->data;
+
+	context->received = worker->received;
+	if (process_packet(context, packet) < 0) {
+		terminate_links(); return -1;
 	}
 
-	if (datalink != NULL) {
+	return 0;
+}
+
+/* add a seedlink connection, taking the stream selection from a list file, a stream list or just selectors */
+static int add_link (const char *server, const char *list, const char *streams, const char *select, const char *state) {
+	link_t *link;
+	SLCD *conn;
 
-		/* Parse Mini-SEED header */
-		if ((rv = msr_unpack (record, reclen, &msr, 0, 0)) != MS_NOERROR) {
-			ms_log (2, "error unpacking mseed record: %s", ms_errorstr(rv)); return;
+	if (nlinks >= MAX_LINKS) {
+		ms_log(2, "too many seedlink servers, at most %d\n", MAX_LINKS); return -1;
+	}
+	if ((conn = (nlinks == 0) ? slconn : sl_newslcd()) == NULL) {
+		ms_log(2, "memory error!\n"); return -1;
+	}
+	conn->netdly = slconn->netdly;
+	conn->netto = slconn->netto;
+	conn->keepalive = slconn->keepalive;
+	if ((conn->sladdr = strdup(server)) == NULL) {
+		ms_log(2, "memory error!\n"); return -1;
+	}
+
+	if (list) {
+		if (sl_read_streamlist (conn, list, select) < 0) {
+			ms_log(2, "unable to read streams [%s]\n", list); return -1;
+		}
+	}
+	else if (streams) {
+		if (sl_parse_streamlist (conn, streams, select) < 0) {
+			ms_log(2, "unable to load streams [%s]\n", streams); return -1;
 		}
+	}
+	else {
+		if (sl_setuniparams (conn, select, -1, 0) < 0) {
+			ms_log(2, "unable to load selectors [%s]\n", select); return -1;
+		}
+	}
 
-		msr_srcname (msr, streamid, 0);
-		strcat (streamid, "/MSEED");
+	link = &links[nlinks++];
+	memset(link, 0, sizeof(link_t));
+	link->slconn = conn;
+	link->statefile = (state) ? strdup(state) : NULL;
+	link->fd = -1;
 
-		/* Determine high precision end time */
-		endtime = msr_endtime (msr);
+	return 0;
+}
 
-		/* Send record to server */
-		while (dl_write (dlconn, record, reclen, streamid, msr->starttime, endtime, writeack) < 0) {
-			if (verbose)
-				ms_log (1, "re-connecting to datalink server\n");
-			if (dlconn->link != -1)
-				dl_disconnect(dlconn);
-			if (dl_connect(dlconn) < 0) {
-				ms_log (2, "error re-connecting to datalink server, sleeping 10 seconds\n"); sleep (10);
+/*
+ * bring back the streams as they were at the last snapshot, along with
+ * the seedlink positions they had reached, so neither is ahead of the other
+ */
+static int restore_snapshot (context_t *contexts) {
+	const snapshot_entry_t *saved;
+	const config_rule_t *rule;
+	crex_tidal_t **shared;
+	crex_stream_t *stream;
+	snapshot_map_t map;
+	const char *text;
+	size_t length;
+	context_t *context;
+	int n, rc, created, restored = 0;
+
+	if ((rc = snapshot_open(&map, streamstate)) <= 0)
+		return rc;
+
+	for (n = 0; n < nlinks; n++) {
+		if ((links[n].statefile) && ((text = snapshot_state(&map, links[n].statefile, &length)) != NULL) &&
+				(state_write(links[n].statefile, text, length) < 0)) {
+			snapshot_close(&map); return -1;
+		}
+	}
+
+	for (saved = snapshot_entry(&map, NULL); saved != NULL; saved = snapshot_entry(&map, saved)) {
+		context = &contexts[registry_hash(saved->srcname) % (unsigned int) threads];
+		if ((stream = registry_lookup(&context->streams, saved->srcname, &created)) == NULL) {
+			ms_log(2, "memory error!\n"); snapshot_close(&map); return -1;
+		}
+		if (!created)
+			continue;
+		registry_counts(&context->streams, stream)->seen = metrics_now();
+
+		/* settings that have since changed start the stream over on its first packet */
+		rule = config_match(&config, stream->srcname, &defaults);
+		if (stream_resume(stream, rule, saved)) {
+			shared = registry_tidal(&context->streams, stream);
+			if ((*shared = tides_get(&context->tides, &rule->tidal)) == NULL) {
+				ms_log(2, "memory error!\n"); snapshot_close(&map); return -1;
 			}
-			if (slconn->terminate)
-				break;
 		}
+		restored++;
 	}
+	snapshot_close(&map);
+
+	if (verbose)
+		ms_log (0, "restored %d streams from [%s]\n", restored, streamstate);
+
+	return 0;
+}
+
+/* have the records queued up to a mark reached the datalink server, those in a journal are already safe */
+static int writer_safe (uint64_t mark) {
+	if ((!datalink) || (queuedepth <= 0))
+		return 1;
+
+	return writer_reached (&writer, (unsigned long) mark);
+}
+
+/* write a held save once the writer has caught up with it, called from the seedlink loop */
+static void release_state (void) {
+	uint64_t mark;
+
+	if ((state_held (&state, &mark)) && (writer_safe (mark)))
+		state_release (&state);
+}
+
+/* copy every stream set up with the current settings, the workers must be idle */
+static int save_snapshot (context_t *contexts) {
+	registry_t *streams;
+	int n, s;
+
+	if (snapshot_begin(&snapshot) < 0)
+		return -1;
+	for (n = 0; n < nlinks; n++) {
+		if ((links[n].statefile) && (snapshot_link(&snapshot, links[n].statefile, links[n].slconn) < 0))
+			return -1;
+	}
+	for (n = 0; n < threads; n++) {
+		streams = &contexts[n].streams;
+		for (s = 0; s < streams->nstreams; s++) {
+			if ((streams->tidals[s] != NULL) &&
+					(snapshot_stream(&snapshot, &streams->streams[s], config_match(&config, streams->streams[s].srcname, &defaults)) < 0))
+				return -1;
+		}
+	}
+	snapshot_end(&snapshot);
+
+	return state_copy(&state, nlinks, snapshot.buffer, snapshot.length);
+}
+
+/*
+ * hand the positions reached, and the streams when kept, to the statefile
+ * thread, held back while records from the packets they cover are still on
+ * their way to the datalink server, so the seedlink loop never waits on it.
+ * A journal holds the records instead, and moves its checkpoint on only once
+ * every statefile has been written, so it covers them all in each save.
+ */
+static void save_state (context_t *contexts, int l) {
+	uint64_t mark = 0;
+	int n;
+
+	if ((datalink) && (journalfile) && (journal_flush (&journal, &mark) < 0))
+		return;
+	if ((datalink) && (!journalfile))
+		mark = writer_mark (&writer);
+	if (state_begin (&state, mark) != 0)
+		return;
+
+	if ((streamstate) || (journalfile)) {
+		/* the records have come from every connection */
+		for (n = 0; n < nlinks; n++) {
+			if (links[n].statefile) {
+				(void) state_save (&state, n, links[n].slconn);
+				links[n].packetcnt = 0;
+				links[n].saved = time(NULL);
+			}
+		}
+		if (streamstate)
+			(void) save_snapshot (contexts);
+	}
+	else {
+		(void) state_save (&state, l, links[l].slconn);
+	}
+
+	release_state ();
+}
+
+/* every statefile in a save has been written, called from the statefile thread */
+static void state_done (void *data, uint64_t mark) {
+	if ((datalink) && (journalfile))
+		(void) journal_checkpoint (&journal, mark);
+}
+
+/*
+ * one seedlink server per line, with optional settings in place of the command line ones, e.g.
+ *
+ *	host:18000 streams=NZ_WLGT:BTH,NZ_AUCT selectors=?TH statefile=/var/run/slcrex/host.state
+ *	other:18000 streamlist=/etc/slcrex/other.list
+ */
+static int load_links (const char *file) {
+	char line[4096], *token, *value, *save = NULL;
+	char *server, *list, *streams, *select, *state;
+	int lineno = 0;
+	FILE *fp;
+
+	if ((fp = fopen(file, "r")) == NULL) {
+		ms_log (2, "unable to open servers file [%s]\n", file); return -1;
+	}
+
+	while (fgets(line, sizeof(line), fp) != NULL) {
+		lineno++;
+		if ((token = strchr(line, '#')) != NULL)
+			*token = '\0';
+		if ((server = strtok_r(line, " \t\r\n", &save)) == NULL)
+			continue;
+
+		list = streamfile; streams = multiselect; select = selectors; state = NULL;
+		while ((token = strtok_r(NULL, " \t\r\n", &save)) != NULL) {
+			if ((value = strchr(token, '=')) != NULL)
+				*value++ = '\0';
+			if ((value != NULL) && (strcmp(token, "streamlist") == 0)) {
+				list = value;
+			}
+			else if ((value != NULL) && (strcmp(token, "streams") == 0)) {
+				streams = value;
+				list = NULL;
+			}
+			else if ((value != NULL) && (strcmp(token, "selectors") == 0))
+				select = value;
+			else if ((value != NULL) && (strcmp(token, "statefile") == 0))
+				state = value;
+			else {
+				ms_log (2, "%s:%d: invalid setting [%s]\n", file, lineno, token); fclose(fp); return -1;
+			}
+		}
+
+		if (add_link(server, list, streams, select, state) < 0) {
+			fclose(fp); return -1;
+		}
+	}
+	fclose(fp);
+
+	if (nlinks == 0) {
+		ms_log (2, "no seedlink servers given in [%s]\n", file); return -1;
+	}
+
+	return 0;
+}
+
+/*
+ * keep the event loop watching a connection's socket, added once when it
+ * connects and removed when it closes, sl_collect_nb closes a socket on
+ * one call and only opens its replacement on a later one
+ */
+static void watch_link (int epfd, int n) {
+	link_t *link = &links[n];
+	struct epoll_event ev;
+	int fd = (link->done) ? -1 : link->slconn->link;
+
+	if (fd == link->fd)
+		return;
+
+	/* closing the socket has most likely removed it already */
+	if ((link->fd >= 0) && (epoll_ctl(epfd, EPOLL_CTL_DEL, link->fd, NULL) < 0) && (errno != ENOENT) && (errno != EBADF))
+		ms_log (1, "unable to stop watching [%s]: %s\n", link->slconn->sladdr, strerror(errno));
+	link->fd = -1;
+	if (fd < 0)
+		return;
+
+	memset(&ev, 0, sizeof(ev));
+	ev.events = EPOLLIN;
+	ev.data.u32 = (uint32_t) n;
+	if ((epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev) < 0) && (errno != EEXIST))
+		ms_log (1, "unable to watch [%s], polling it instead: %s\n", link->slconn->sladdr, strerror(errno));
+	link->fd = fd;
+}
+
+/* wait for any seedlink socket to have data, or a short while so the connections can be kept alive */
+static void wait_links (int epfd) {
+	struct epoll_event events[MAX_LINKS];
+
+	(void) epoll_wait(epfd, events, MAX_LINKS, 250);
+}
+
+/* per stream counts, the owning thread may be adding streams */
+static void stream_metrics (FILE *fp, context_t *contexts, const char *name, const char *help, size_t offset) {
+	registry_t *streams;
+	int n, s;
+
+	fprintf(fp, "# HELP %s %s\n# TYPE %s counter\n", name, help, name);
+	for (n = 0; n < threads; n++) {
+		streams = &contexts[n].streams;
+		pthread_mutex_lock(&contexts[n].lock);
+		for (s = 0; s < streams->nstreams; s++)
+			fprintf(fp, "%s{stream=\"%s\"} %lu\n", name, streams->streams[s].srcname,
+				atomic_load_explicit((atomic_ulong *) ((char *) &streams->counts[s] + offset), memory_order_relaxed));
+		pthread_mutex_unlock(&contexts[n].lock);
+	}
+}
+
+/* how long each stream has had data waiting for a record, returning how many are past the deadline */
+static int pending_metrics (FILE *fp, context_t *contexts, double limit) {
+	uint64_t now = metrics_now(), pending;
+	registry_t *streams;
+	int n, s, overdue = 0;
+
+	if (fp != NULL)
+		fprintf(fp, "# HELP slcrex_stream_pending_seconds data waiting for a crex record, per stream\n# TYPE slcrex_stream_pending_seconds gauge\n");
+	for (n = 0; n < threads; n++) {
+		streams = &contexts[n].streams;
+		pthread_mutex_lock(&contexts[n].lock);
+		for (s = 0; s < streams->nstreams; s++) {
+			pending = atomic_load_explicit(&streams->counts[s].pending, memory_order_relaxed);
+			if ((pending != 0) && (pending < now) && (limit > 0.0) && ((double) (now - pending) > limit * 1.0e6))
+				overdue++;
+			if (fp != NULL)
+				fprintf(fp, "slcrex_stream_pending_seconds{stream=\"%s\"} %g\n", streams->streams[s].srcname,
+					((pending != 0) && (pending < now)) ? (double) (now - pending) / 1.0e6 : 0.0);
+		}
+		pthread_mutex_unlock(&contexts[n].lock);
+	}
+
+	return overdue;
+}
+
+/* everything is summed over the processing threads */
+static void render_metrics (FILE *fp, void *data) {
+	context_t *contexts = (context_t *) data;
+	metrics_histogram_t *hists[threads];
+	unsigned long packets = 0, samples = 0, records = 0, bytes = 0, nstreams = 0, slots = 0;
+	metrics_histogram_t *hist;
+	int n;
+
+	for (n = 0; n < threads; n++) {
+		packets += atomic_load_explicit(&contexts[n].packets, memory_order_relaxed);
+		samples += atomic_load_explicit(&contexts[n].samples, memory_order_relaxed);
+		records += atomic_load_explicit(&contexts[n].records, memory_order_relaxed);
+		bytes += atomic_load_explicit(&contexts[n].bytes, memory_order_relaxed);
+		pthread_mutex_lock(&contexts[n].lock);
+		nstreams += (unsigned long) contexts[n].streams.nstreams;
+		slots += (unsigned long) contexts[n].streams.maxstreams;
+		pthread_mutex_unlock(&contexts[n].lock);
+	}
+
+	metrics_counter(fp, "slcrex_packets_total", "seedlink data packets processed", packets);
+	metrics_counter(fp, "slcrex_samples_total", "samples in the processed packets", samples);
+	metrics_counter(fp, "slcrex_records_total", "crex records written out", records);
+	metrics_counter(fp, "slcrex_record_bytes_total", "bytes of crex records written out", bytes);
+	if (residuals) {
+		metrics_counter(fp, "slcrex_residual_records_total", "steim2 measured and residual records written out", atomic_load(&residual.stats.records));
+		metrics_counter(fp, "slcrex_residual_bytes_total", "bytes of steim2 measured and residual records", atomic_load(&residual.stats.bytes));
+		metrics_counter(fp, "slcrex_residual_samples_total", "measured and residual values repacked", atomic_load(&residual.stats.samples));
+		hist = &residual.stats.encodes;
+		metrics_histogram(fp, "slcrex_residual_encode", "steim2 packing of measured and residual values", &hist, 1);
+	}
+	metrics_gauge(fp, "slcrex_streams", "streams held", (double) nstreams);
+	metrics_gauge(fp, "slcrex_stream_slots", "stream state allocated", (double) slots);
+	metrics_gauge(fp, "slcrex_resident_bytes", "resident set size", (double) metrics_resident());
+	if (evict > 0.0) {
+		metrics_counter(fp, "slcrex_streams_evicted_total", "idle streams dropped", atomic_load(&evicted));
+		metrics_counter(fp, "slcrex_streams_restored_total", "dropped streams brought back from disk", atomic_load(&faulted));
+	}
+	if (deadline > 0.0) {
+		for (n = 0, records = 0; n < threads; n++)
+			records += atomic_load_explicit(&contexts[n].late, memory_order_relaxed);
+		metrics_counter(fp, "slcrex_records_late_total", "crex records holding data for longer than the deadline", records);
+		metrics_gauge(fp, "slcrex_streams_overdue", "streams with data waiting for longer than the deadline", (double) pending_metrics(NULL, contexts, deadline));
+	}
+
+	for (n = 0; n < threads; n++)
+		hists[n] = &contexts[n].latency;
+	metrics_histogram(fp, "slcrex_latency", "packet arrival to crex record out", hists, threads);
+	for (n = 0; n < threads; n++)
+		hists[n] = &contexts[n].hold;
+	metrics_histogram(fp, "slcrex_hold", "oldest waiting data arrival to crex record out", hists, threads);
+	for (n = 0; n < threads; n++)
+		hists[n] = &contexts[n].process;
+	metrics_histogram(fp, "slcrex_process", "crex conversion of each packet", hists, threads);
+
+	hist = (queuedepth > 0) ? &writer.stats.writes : &writes;
+	metrics_histogram(fp, "slcrex_datalink_write", "datalink record writes", &hist, 1);
+	hist = (queuedepth > 0) ? &writer.stats.reconnects : &reconnects;
+	metrics_histogram(fp, "slcrex_datalink_reconnect", "datalink reconnections", &hist, 1);
+
+	metrics_counter(fp, "slcrex_output_records_total", "records handed to the outputs", atomic_load(&sinks.stats.records));
+	metrics_counter(fp, "slcrex_output_bytes_total", "bytes written to output files", atomic_load(&sinks.stats.bytes));
+	metrics_counter(fp, "slcrex_output_flushes_total", "output buffer flushes", atomic_load(&sinks.stats.flushes));
+	metrics_counter(fp, "slcrex_output_writes_total", "vectored writes to output files", atomic_load(&sinks.stats.writes));
+	metrics_counter(fp, "slcrex_output_errors_total", "failed writes to output files", atomic_load(&sinks.stats.errors));
+
+	if ((datalink) && (queuedepth > 0)) {
+		hist = &writer.stats.delays;
+		metrics_histogram(fp, "slcrex_writer_delay", "writer queue to datalink server", &hist, 1);
+		metrics_counter(fp, "slcrex_writer_queued_total", "records queued for the writer", atomic_load(&writer.stats.queued));
+		metrics_counter(fp, "slcrex_writer_written_total", "records written by the writer", atomic_load(&writer.stats.written));
+		metrics_counter(fp, "slcrex_writer_dropped_total", "records dropped by the writer", atomic_load(&writer.stats.dropped));
+		metrics_counter(fp, "slcrex_writer_spilled_total", "records spilled by the writer", atomic_load(&writer.stats.spilled));
+		metrics_counter(fp, "slcrex_writer_replayed_total", "records resent after a reconnect", atomic_load(&writer.stats.replayed));
+		metrics_gauge(fp, "slcrex_writer_depth", "records waiting for the writer", (double) writer_depth(&writer));
+	}
+
+	fprintf(fp, "# HELP slcrex_seedlink_packets_total seedlink data packets per server\n# TYPE slcrex_seedlink_packets_total counter\n");
+	for (n = 0; n < nlinks; n++)
+		fprintf(fp, "slcrex_seedlink_packets_total{server=\"%s\"} %lu\n", links[n].slconn->sladdr, atomic_load_explicit(&links[n].packets, memory_order_relaxed));
+	fprintf(fp, "# HELP slcrex_seedlink_lag_seconds last packet end time behind the clock, per server\n# TYPE slcrex_seedlink_lag_seconds gauge\n");
+	for (n = 0; n < nlinks; n++)
+		fprintf(fp, "slcrex_seedlink_lag_seconds{server=\"%s\"} %g\n", links[n].slconn->sladdr, (double) atomic_load_explicit(&links[n].lag, memory_order_relaxed) / 1.0e6);
+	hist = &state.writes;
+	metrics_histogram(fp, "slcrex_statefile_write", "statefile writes, including syncs", &hist, 1);
+	metrics_counter(fp, "slcrex_statefile_saved_total", "statefiles written", atomic_load(&state.saved));
+	metrics_counter(fp, "slcrex_statefile_failed_total", "statefiles not written", atomic_load(&state.failed));
+	metrics_gauge(fp, "slcrex_seedlink_catching_up", "servers being read from a backlog", (double) atomic_load(&catching));
+
+	stream_metrics(fp, contexts, "slcrex_stream_packets_total", "seedlink data packets per stream", offsetof(registry_counts_t, packets));
+	stream_metrics(fp, contexts, "slcrex_stream_samples_total", "samples per stream", offsetof(registry_counts_t, samples));
+	stream_metrics(fp, contexts, "slcrex_stream_gaps_total", "packets not following on from the last, per stream", offsetof(registry_counts_t, gaps));
+	(void) pending_metrics(fp, contexts, 0.0);
 }
 
 int main(int argc, char **argv) {
@@ -157,21 +1010,20 @@ int main(int argc, char **argv) {
 
 	char buf[1024];
 
-    char srcname[100];
-    crex_tidal_t tidal;
+    context_t *contexts = NULL;
+    void **workers = NULL;
+    pool_t pool;
+    msheader_t hdr;
 
-    crex_stream_t *sp = NULL;
-    crex_stream_t *stream = NULL;
-    crex_stream_t *streams = NULL;
-
-    /* FIR filter config */
-    int nfirs = 0;
-    char *firnames[FIR_MAX_FILTERS];
-
-	MSRecord *msr = NULL;
 	SLpacket *slpack = NULL;
-	int packetcnt = 0;
-    int psamples = 0;
+	unsigned long packets = 0, allocs = 0, count;
+	link_t *link = NULL;
+	struct timespec ts;
+	hptime_t lag;
+	time_t swept = time(NULL); /* last look for idle streams */
+	int active, progress, failed = 0;
+	int epfd, l, synced;
+	uint64_t mark;
 
 	int rc;
 	int option_index = 0;
@@ -179,6 +1031,7 @@ int main(int argc, char **argv) {
 		{"help", 0, 0, 'h'},
 		{"verbose", 0, 0, 'v'},
 		{"ack", 0, 0, 'w'},
+		{"window", 1, 0, 'W'},
 		{"id", 1, 0, 'i'},
 		{"delay", 1, 0, 'd'},
 		{"timeout", 1, 0, 't'},
@@ -188,6 +1041,12 @@ int main(int argc, char **argv) {
 		{"selectors", 1, 0, 's'},
 		{"statefile", 1, 0, 'x'},
 		{"update", 1, 0, 'u'},
+		{"threads", 1, 0, 'n'},
+		{"queue", 1, 0, 'q'},
+		{"overflow", 1, 0, 'o'},
+		{"spill", 1, 0, 'j'},
+		{"journal", 1, 0, 'J'},
+		{"journal-size", 1, 0, 'M'},
         {"firfile", 1, 0, 'N'},
         {"filter", 1, 0, 'F'},
 		{"tag", 1, 0, 'I'},
@@ -196,6 +1055,20 @@ int main(int argc, char **argv) {
 		{"latitude", 1, 0, 'L'},
 		{"zone", 1, 0, 'Z'},
 		{"tide", 1, 0, 'T'},
+		{"config", 1, 0, 'c'},
+		{"metrics", 1, 0, 'm'},
+		{"servers", 1, 0, 'C'},
+		{"deadline", 1, 0, 'D'},
+		{"update-time", 1, 0, 'E'},
+		{"stream-state", 1, 0, 'P'},
+		{"archive", 1, 0, 'a'},
+		{"buffer", 1, 0, 'b'},
+		{"flush", 1, 0, 'f'},
+		{"residuals", 1, 0, 'r'},
+		{"evict", 1, 0, 'e'},
+		{"evict-dir", 1, 0, 'K'},
+		{"catchup", 1, 0, 'R'},
+		{"catchup-update", 1, 0, 'U'},
 		{0, 0, 0, 0}
 	};
 
@@ -212,8 +1085,13 @@ int main(int argc, char **argv) {
 	sigaction (SIGQUIT, &sa, NULL);
 	sigaction (SIGTERM, &sa, NULL);
 
-	sa.sa_handler = SIG_IGN;
+	sa.sa_handler = hup_handler;
 	sigaction (SIGHUP, &sa, NULL);
+
+	sa.sa_handler = usr1_handler;
+	sigaction (SIGUSR1, &sa, NULL);
+
+	sa.sa_handler = SIG_IGN;
 	sigaction (SIGPIPE, &sa, NULL);
 
 	/* adjust output logging ... -> syslog maybe? */
@@ -222,7 +1100,7 @@ int main(int argc, char **argv) {
 	/* get a new connection description */
 	slconn = sl_newslcd();
 
-	while ((rc = getopt_long(argc, argv, "hvwi:d:t:k:l:S:s:x:u:N:F:I:A:B:L:T:Z:", long_options, &option_index)) != EOF) {
+	while ((rc = getopt_long(argc, argv, "hvwW:i:d:t:k:l:S:s:x:u:n:q:o:j:J:M:N:F:I:A:B:L:T:Z:c:m:C:D:R:U:E:P:a:b:f:r:e:K:", long_options, &option_index)) != EOF) {
 		switch(rc) {
 		case '?':
 			(void) fprintf(stderr, "usage: %s\n", program_usage);
@@ -235,6 +1113,7 @@ int main(int argc, char **argv) {
 			(void) fprintf(stderr, "\t-h --help\tcommand line help (this)\n");
 			(void) fprintf(stderr, "\t-v --verbose\trun program in verbose mode\n");
 			(void) fprintf(stderr, "\t-w --ack\trequest write acks [%s]\n", (writeack) ? "on" : "off");
+			(void) fprintf(stderr, "\t-W --window\twrites in flight awaiting acks, needs a queue [%d]\n", window);
 			(void) fprintf(stderr, "\t-i --id \tprovide a config lookup key [%s]\n", id);
 			(void) fprintf(stderr, "\t-d --delay\talternative seedlink delay [%d]\n", slconn->netdly);
 			(void) fprintf(stderr, "\t-t --timeout\talternative seedlink timeout [%d]\n", slconn->netto);
@@ -243,7 +1122,24 @@ int main(int argc, char **argv) {
 			(void) fprintf(stderr, "\t-S --streams\talternative seedlink streams [%s]\n", (multiselect) ? multiselect : "<null>");
 			(void) fprintf(stderr, "\t-s --selectors\talternative seedlink selectors [%s]\n", (selectors) ? selectors : "<null>");
 			(void) fprintf(stderr, "\t-x --statefile\tseedlink statefile [%s]\n", (statefile) ? statefile : "<null>");
-			(void) fprintf(stderr, "\t-u --update\talternative state flush interval [%d]\n", stateint);
+			(void) fprintf(stderr, "\t-C --servers\tcollect from each seedlink server listed in a file [%s]\n", (serversfile) ? serversfile : "<null>");
+			(void) fprintf(stderr, "\t-u --update\talternative state flush interval in packets, zero for by time only [%d]\n", stateint);
+			(void) fprintf(stderr, "\t-P --stream-state\tsave and restore stream processing with the statefiles [%s]\n", (streamstate) ? streamstate : "<null>");
+			(void) fprintf(stderr, "\t-E --update-time\talso flush state after this many seconds, even with -u 0, zero never [%d]\n", updatetime);
+			(void) fprintf(stderr, "\t-R --catchup\tseconds behind that counts as a backlog, zero never [%g]\n", catchup);
+			(void) fprintf(stderr, "\t-U --catchup-update\tstate flush interval in seconds when catching up [%d]\n", catchupint);
+			(void) fprintf(stderr, "\t-n --threads\tstream processing threads [%d]\n", threads);
+			(void) fprintf(stderr, "\t-q --queue\tdatalink writer queue depth, zero writes inline [%d]\n", queuedepth);
+			(void) fprintf(stderr, "\t-o --overflow\tfull queue policy, block, drop or spill [%s]\n", overflow);
+			(void) fprintf(stderr, "\t-j --spill\tspill file for queue overflow [%s]\n", (spillfile) ? spillfile : "<tmp>");
+			(void) fprintf(stderr, "\t-J --journal\tpersistent datalink journal, replaces the queue [%s]\n", (journalfile) ? journalfile : "<null>");
+			(void) fprintf(stderr, "\t-M --journal-size\tjournal size in megabytes [%d]\n", journalsize);
+			(void) fprintf(stderr, "\t-a --archive\talso write records into day files under this directory [%s]\n", (archive) ? archive : "<null>");
+			(void) fprintf(stderr, "\t-b --buffer\tkilobytes of records gathered before writing to files [%d]\n", outputsize);
+			(void) fprintf(stderr, "\t-f --flush\tlongest a record waits before writing, zero until full [%g]\n", outputint);
+			(void) fprintf(stderr, "\t-e --evict\tdrop streams idle for this many seconds, zero never [%g]\n", evict);
+			(void) fprintf(stderr, "\t-K --evict-dir\tkeep the state of dropped streams here until they return [%s]\n", (evictdir) ? evictdir : "<null>");
+			(void) fprintf(stderr, "\t-r --residuals\talso write steim2 measured and residual channels, with these orientation codes [%s]\n", (residuals) ? residuals : "<null>");
             (void) fprintf(stderr, "\t-N --firfile\tprovide an alternative fir-filters file [%s]\n", firfile);
             (void) fprintf(stderr, "\t-F --filter\tadd a decimation firfilter\n");
             (void) fprintf(stderr, "\t-I --tag\tprovide CREX ID tag [%s]\n", id);
@@ -252,6 +1148,9 @@ int main(int argc, char **argv) {
             (void) fprintf(stderr, "\t-L --latitude\tprovide reference latitude [%g]\n", latitude);
             (void) fprintf(stderr, "\t-Z --zone\tprovide reference time zone offet [%g]\n", zone);
             (void) fprintf(stderr, "\t-T --tide\tprovide tidal constants [<label>/<amplitude>/<lag>]\n");
+			(void) fprintf(stderr, "\t-c --config\tper stream settings, re-read on SIGHUP [%s]\n", (configfile) ? configfile : "<null>");
+			(void) fprintf(stderr, "\t-D --deadline\tlongest data should wait for a record, reported in the metrics [%g]\n", deadline);
+			(void) fprintf(stderr, "\t-m --metrics\tserve metrics over http, also written to stderr on SIGUSR1 [%s]\n", (metricsaddr) ? metricsaddr : "<null>");
 			exit(0); /*NOTREACHED*/
 		case 'v':
 			verbose++;
@@ -259,6 +1158,9 @@ int main(int argc, char **argv) {
 		case 'w':
 			writeack++;
 			break;
+		case 'W':
+			window = atoi(optarg);
+			break;
 		case 'i':
 			id = optarg;
 			break;
@@ -286,6 +1188,24 @@ int main(int argc, char **argv) {
 		case 'u':
 			stateint = atoi(optarg);
 			break;
+		case 'n':
+			threads = atoi(optarg);
+			break;
+		case 'q':
+			queuedepth = atoi(optarg);
+			break;
+		case 'o':
+			overflow = optarg;
+			break;
+		case 'j':
+			spillfile = optarg;
+			break;
+		case 'J':
+			journalfile = optarg;
+			break;
+		case 'M':
+			journalsize = atoi(optarg);
+			break;
         case 'N':
             firfile = optarg;
             break;
@@ -317,11 +1237,54 @@ int main(int argc, char **argv) {
                 tidal.num_tides++;
             }
             break;
+		case 'c':
+			configfile = optarg;
+			break;
+		case 'm':
+			metricsaddr = optarg;
+			break;
+		case 'C':
+			serversfile = optarg;
+			break;
+		case 'D':
+			deadline = atof(optarg);
+			break;
+		case 'E':
+			updatetime = atoi(optarg);
+			break;
+		case 'P':
+			streamstate = optarg;
+			break;
+		case 'a':
+			archive = optarg;
+			break;
+		case 'b':
+			outputsize = atoi(optarg);
+			break;
+		case 'f':
+			outputint = atof(optarg);
+			break;
+		case 'r':
+			residuals = optarg;
+			break;
+		case 'e':
+			evict = atof(optarg);
+			break;
+		case 'K':
+			evictdir = optarg;
+			break;
+		case 'R':
+			catchup = atof(optarg);
+			break;
+		case 'U':
+			catchupint = atoi(optarg);
+			break;
 		}
 	}
 
 	/* who to connect to ... */
-	seedlink = ((optind < argc) ? argv[optind++] : seedlink);
+	if (!serversfile)
+		seedlink = ((optind < argc) ? argv[optind++] : seedlink);
 	datalink = ((optind < argc) ? argv[optind++] : datalink);
 
 	/* report the program version */
@@ -331,10 +1294,31 @@ int main(int argc, char **argv) {
     tidal.zone = zone;
     tidal.latitude = latitude;
 
+	/* the command line settings apply to any stream without its own */
+	strncpy(defaults.tag, tag, sizeof(defaults.tag) - 1);
+	defaults.alpha = alpha;
+	defaults.beta = beta;
+	defaults.nfirs = nfirs;
+	for (n = 0; n < nfirs; n++)
+		strncpy(defaults.firnames[n], firnames[n], CONFIG_FILTER - 1);
+	memcpy(&defaults.tidal, &tidal, sizeof(crex_tidal_t));
+
+	if ((configfile) && (config_load(&config, configfile, &defaults) < 0)) {
+		ms_log(1, "unable to load config file [%s]\n", configfile); exit(-1);
+	}
+
     /* load the base firfilter definitions if required */
-    if ((nfirs > 0) && (firfilter_load(firfile) < 0)) {
-        ms_log(1, "could not load fir filter file [%s]\n", firfile); exit(-1);
-    }
+	if ((check_filters(&defaults, 1) < 0) || (check_filters(config.rules, config.nrules) < 0)) {
+		exit(-1);
+	}
+
+	/* the journal takes the place of the writer queue */
+	if ((journalfile) && (queuedepth < 1))
+		queuedepth = 1;
+
+	if ((window > 1) && ((!writeack) || (queuedepth < 1))) {
+		ms_log(1, "a write window needs both acks and a writer queue\n"); exit(-1);
+	}
 
 	if (datalink) {
 		/* provide user tag */
@@ -351,132 +1335,279 @@ int main(int argc, char **argv) {
 		if (dlconn->writeperm != 1) {
 			ms_log(1, "datalink server is non-writable\n"); exit(-1);
 		}
+		if (queuedepth > 0) {
+			if ((rc = writer_policy(overflow)) < 0) {
+				ms_log(1, "unknown overflow policy [%s]\n", overflow); exit(-1);
+			}
+			if ((journalfile) && (journal_open(&journal, journalfile, (uint64_t) journalsize << 20) < 0)) {
+				ms_log(1, "unable to open journal [%s]\n", journalfile); exit(-1);
+			}
+			if (writer_start(&writer, dlconn, queuedepth, rc, spillfile, (journalfile) ? &journal : NULL, writeack, window, verbose) < 0) {
+				ms_log(1, "unable to start datalink writer\n"); exit(-1);
+			}
+		}
 	}
 
-	slconn->sladdr = seedlink;
-	if (streamfile) {
-		if (sl_read_streamlist (slconn, streamfile, selectors) < 0) {
-		 ms_log(1, "unable to read streams [%s]\n", streamfile); exit(-1);
-		}
+	/* datalink, a local archive, or both, otherwise stdout */
+	if (sinks_init(&sinks, (size_t) outputsize << 10, outputint) < 0) {
+		ms_log(1, "memory error!\n"); exit(-1);
 	}
-	else if (multiselect) {
-		if (sl_parse_streamlist (slconn, multiselect, selectors) < 0) {
-			ms_log(1, "unable to load streams [%s]\n", multiselect); exit(-1);
+	if ((datalink) && (sinks_callback(&sinks, datalink_record, NULL) < 0))
+		exit(-1);
+	if ((archive) && (sinks_archive(&sinks, archive) < 0))
+		exit(-1);
+	if ((!datalink) && (!archive) && (sinks_stream(&sinks, fileno(stdout)) < 0))
+		exit(-1);
+	if ((residuals) && (residual_init(&residual, residuals, residual_handler, NULL) < 0))
+		exit(-1);
+
+	/* either a list of servers, or the one given on the command line */
+	if (serversfile) {
+		if (load_links(serversfile) < 0) {
+			ms_log(1, "unable to load seedlink servers [%s]\n", serversfile); exit(-1);
 		}
 	}
-	else {
-		if (sl_setuniparams (slconn, selectors, -1, 0) < 0) {
-			ms_log(1, "unable to load selectors [%s]\n", selectors); exit(-1);
+	else if (add_link(seedlink, streamfile, multiselect, selectors, statefile) < 0) {
+		exit(-1);
+	}
+
+	/* one statefile per connection, and the streams after them */
+	if (state_start(&state, nlinks + 1, state_done, NULL) < 0) {
+		ms_log(1, "unable to start statefile writer\n"); exit(-1);
+	}
+	for (l = 0; l < nlinks; l++) {
+		links[l].saved = time(NULL);
+		if ((links[l].statefile) && (state_file(&state, l, links[l].statefile) < 0)) {
+			ms_log(1, "memory error!\n"); exit(-1);
 		}
 	}
+	if ((streamstate) && (state_file(&state, nlinks, streamstate) < 0)) {
+		ms_log(1, "memory error!\n"); exit(-1);
+	}
 
-	/* recover any statefile info ... */
-	if ((statefile) && (sl_recoverstate (slconn, statefile) < 0)) {
-		ms_log (1, "unable to recover statefile [%s]\n", statefile);
+	if ((epfd = epoll_create1(0)) < 0) {
+		ms_log(1, "unable to create event loop\n"); exit(-1);
 	}
 
-	/* loop with the connection manager */
-	while (sl_collect (slconn, &slpack)) {
-		if (sl_packettype(slpack) != SLDATA)
-            continue;
-		
-		/* unpack record header and data samples */
-		if ((rc = msr_unpack (slpack->msrecord, SLRECSIZE, &msr, 1, 1)) != MS_NOERROR) {
-			sl_log(2, 0, "error parsing record\n");
+	/* stream state lookup, one per processing thread */
+	if (threads < 1)
+		threads = 1;
+	if (((contexts = (context_t *) calloc(threads, sizeof(context_t))) == NULL) || ((workers = (void **) calloc(threads, sizeof(void *))) == NULL)) {
+		ms_log(1, "memory error!\n"); exit(-1);
+	}
+	for (n = 0; n < threads; n++) {
+		if (registry_init(&contexts[n].streams, 0) < 0) {
+			ms_log(1, "memory error!\n"); exit(-1);
 		}
+		pthread_mutex_init(&contexts[n].lock, NULL);
+		/*
+		 * process_crex takes a non const crex_tidal_t and libcrex makes no promise
+		 * not to write to it, so no set is handed to more than one thread
+		 */
+		tides_init(&contexts[n].tides, 16);
+		workers[n] = &contexts[n];
+	}
+	if ((threads > 1) && (pool_start(&pool, threads, 1024, SLRECSIZE, worker_handler, workers) < 0)) {
+		ms_log(1, "unable to start processing threads\n"); exit(-1);
+	}
 
-		if (verbose > 1)
-			msr_print(msr, (verbose > 2) ? 1 : 0);
-        msr_srcname(msr, srcname, 0);
-        for (stream = streams; stream != NULL; stream = stream->next) {
-            if (strcmp(stream->srcname, srcname) == 0)
-                break;
-        }
-        if (stream == NULL) {
-            if ((stream = (crex_stream_t *) malloc(sizeof(crex_stream_t))) == NULL) {
-                ms_log(1, "memory error!\n"); exit(-1);
-            }
-            memset(stream, 0, sizeof(crex_stream_t));
-            strcpy(stream->srcname, srcname);
-
-            /* Insert passed ctd values. */
-            strncpy(stream->ctd.id, tag, 24);
-
-            stream->alpha = alpha;
-            stream->beta = beta;
-
-            /* Insert default ctd values. */
-            stream->ctd.time = 0;
-            stream->ctd.temp = -1;
-            stream->ctd.autoQC = 11;
-            stream->ctd.manualQC = 7;
-            stream->ctd.offset = 0;
-            stream->ctd.increment = 1;
-
-            /* reset the CREX data arrays */
-            for (n = 0; n < CREX_BUF_SIZE; n++) {
-                stream->ctd.mes[n] = CREX_NO_DATA;
-                stream->ctd.res[n] = CREX_NO_DATA;
-            }
+	/* the streams, and then where seedlink should carry on from */
+	if ((streamstate) && (restore_snapshot(contexts) < 0)) {
+		ms_log(1, "unable to restore streams [%s]\n", streamstate); exit(-1);
+	}
+	for (l = 0; l < nlinks; l++) {
+		if ((links[l].statefile) && (sl_recoverstate (links[l].slconn, links[l].statefile) < 0)) {
+			ms_log (1, "unable to recover statefile [%s]\n", links[l].statefile);
+		}
+	}
 
-            /* and the fir filters themselves */
-            stream->nfirs = nfirs;
-            for (n = 0; n < stream->nfirs; n++) {
-                if (firfilter_find(firnames[n], &stream->firs[n]) < 0) {
-                    ms_log(1, "could not find fir filter [%s]\n", firnames[n]); exit(-1);
-                }
-            }
+	if ((metricsaddr) && (metrics_serve(&metrics, metricsaddr, render_metrics, contexts) < 0)) {
+		ms_log(1, "unable to serve metrics [%s]\n", metricsaddr); exit(-1);
+	}
 
-            stream->delay = 0LL;
-            stream->samprate = msr->samprate;
-            for (n = 0; n < stream->nfirs; n++) {
-                stream->delay -= (hptime_t) MS_EPOCH2HPTIME(((stream->firs[n].minimum) ? 0.0 : ((double) stream->firs[n].length / 2.0 - 0.5) / stream->samprate));
-                stream->samprate /= (double) stream->firs[n].decimate;
-            }
+	/* take a packet from each connection in turn, waiting only when none have any */
+	active = nlinks;
+	while ((active > 0) && (!failed)) {
+		progress = 0;
+		for (l = 0; (l < nlinks) && (!failed); l++) {
+			link = &links[l];
+			if (link->done)
+				continue;
+			if ((rc = sl_collect_nb (link->slconn, &slpack)) == SLTERMINATE) {
+				if (verbose)
+					ms_log (0, "seedlink connection terminated [%s]\n", link->slconn->sladdr);
+				if (link->behind)
+					atomic_fetch_sub(&catching, 1);
+				link->done = 1; active--;
+				watch_link (epfd, l);
+				continue;
+			}
+			watch_link (epfd, l);
+			if (rc != SLPACKET)
+				continue;
+			progress = 1;
 
-            if (streams != NULL) {
-                stream->next = streams;
-            }
-            streams = stream;
-        }
+			if (sl_packettype(slpack) != SLDATA)
+				continue;
+			atomic_fetch_add_explicit(&link->packets, 1, memory_order_relaxed);
 
-        if (process_crex(msr, &tidal, stream, record_handler, NULL, &psamples, -1.0, verbose) < 0) {
-            ms_log (1, "error processing mseed block\n"); break;
-        }
+			if (msheader_parse (slpack->msrecord, SLRECSIZE, &hdr) < 0) {
+				sl_log(2, 0, "error parsing record\n"); continue;
+			}
 
-        if ((verbose) && (psamples > 0))
-             ms_log(0, "packed: %d samples\n", psamples);
+			/* how far behind the clock, with some slack before going back to live */
+			clock_gettime(CLOCK_REALTIME, &ts);
+			lag = MS_EPOCH2HPTIME(ts.tv_sec) + (hptime_t) ts.tv_nsec / (1000000000 / HPTMODULUS) - hdr.endtime;
+			atomic_store_explicit(&link->lag, (long) (lag / (HPTMODULUS / 1000000)), memory_order_relaxed);
+			if ((catchup > 0.0) && (!link->behind) && ((double) lag > catchup * HPTMODULUS)) {
+				ms_log (0, "catching up [%s], %.0f seconds behind\n", link->slconn->sladdr, (double) lag / HPTMODULUS);
+				atomic_fetch_add(&catching, 1);
+				link->behind = 1;
+			}
+			else if ((link->behind) && ((double) lag < catchup * HPTMODULUS / 2.0)) {
+				ms_log (0, "caught up [%s]\n", link->slconn->sladdr);
+				atomic_fetch_sub(&catching, 1);
+				link->behind = 0;
+			}
 
-		/* done with it */
-		msr_free(&msr);
+			/* hand the packet to the thread owning its stream */
+			if (threads > 1) {
+				(void) pool_dispatch (&pool, registry_hash(hdr.srcname), slpack->msrecord);
+			}
+			else {
+				contexts[0].received = metrics_now();
+				if (process_packet (&contexts[0], slpack->msrecord) < 0) {
+					failed = 1; break;
+				}
+			}
 
-		/* Save intermediate state files */
-		if (statefile && stateint) {
-			if (++packetcnt >= stateint) {
-				sl_savestate (slconn, statefile);
-				packetcnt = 0;
+			/* confirm the steady state does not touch the heap, counting only since the last report */
+			if ((verbose) && (alloc_enabled()) && ((++packets % 10000) == 0)) {
+				count = alloc_count() - allocs;
+				allocs += count;
+				ms_log (0, "allocations: %lu over the last 10000 packets, %.3f per packet\n", count, (double) count / 10000.0);
 			}
+
+			/* Save intermediate state files, by time rather than count when catching up */
+			if (link->statefile && ((stateint) || (updatetime > 0))) {
+				++link->packetcnt;
+				/* a save still waiting on the writer puts off the next one */
+				if (((link->behind) ? (time(NULL) - link->saved >= catchupint) :
+						(((stateint) && (link->packetcnt >= stateint)) || ((updatetime > 0) && (time(NULL) - link->saved >= updatetime)))) &&
+						(state_ready (&state))) {
+					/* records from these packets must be safe before seedlink moves past them */
+					if (threads > 1)
+						pool_sync (&pool);
+					if (residuals)
+						(void) residual_flush (&residual);
+					(void) sinks_flush (&sinks);
+					save_state (contexts, l);
+					link->packetcnt = 0;
+					link->saved = time(NULL);
+				}
+			}
+		}
+
+		if (dump) {
+			dump = 0;
+			render_metrics(stderr, contexts);
+		}
+
+		/* the workers must be idle while their streams are changed */
+		if (reload) {
+			reload = 0;
+			if (threads > 1)
+				pool_sync (&pool);
+			if (configfile)
+				reload_config (contexts);
+		}
+
+		/* look for idle streams every minute, or sooner with a short timeout */
+		if ((evict > 0.0) && ((double) (time(NULL) - swept) >= ((evict < 60.0) ? evict : 60.0))) {
+			swept = time(NULL);
+			if (threads > 1)
+				pool_sync (&pool);
+			evict_streams (contexts);
 		}
+
+		/* held back records and saves are written even when nothing new arrives */
+		(void) sinks_poll (&sinks);
+		release_state ();
+
+		if ((!progress) && (active > 0) && (!failed))
+			wait_links (epfd);
 	}
 
 	/* closing down */
 	if (verbose)
 		ms_log (0, "stopping\n");
 
-	if (statefile && slconn->terminate)
-		(void) sl_savestate (slconn, statefile);
+	if (threads > 1)
+		pool_stop (&pool);
+	if (residuals)
+		(void) residual_flush (&residual);
+	(void) sinks_flush (&sinks);
+
+	if (metricsaddr)
+		metrics_stop (&metrics);
+
+	/* let the writer finish first, records given up on leave the statefiles at the last positions known to be safe */
+	if ((datalink) && (queuedepth > 0))
+		writer_stop (&writer);
+	release_state ();
+	state_flush (&state);
+	mark = 0;
+	if ((datalink) && (journalfile) && (journal_flush (&journal, &mark) < 0))
+		synced = 0;
+	else if ((synced = ((writer_safe (writer_mark (&writer))) && (state_begin (&state, mark) == 0))) == 0)
+		ms_log (1, "datalink records outstanding, statefiles not updated\n");
+
+	if ((streamstate) && (terminating) && (synced))
+		(void) save_snapshot (contexts);
+
+	for (l = 0; l < nlinks; l++) {
+		if (links[l].statefile && links[l].slconn->terminate && synced)
+			(void) state_save (&state, l, links[l].slconn);
+		if (links[l].slconn->link != -1)
+			(void) sl_disconnect (links[l].slconn);
+	}
+	close (epfd);
+
+	/* anything still to be written is written before stopping */
+	if (synced)
+		state_release (&state);
+	state_flush (&state);
+	state_stop (&state);
+	snapshot_free (&snapshot);
+	snapshot_free (&parked);
+	if (verbose)
+		ms_log (0, "statefiles: %lu saved, %lu failed\n", atomic_load(&state.saved), atomic_load(&state.failed));
 
-	if (slconn->link != -1)
-		(void) sl_disconnect (slconn);
+	if ((datalink) && (queuedepth > 0)) {
+		if (verbose)
+			writer_log (&writer);
+		if (journalfile)
+			journal_close (&journal);
+	}
 
 	if ((datalink) && (dlconn->link != -1))
 		dl_disconnect (dlconn);
-
-    stream = streams;
-    while (stream != NULL) {
-        sp = stream; stream = stream->next;
-        free((char *) sp);
-    }
+	sinks_free (&sinks);
+	residual_free (&residual);
+
+	for (n = 0; n < threads; n++) {
+		if (verbose)
+			tides_log(&contexts[n].tides);
+		for (rc = 0; rc < contexts[n].streams.nstreams; rc++)
+			tides_put(&contexts[n].tides, contexts[n].streams.tidals[rc]);
+		tides_free(&contexts[n].tides);
+		registry_free(&contexts[n].streams);
+		msr_free(&contexts[n].msr);
+		pthread_mutex_destroy(&contexts[n].lock);
+	}
+	free((char *) contexts);
+	config_free(&config);
+	free((char *) workers);
 
 	/* closing down */
 	if (verbose)
@@ -0,0 +1,319 @@
+/*
+ * Copyright (c) 2014 Institute of Geological & Nuclear Sciences Ltd.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *		notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *		notice, this list of conditions and the following disclaimer in the
+ *		documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+/* system includes */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <libmseed.h>
+#include <libslink.h>
+#include <libcrex.h>
+
+#include "state.h"
+#include "config.h"
+#include "snapshot.h"
+
+#define SNAPSHOT_ALIGN(x) (((x) + 7) & ~((size_t) 7))
+
+static int snapshot_grow(snapshot_t *snap, size_t length) {
+	char *grown;
+
+	if (length <= snap->size)
+		return 0;
+	if ((grown = (char *) realloc(snap->buffer, 2 * length)) == NULL) {
+		ms_log (2, "memory error!\n"); return -1;
+	}
+	snap->buffer = grown;
+	snap->size = 2 * length;
+
+	return 0;
+}
+
+static snapshot_header_t *snapshot_header(snapshot_t *snap) {
+	return (snapshot_header_t *) snap->buffer;
+}
+
+/* fnv-1a, enough to catch a torn or damaged file */
+static uint32_t snapshot_checksum(const char *data, size_t length) {
+	uint32_t h = 2166136261U;
+	size_t n;
+
+	for (n = 0; n < length; n++) {
+		h ^= (unsigned char) data[n];
+		h *= 16777619U;
+	}
+
+	return h;
+}
+
+/* start again, the buffer is kept between snapshots */
+int snapshot_begin(snapshot_t *snap) {
+	if (snapshot_grow(snap, sizeof(snapshot_header_t)) < 0)
+		return -1;
+
+	memset(snap->buffer, 0, sizeof(snapshot_header_t));
+	memcpy(snapshot_header(snap)->magic, SNAPSHOT_MAGIC, 8);
+	snapshot_header(snap)->bufsize = (uint32_t) CREX_BUF_SIZE;
+	snap->length = sizeof(snapshot_header_t);
+
+	return 0;
+}
+
+/* every connection comes before any stream */
+int snapshot_link(snapshot_t *snap, const char *statefile, SLCD *slconn) {
+	uint32_t lengths[2];
+	size_t start = snap->length;
+	long length;
+
+	if (snapshot_header(snap)->offset != 0)
+		return -1;
+
+	lengths[0] = (uint32_t) strlen(statefile);
+	if (snapshot_grow(snap, start + sizeof(lengths) + lengths[0]) < 0)
+		return -1;
+	memcpy(snap->buffer + start + sizeof(lengths), statefile, lengths[0]);
+
+	if ((length = state_text(slconn, &snap->buffer, &snap->size, start + sizeof(lengths) + lengths[0])) < 0)
+		return -1;
+	lengths[1] = (uint32_t) ((size_t) length - start - sizeof(lengths) - lengths[0]);
+	memcpy(snap->buffer + start, lengths, sizeof(lengths));
+
+	snap->length = (size_t) length;
+	snapshot_header(snap)->nlinks++;
+
+	return 0;
+}
+
+/* the end of the statefile texts, where the streams start */
+static int snapshot_offset(snapshot_t *snap) {
+	size_t start;
+
+	if (snapshot_header(snap)->offset != 0)
+		return 0;
+
+	start = SNAPSHOT_ALIGN(snap->length);
+	if (snapshot_grow(snap, start) < 0)
+		return -1;
+	memset(snap->buffer + snap->length, 0, start - snap->length);
+	snap->length = start;
+	snapshot_header(snap)->offset = (uint32_t) start;
+
+	return 0;
+}
+
+/* a stream set up from the given settings */
+int snapshot_stream(snapshot_t *snap, const crex_stream_t *stream, const config_rule_t *rule) {
+	snapshot_entry_t *entry;
+	size_t length = SNAPSHOT_ALIGN(sizeof(snapshot_entry_t));
+	int f;
+
+	if (snapshot_offset(snap) < 0)
+		return -1;
+
+	if ((strlen(stream->srcname) >= SNAPSHOT_SRCNAME) || (stream->nfirs != rule->nfirs)) {
+		ms_log (1, "not saving the state of stream [%s]\n", stream->srcname); return 0;
+	}
+	if (snapshot_grow(snap, snap->length + length) < 0)
+		return -1;
+
+	entry = (snapshot_entry_t *) (snap->buffer + snap->length);
+	memset(entry, 0, length);
+	entry->length = (uint32_t) length;
+	entry->nfirs = (uint32_t) stream->nfirs;
+	strcpy(entry->srcname, stream->srcname);
+	strncpy(entry->tag, stream->ctd.id, SNAPSHOT_TAG - 1);
+	entry->alpha = stream->alpha;
+	entry->beta = stream->beta;
+	entry->samprate = stream->samprate;
+	entry->ctd[0] = stream->ctd.time;
+	entry->ctd[1] = stream->ctd.temp;
+	entry->ctd[2] = stream->ctd.autoQC;
+	entry->ctd[3] = stream->ctd.manualQC;
+	entry->ctd[4] = stream->ctd.offset;
+	entry->ctd[5] = stream->ctd.increment;
+	for (f = 0; f < CREX_BUF_SIZE; f++) {
+		entry->mes[f] = stream->ctd.mes[f];
+		entry->res[f] = stream->ctd.res[f];
+	}
+	for (f = 0; f < stream->nfirs; f++) {
+		strncpy(entry->firs[f].name, rule->firnames[f], CONFIG_FILTER - 1);
+		entry->firs[f].length = stream->firs[f].length;
+		entry->firs[f].decimate = stream->firs[f].decimate;
+		/* back to the rate coming in */
+		entry->samprate *= (double) stream->firs[f].decimate;
+	}
+
+	snap->length += length;
+	snapshot_header(snap)->nstreams++;
+
+	return 0;
+}
+
+/* ready to be written */
+void snapshot_end(snapshot_t *snap) {
+	(void) snapshot_offset(snap);
+
+	snapshot_header(snap)->length = (uint32_t) snap->length;
+	snapshot_header(snap)->checksum = snapshot_checksum(snap->buffer + sizeof(snapshot_header_t), snap->length - sizeof(snapshot_header_t));
+}
+
+void snapshot_free(snapshot_t *snap) {
+	free(snap->buffer);
+	memset(snap, 0, sizeof(snapshot_t));
+}
+
+/* the stream entries must lie end to end within the file */
+static int snapshot_check(const snapshot_map_t *map, const snapshot_header_t *header) {
+	const snapshot_entry_t *entry;
+	size_t offset = header->offset;
+	uint32_t n, f;
+
+	for (n = 0; n < header->nstreams; n++) {
+		if (offset + SNAPSHOT_ALIGN(sizeof(snapshot_entry_t)) > map->size)
+			return -1;
+		entry = (const snapshot_entry_t *) (map->map + offset);
+		if ((entry->length != SNAPSHOT_ALIGN(sizeof(snapshot_entry_t))) || (entry->nfirs > FIR_MAX_FILTERS) ||
+				(memchr(entry->srcname, '\0', SNAPSHOT_SRCNAME) == NULL) || (memchr(entry->tag, '\0', SNAPSHOT_TAG) == NULL))
+			return -1;
+		for (f = 0; f < entry->nfirs; f++) {
+			if (memchr(entry->firs[f].name, '\0', CONFIG_FILTER) == NULL)
+				return -1;
+		}
+		offset += entry->length;
+	}
+
+	return (offset == map->size) ? 0 : -1;
+}
+
+/* map an existing snapshot, returns zero if there is none that can be used */
+int snapshot_open(snapshot_map_t *map, const char *path) {
+	const snapshot_header_t *header;
+	struct stat st;
+	int fd;
+
+	memset(map, 0, sizeof(snapshot_map_t));
+
+	if ((fd = open(path, O_RDONLY)) < 0)
+		return 0;
+	if ((fstat(fd, &st) < 0) || ((size_t) st.st_size < sizeof(snapshot_header_t))) {
+		close(fd); return 0;
+	}
+	if ((map->map = (char *) mmap(NULL, (size_t) st.st_size, PROT_READ, MAP_PRIVATE, fd, 0)) == MAP_FAILED) {
+		ms_log (2, "unable to map stream snapshot [%s]\n", path); map->map = NULL; close(fd); return -1;
+	}
+	close(fd);
+	map->size = (size_t) st.st_size;
+
+	header = (const snapshot_header_t *) map->map;
+	if ((memcmp(header->magic, SNAPSHOT_MAGIC, 8) != 0) || (header->bufsize != (uint32_t) CREX_BUF_SIZE) ||
+			(header->length != map->size) || (header->offset < sizeof(snapshot_header_t)) ||
+			(header->offset > map->size) || (header->offset % 8 != 0) ||
+			(header->checksum != snapshot_checksum(map->map + sizeof(snapshot_header_t), map->size - sizeof(snapshot_header_t))) ||
+			(snapshot_check(map, header) < 0)) {
+		ms_log (1, "ignoring incompatible stream snapshot [%s]\n", path);
+		snapshot_close(map);
+		return 0;
+	}
+	map->header = header;
+
+	return 1;
+}
+/* the saved seedlink state of a connection */
+const char *snapshot_state(snapshot_map_t *map, const char *statefile, size_t *length) {
+	size_t offset = sizeof(snapshot_header_t);
+	uint32_t lengths[2];
+	uint32_t n;
+
+	for (n = 0; n < map->header->nlinks; n++) {
+		if (offset + sizeof(lengths) > map->header->offset)
+			break;
+		memcpy(lengths, map->map + offset, sizeof(lengths));
+		offset += sizeof(lengths);
+		if (offset + lengths[0] + lengths[1] > map->header->offset)
+			break;
+		if ((lengths[0] == strlen(statefile)) && (memcmp(map->map + offset, statefile, lengths[0]) == 0)) {
+			*length = lengths[1];
+			return map->map + offset + lengths[0];
+		}
+		offset += lengths[0] + lengths[1];
+	}
+
+	return NULL;
+}
+
+/* the first stream entry, or the one after the given entry, NULL after the last */
+const snapshot_entry_t *snapshot_entry(snapshot_map_t *map, const snapshot_entry_t *entry) {
+	size_t offset;
+
+	offset = (entry == NULL) ? map->header->offset : (size_t) ((const char *) entry - map->map) + entry->length;
+	if ((map->header->nstreams == 0) || (offset >= map->size))
+		return NULL;
+
+	return (const snapshot_entry_t *) (map->map + offset);
+}
+
+/*
+ * copy the saved values into a stream already set up from its settings, at
+ * the saved rate, returns zero if they no longer fit, the same filters by
+ * name, length and decimation included
+ */
+int snapshot_restore(const snapshot_entry_t *entry, crex_stream_t *stream, const config_rule_t *rule) {
+	int f;
+
+	if ((entry->alpha != stream->alpha) || (entry->beta != stream->beta) ||
+			(strncmp(entry->tag, stream->ctd.id, SNAPSHOT_TAG - 1) != 0) ||
+			((int) entry->nfirs != rule->nfirs) || ((int) entry->nfirs != stream->nfirs))
+		return 0;
+	for (f = 0; f < stream->nfirs; f++) {
+		if ((strncmp(entry->firs[f].name, rule->firnames[f], CONFIG_FILTER) != 0) ||
+				(entry->firs[f].length != stream->firs[f].length) || (entry->firs[f].decimate != stream->firs[f].decimate))
+			return 0;
+	}
+
+	stream->ctd.time = entry->ctd[0];
+	stream->ctd.temp = entry->ctd[1];
+	stream->ctd.autoQC = entry->ctd[2];
+	stream->ctd.manualQC = entry->ctd[3];
+	stream->ctd.offset = entry->ctd[4];
+	stream->ctd.increment = entry->ctd[5];
+	for (f = 0; f < CREX_BUF_SIZE; f++) {
+		stream->ctd.mes[f] = entry->mes[f];
+		stream->ctd.res[f] = entry->res[f];
+	}
+
+	return 1;
+}
+
+void snapshot_close(snapshot_map_t *map) {
+	if (map->map != NULL)
+		munmap(map->map, map->size);
+	memset(map, 0, sizeof(snapshot_map_t));
+}
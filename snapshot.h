@@ -0,0 +1,111 @@
+/*
+ * Copyright (c) 2014 Institute of Geological & Nuclear Sciences Ltd.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *		notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *		notice, this list of conditions and the following disclaimer in the
+ *		documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#ifndef _SNAPSHOT_H
+#define _SNAPSHOT_H
+
+/*
+ * snapshot: the processing state of every stream, together with the
+ * seedlink positions it corresponds to.
+ *
+ * The file starts with a header, followed by the statefile text of
+ * each seedlink connection and then one entry per stream, eight byte
+ * aligned so they can be used straight from a memory mapping. Only
+ * the CREX message values are kept, along with the name, length and
+ * decimation of each filter, the filters themselves come from the
+ * configuration when a stream is restored and are primed again by the
+ * packets that follow. A checksum covers everything after the header.
+ */
+
+#include <stdint.h>
+
+#include <libslink.h>
+#include <libcrex.h>
+
+#include "config.h"
+
+#define SNAPSHOT_MAGIC "SLCREXS3"
+#define SNAPSHOT_SRCNAME 64
+#define SNAPSHOT_TAG 32
+
+typedef struct snapshot_header_s {
+	char magic[8];
+	uint32_t bufsize; /* CREX_BUF_SIZE when written */
+	uint32_t nlinks;
+	uint32_t nstreams;
+	uint32_t offset; /* of the first stream */
+	uint32_t length; /* of the whole file */
+	uint32_t checksum; /* of everything after the header */
+} snapshot_header_t;
+
+/* the filter a stream was set up with */
+typedef struct snapshot_filter_s {
+	char name[CONFIG_FILTER];
+	int32_t length;
+	int32_t decimate;
+} snapshot_filter_t;
+
+typedef struct snapshot_entry_s {
+	uint32_t length; /* of the entry */
+	uint32_t nfirs;
+	char srcname[SNAPSHOT_SRCNAME];
+	char tag[SNAPSHOT_TAG];
+	double alpha;
+	double beta;
+	double samprate; /* of the records coming in */
+	int32_t ctd[6]; /* time, temp, autoQC, manualQC, offset & increment */
+	int32_t mes[CREX_BUF_SIZE];
+	int32_t res[CREX_BUF_SIZE];
+	snapshot_filter_t firs[FIR_MAX_FILTERS];
+} snapshot_entry_t;
+
+/* being built */
+typedef struct snapshot_s {
+	char *buffer;
+	size_t size;
+	size_t length;
+} snapshot_t;
+
+/* being read */
+typedef struct snapshot_map_s {
+	char *map;
+	size_t size;
+	const snapshot_header_t *header;
+} snapshot_map_t;
+
+extern int snapshot_begin(snapshot_t *snap);
+extern int snapshot_link(snapshot_t *snap, const char *statefile, SLCD *slconn);
+extern int snapshot_stream(snapshot_t *snap, const crex_stream_t *stream, const config_rule_t *rule);
+extern void snapshot_end(snapshot_t *snap);
+extern void snapshot_free(snapshot_t *snap);
+
+extern int snapshot_open(snapshot_map_t *map, const char *path);
+extern const char *snapshot_state(snapshot_map_t *map, const char *statefile, size_t *length);
+extern const snapshot_entry_t *snapshot_entry(snapshot_map_t *map, const snapshot_entry_t *entry);
+extern int snapshot_restore(const snapshot_entry_t *entry, crex_stream_t *stream, const config_rule_t *rule);
+extern void snapshot_close(snapshot_map_t *map);
+
+#endif /* _SNAPSHOT_H */
@@ -0,0 +1,414 @@
+/*
+ * Copyright (c) 2014 Institute of Geological & Nuclear Sciences Ltd.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *		notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *		notice, this list of conditions and the following disclaimer in the
+ *		documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+/* system includes */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <libgen.h>
+#include <limits.h>
+
+#include <libmseed.h>
+#include <libslink.h>
+
+#include "state.h"
+
+/* replace a file with the given contents, syncing both the file and its directory */
+int state_write(const char *path, const char *data, size_t length) {
+	char tmp[PATH_MAX], dir[PATH_MAX];
+	size_t done;
+	ssize_t n;
+	int fd;
+
+	if (snprintf(tmp, sizeof(tmp), "%s.tmp", path) >= (int) sizeof(tmp))
+		return -1;
+
+	if ((fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0644)) < 0) {
+		ms_log (2, "unable to open statefile [%s]\n", tmp); return -1;
+	}
+	for (done = 0; done < length; done += (size_t) n) {
+		if ((n = write(fd, data + done, length - done)) < 0) {
+			ms_log (2, "unable to write statefile [%s]\n", tmp); close(fd); unlink(tmp); return -1;
+		}
+	}
+	if ((fsync(fd) < 0) || (close(fd) < 0)) {
+		ms_log (2, "unable to sync statefile [%s]\n", tmp); unlink(tmp); return -1;
+	}
+	if (rename(tmp, path) < 0) {
+		ms_log (2, "unable to replace statefile [%s]\n", path); unlink(tmp); return -1;
+	}
+
+	/* and the rename itself */
+	strncpy(dir, path, sizeof(dir) - 1); dir[sizeof(dir) - 1] = '\0';
+	if ((fd = open(dirname(dir), O_RDONLY)) >= 0) {
+		(void) fsync(fd);
+		close(fd);
+	}
+
+	return 0;
+}
+
+/* free a one off file, with the lock held or once the thread has stopped */
+static void state_free(state_item_t *item) {
+	free(item->path);
+	free(item->data);
+	free(item);
+}
+
+/* write the oldest one off file, the lock is held on entry and exit */
+static void state_item(state_t *state) {
+	state_item_t *item = state->items;
+
+	if ((state->items = item->next) == NULL)
+		state->last = NULL;
+	state->writing = item;
+	pthread_mutex_unlock(&state->lock);
+
+	if (state_write(item->path, item->data, item->length) < 0)
+		atomic_fetch_add(&state->failed, 1);
+	else
+		atomic_fetch_add(&state->saved, 1);
+
+	pthread_mutex_lock(&state->lock);
+	state->writing = NULL;
+	state_free(item);
+	pthread_cond_broadcast(&state->cond);
+}
+
+static void *state_thread(void *arg) {
+	state_t *state = (state_t *) arg;
+	state_file_t *file;
+	size_t length, size;
+	uint64_t start;
+	char *swap;
+	int n, round, rc;
+
+	pthread_mutex_lock(&state->lock);
+	while (!state->stop) {
+		if (state->items != NULL) {
+			state_item(state);
+			continue;
+		}
+		for (n = 0, file = NULL; n < state->nfiles; n++) {
+			if ((state->files[n].dirty) && (!state->files[n].held)) {
+				file = &state->files[n]; break;
+			}
+		}
+		if (file == NULL) {
+			pthread_cond_wait(&state->cond, &state->lock);
+			continue;
+		}
+
+		/* take the latest copy, a newer one may arrive while this is written */
+		swap = state->buffer; state->buffer = file->snapshot; file->snapshot = swap;
+		size = state->size; state->size = file->size; file->size = size;
+		length = file->length;
+		round = file->round;
+		file->dirty = 0;
+		file->round = 0;
+		state->busy = 1;
+		pthread_mutex_unlock(&state->lock);
+
+		start = metrics_now();
+		if ((rc = state_write(file->path, state->buffer, length)) < 0)
+			atomic_fetch_add(&state->failed, 1);
+		else
+			atomic_fetch_add(&state->saved, 1);
+		metrics_observe(&state->writes, metrics_now() - start);
+
+		pthread_mutex_lock(&state->lock);
+		if (round) {
+			if (rc < 0)
+				state->spoiled = 1;
+			if ((--state->pending == 0) && (!state->spoiled) && (state->done != NULL)) {
+				pthread_mutex_unlock(&state->lock);
+				state->done(state->data, state->mark);
+				pthread_mutex_lock(&state->lock);
+			}
+		}
+		state->busy = 0;
+		pthread_cond_broadcast(&state->cond);
+	}
+	pthread_mutex_unlock(&state->lock);
+
+	return NULL;
+}
+
+int state_start(state_t *state, int nfiles, void (*done)(void *data, uint64_t mark), void *data) {
+	memset(state, 0, sizeof(state_t));
+	state->done = done;
+	state->data = data;
+
+	if ((state->files = (state_file_t *) calloc(nfiles, sizeof(state_file_t))) == NULL) {
+		ms_log (2, "memory error!\n"); return -1;
+	}
+	state->nfiles = nfiles;
+
+	pthread_mutex_init(&state->lock, NULL);
+	pthread_cond_init(&state->cond, NULL);
+
+	if (pthread_create(&state->thread, NULL, state_thread, state) != 0) {
+		ms_log (2, "unable to start statefile thread\n"); return -1;
+	}
+
+	return 0;
+}
+
+int state_file(state_t *state, int index, const char *path) {
+	pthread_mutex_lock(&state->lock);
+	state->files[index].path = strdup(path);
+	pthread_mutex_unlock(&state->lock);
+
+	return (state->files[index].path != NULL) ? 0 : -1;
+}
+
+/* make room for more bytes at the end of a growing buffer */
+static int state_grow(char **buffer, size_t *size, size_t length) {
+	char *grown;
+
+	if (length <= *size)
+		return 0;
+	if ((grown = (char *) realloc(*buffer, 2 * length)) == NULL) {
+		ms_log (2, "memory error!\n"); return -1;
+	}
+	*buffer = grown;
+	*size = 2 * length;
+
+	return 0;
+}
+
+/* a file saved while a save is held back becomes part of it */
+static void state_join(state_t *state, state_file_t *file) {
+	if ((state->holding) && (!file->round)) {
+		file->round = 1;
+		state->pending++;
+	}
+	file->held = state->holding;
+}
+
+/* append the current stream positions, the same as sl_savestate would write them, returning the new length */
+long state_text(SLCD *slconn, char **buffer, size_t *size, size_t length) {
+	SLstream *stream;
+	char line[200];
+	int n;
+
+	for (stream = slconn->streams; stream != NULL; stream = stream->next) {
+		n = snprintf(line, sizeof(line), "%s %s %d %s\n", stream->net, stream->sta, stream->seqnum, stream->timestamp);
+		if ((n < 0) || (n >= (int) sizeof(line)))
+			continue;
+		if (state_grow(buffer, size, length + (size_t) n) < 0)
+			return -1;
+		memcpy(*buffer + length, line, (size_t) n);
+		length += (size_t) n;
+	}
+
+	return (long) length;
+}
+
+int state_save(state_t *state, int index, SLCD *slconn) {
+	state_file_t *file = &state->files[index];
+	long length;
+
+	pthread_mutex_lock(&state->lock);
+	if ((length = state_text(slconn, &file->snapshot, &file->size, 0)) >= 0) {
+		file->length = (size_t) length;
+		file->dirty = 1;
+		state_join(state, file);
+		pthread_cond_broadcast(&state->cond);
+	}
+	pthread_mutex_unlock(&state->lock);
+
+	return (length < 0) ? -1 : 0;
+}
+
+/* as above, for any other contents */
+int state_copy(state_t *state, int index, const char *data, size_t length) {
+	state_file_t *file = &state->files[index];
+	int rc;
+
+	pthread_mutex_lock(&state->lock);
+	if ((rc = state_grow(&file->snapshot, &file->size, length)) == 0) {
+		memcpy(file->snapshot, data, length);
+		file->length = length;
+		file->dirty = 1;
+		state_join(state, file);
+		pthread_cond_broadcast(&state->cond);
+	}
+	pthread_mutex_unlock(&state->lock);
+
+	return rc;
+}
+
+/* queue a copy of a one off file to be written */
+int state_put(state_t *state, const char *path, const char *data, size_t length) {
+	state_item_t *item;
+
+	if ((item = (state_item_t *) calloc(1, sizeof(state_item_t))) == NULL) {
+		ms_log (2, "memory error!\n"); return -1;
+	}
+	if (((item->path = strdup(path)) == NULL) || ((item->data = (char *) malloc(length + 1)) == NULL)) {
+		ms_log (2, "memory error!\n"); state_free(item); return -1;
+	}
+	memcpy(item->data, data, length);
+	item->length = length;
+
+	pthread_mutex_lock(&state->lock);
+	if (state->last != NULL)
+		state->last->next = item;
+	else
+		state->items = item;
+	state->last = item;
+	pthread_cond_broadcast(&state->cond);
+	pthread_mutex_unlock(&state->lock);
+
+	return 0;
+}
+
+/* is a one off file waiting to be written, must hold the lock */
+static int state_queued(state_t *state, const char *path) {
+	state_item_t *item;
+
+	if ((state->writing != NULL) && ((path == NULL) || (strcmp(state->writing->path, path) == 0)))
+		return 1;
+	for (item = state->items; item != NULL; item = item->next) {
+		if ((path == NULL) || (strcmp(item->path, path) == 0))
+			return 1;
+	}
+
+	return 0;
+}
+
+/* wait for a one off file to be written before reading it back */
+void state_wait(state_t *state, const char *path) {
+	pthread_mutex_lock(&state->lock);
+	while (state_queued(state, path))
+		pthread_cond_wait(&state->cond, &state->lock);
+	pthread_mutex_unlock(&state->lock);
+}
+
+/*
+ * hold back the copies saved from now on until state_release, so the thread
+ * leaves them alone until the records they cover are safe, the mark saying
+ * which. Only one save is in progress at a time, returns 1 if one still is.
+ */
+int state_begin(state_t *state, uint64_t mark) {
+	int rc = 1;
+
+	pthread_mutex_lock(&state->lock);
+	if ((!state->holding) && (state->pending == 0)) {
+		state->holding = 1;
+		state->mark = mark;
+		state->spoiled = 0;
+		rc = 0;
+	}
+	pthread_mutex_unlock(&state->lock);
+
+	return rc;
+}
+
+/* is a save still held back, and for which mark */
+int state_held(state_t *state, uint64_t *mark) {
+	int held;
+
+	pthread_mutex_lock(&state->lock);
+	held = state->holding;
+	if (mark != NULL)
+		*mark = state->mark;
+	pthread_mutex_unlock(&state->lock);
+
+	return held;
+}
+
+/* can a new save begin, the last one having been released and written */
+int state_ready(state_t *state) {
+	int ready;
+
+	pthread_mutex_lock(&state->lock);
+	ready = ((!state->holding) && (state->pending == 0));
+	pthread_mutex_unlock(&state->lock);
+
+	return ready;
+}
+
+/* let the thread write the held copies */
+void state_release(state_t *state) {
+	int n, done;
+
+	pthread_mutex_lock(&state->lock);
+	for (n = 0; n < state->nfiles; n++)
+		state->files[n].held = 0;
+	done = ((state->holding) && (state->pending == 0) && (state->done != NULL));
+	state->holding = 0;
+	pthread_cond_broadcast(&state->cond);
+	pthread_mutex_unlock(&state->lock);
+
+	/* nothing to write */
+	if (done)
+		state->done(state->data, state->mark);
+}
+
+/* wait until every copy and one off file has been written, other than any still held */
+void state_flush(state_t *state) {
+	int n, dirty;
+
+	pthread_mutex_lock(&state->lock);
+	do {
+		for (n = 0, dirty = ((state->busy) || (state_queued(state, NULL))); (n < state->nfiles) && (!dirty); n++)
+			dirty = (state->files[n].dirty) && (!state->files[n].held);
+		if (dirty)
+			pthread_cond_wait(&state->cond, &state->lock);
+	} while (dirty);
+	pthread_mutex_unlock(&state->lock);
+}
+
+/* stop the thread, anything not yet written is dropped, see state_flush */
+void state_stop(state_t *state) {
+	state_item_t *item;
+	int n;
+
+	pthread_mutex_lock(&state->lock);
+	state->stop = 1;
+	pthread_cond_broadcast(&state->cond);
+	pthread_mutex_unlock(&state->lock);
+
+	pthread_join(state->thread, NULL);
+
+	for (n = 0; n < state->nfiles; n++) {
+		free(state->files[n].path);
+		free(state->files[n].snapshot);
+	}
+	free((char *) state->files);
+	free(state->buffer);
+	while ((item = state->items) != NULL) {
+		state->items = item->next;
+		state_free(item);
+	}
+
+	pthread_cond_destroy(&state->cond);
+	pthread_mutex_destroy(&state->lock);
+}
@@ -0,0 +1,117 @@
+/*
+ * Copyright (c) 2014 Institute of Geological & Nuclear Sciences Ltd.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *		notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *		notice, this list of conditions and the following disclaimer in the
+ *		documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#ifndef _STATE_H
+#define _STATE_H
+
+/*
+ * state: seedlink statefiles written away from the collection loop.
+ *
+ * The stream sequence numbers are copied in the format sl_savestate
+ * uses, so sl_recoverstate can read them back, and a background thread
+ * writes each copy to a temporary file, syncs it and renames it over
+ * the statefile, so a crash leaves either the old or the new state.
+ * Other files, such as stream snapshots, can be written the same way,
+ * as can one off files not known in advance.
+ * A save can be held back until the records it covers are safe
+ * elsewhere, without the caller having to wait for them, and once
+ * every file in it has been written a callback is told of its mark.
+ */
+
+#include <stdint.h>
+#include <stdatomic.h>
+#include <pthread.h>
+
+#include <libslink.h>
+
+#include "metrics.h"
+
+typedef struct state_file_s {
+	char *path;
+	char *snapshot; /* waiting to be written */
+	size_t length;
+	size_t size;
+	int dirty;
+	int held; /* part of a save waiting on state_release */
+	int round; /* part of the save in progress */
+} state_file_t;
+
+/* a one off file, written in turn */
+typedef struct state_item_s {
+	char *path;
+	char *data;
+	size_t length;
+	struct state_item_s *next;
+} state_item_t;
+
+typedef struct state_s {
+	state_file_t *files;
+	int nfiles;
+
+	char *buffer; /* being written, owned by the thread */
+	size_t size;
+
+	state_item_t *items; /* oldest first */
+	state_item_t *last;
+	state_item_t *writing; /* taken off the list by the thread */
+
+	int busy; /* a file is being written */
+	int stop;
+
+	/* a save held back until the records it covers are safe, then written in full */
+	int holding;
+	uint64_t mark;
+	int pending; /* files in the save still to be written */
+	int spoiled; /* and any that could not be */
+	void (*done)(void *data, uint64_t mark);
+	void *data;
+
+	pthread_t thread;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+
+	atomic_ulong saved;
+	atomic_ulong failed;
+	metrics_histogram_t writes;
+} state_t;
+
+extern int state_start(state_t *state, int nfiles, void (*done)(void *data, uint64_t mark), void *data);
+extern int state_file(state_t *state, int index, const char *path);
+extern int state_save(state_t *state, int index, SLCD *slconn);
+extern int state_copy(state_t *state, int index, const char *data, size_t length);
+extern int state_put(state_t *state, const char *path, const char *data, size_t length);
+extern void state_wait(state_t *state, const char *path);
+extern int state_begin(state_t *state, uint64_t mark);
+extern int state_held(state_t *state, uint64_t *mark);
+extern int state_ready(state_t *state);
+extern void state_release(state_t *state);
+
+extern long state_text(SLCD *slconn, char **buffer, size_t *size, size_t length);
+extern int state_write(const char *path, const char *data, size_t length);
+extern void state_flush(state_t *state);
+extern void state_stop(state_t *state);
+
+#endif /* _STATE_H */
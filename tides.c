@@ -0,0 +1,175 @@
+/*
+ * Copyright (c) 2014 Institute of Geological & Nuclear Sciences Ltd.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *		notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *		notice, this list of conditions and the following disclaimer in the
+ *		documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+/* system includes */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <libmseed.h>
+#include <libcrex.h>
+
+#include "tides.h"
+
+static unsigned int tides_hash(const void *p, size_t len, unsigned int h) {
+	const unsigned char *c = (const unsigned char *) p;
+
+	while (len-- > 0) {
+		h ^= *c++;
+		h *= 16777619U;
+	}
+
+	return h;
+}
+
+static unsigned int tides_key(const crex_tidal_t *tidal) {
+	unsigned int h = 2166136261U;
+	int n;
+
+	h = tides_hash(&tidal->latitude, sizeof(tidal->latitude), h);
+	h = tides_hash(&tidal->zone, sizeof(tidal->zone), h);
+	h = tides_hash(&tidal->num_tides, sizeof(tidal->num_tides), h);
+	for (n = 0; n < tidal->num_tides; n++) {
+		h = tides_hash(tidal->tides[n].name, strlen(tidal->tides[n].name), h);
+		h = tides_hash(&tidal->tides[n].amplitude, sizeof(tidal->tides[n].amplitude), h);
+		h = tides_hash(&tidal->tides[n].lag, sizeof(tidal->tides[n].lag), h);
+	}
+
+	return h;
+}
+
+static int tides_equal(const crex_tidal_t *a, const crex_tidal_t *b) {
+	int n;
+
+	if ((a->latitude != b->latitude) || (a->zone != b->zone) || (a->num_tides != b->num_tides))
+		return 0;
+	for (n = 0; n < a->num_tides; n++) {
+		if ((strcmp(a->tides[n].name, b->tides[n].name) != 0) || (a->tides[n].amplitude != b->tides[n].amplitude) || (a->tides[n].lag != b->tides[n].lag))
+			return 0;
+	}
+
+	return 1;
+}
+
+/* drop the least recently used idle sets beyond the limit, must hold the lock */
+static void tides_evict(tides_t *tides) {
+	tides_set_t *set, **prev, **oldest;
+	int idle;
+
+	for (;;) {
+		idle = 0; oldest = NULL;
+		for (prev = &tides->sets; (set = *prev) != NULL; prev = &set->next) {
+			if (set->refs > 0)
+				continue;
+			idle++;
+			if ((oldest == NULL) || (set->used < (*oldest)->used))
+				oldest = prev;
+		}
+		if (idle <= tides->maxidle)
+			break;
+
+		set = *oldest; *oldest = set->next;
+		free((char *) set);
+		tides->nsets--;
+		tides->evictions++;
+	}
+}
+
+void tides_init(tides_t *tides, int maxidle) {
+	memset(tides, 0, sizeof(tides_t));
+	tides->maxidle = maxidle;
+	pthread_mutex_init(&tides->lock, NULL);
+}
+
+void tides_free(tides_t *tides) {
+	tides_set_t *set;
+
+	while ((set = tides->sets) != NULL) {
+		tides->sets = set->next;
+		free((char *) set);
+	}
+	pthread_mutex_destroy(&tides->lock);
+}
+
+/* the shared copy of a tidal configuration, adding one if it is new */
+crex_tidal_t *tides_get(tides_t *tides, const crex_tidal_t *tidal) {
+	tides_set_t *set;
+	unsigned int hash = tides_key(tidal);
+
+	pthread_mutex_lock(&tides->lock);
+
+	for (set = tides->sets; set != NULL; set = set->next) {
+		if ((set->hash == hash) && (tides_equal(&set->tidal, tidal)))
+			break;
+	}
+
+	if (set != NULL) {
+		tides->shared++;
+	}
+	else if ((set = (tides_set_t *) malloc(sizeof(tides_set_t))) != NULL) {
+		memcpy(&set->tidal, tidal, sizeof(crex_tidal_t));
+		set->hash = hash;
+		set->refs = 0;
+		set->next = tides->sets;
+		tides->sets = set;
+		tides->nsets++;
+		tides->created++;
+	}
+
+	if (set != NULL) {
+		set->refs++;
+		set->used = ++tides->clock;
+	}
+
+	pthread_mutex_unlock(&tides->lock);
+
+	return (set != NULL) ? &set->tidal : NULL;
+}
+
+/* release a shared configuration, once unused it becomes a candidate for eviction */
+void tides_put(tides_t *tides, crex_tidal_t *tidal) {
+	tides_set_t *set;
+
+	if (tidal == NULL)
+		return;
+
+	pthread_mutex_lock(&tides->lock);
+	for (set = tides->sets; set != NULL; set = set->next) {
+		if (&set->tidal == tidal) {
+			set->refs--;
+			set->used = ++tides->clock;
+			break;
+		}
+	}
+	tides_evict(tides);
+	pthread_mutex_unlock(&tides->lock);
+}
+
+void tides_log(tides_t *tides) {
+	pthread_mutex_lock(&tides->lock);
+	ms_log (0, "tidal sets: %d, shared=%lu created=%lu evictions=%lu\n", tides->nsets, tides->shared, tides->created, tides->evictions);
+	pthread_mutex_unlock(&tides->lock);
+}
@@ -0,0 +1,71 @@
+/*
+ * Copyright (c) 2014 Institute of Geological & Nuclear Sciences Ltd.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *		notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *		notice, this list of conditions and the following disclaimer in the
+ *		documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#ifndef _TIDES_H
+#define _TIDES_H
+
+/*
+ * tides: share one crex_tidal_t between every stream using the same
+ * constituents, latitude and zone, keeping a bounded number of unused
+ * sets around in case they are wanted again. Only the configuration is
+ * shared, tidal predictions are not cached, and each processing thread
+ * keeps its own sets.
+ *
+ */
+
+#include <pthread.h>
+
+#include <libcrex.h>
+
+typedef struct tides_set_s {
+	crex_tidal_t tidal;
+	unsigned int hash;
+	int refs;
+	unsigned long used; /* last use, for eviction */
+	struct tides_set_s *next;
+} tides_set_t;
+
+typedef struct tides_s {
+	tides_set_t *sets;
+	int nsets;
+	int maxidle; /* unreferenced sets to keep */
+	unsigned long clock;
+
+	unsigned long shared; /* streams given an existing set */
+	unsigned long created;
+	unsigned long evictions;
+
+	pthread_mutex_t lock;
+} tides_t;
+
+extern void tides_init(tides_t *tides, int maxidle);
+extern void tides_free(tides_t *tides);
+
+extern crex_tidal_t *tides_get(tides_t *tides, const crex_tidal_t *tidal);
+extern void tides_put(tides_t *tides, crex_tidal_t *tidal);
+extern void tides_log(tides_t *tides);
+
+#endif /* _TIDES_H */
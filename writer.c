@@ -0,0 +1,557 @@
+/*
+ * Copyright (c) 2014 Institute of Geological & Nuclear Sciences Ltd.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *		notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *		notice, this list of conditions and the following disclaimer in the
+ *		documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+/* system includes */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+
+#include <libmseed.h>
+#include <libdali.h>
+
+#include "writer.h"
+
+static hptime_t writer_now(void) {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (hptime_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static void writer_max(atomic_ulong *value, unsigned long v) {
+	unsigned long m = atomic_load(value);
+
+	while ((v > m) && (!atomic_compare_exchange_weak(value, &m, v)))
+		;
+}
+
+static void writer_wait(writer_t *writer) {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_REALTIME, &ts);
+	ts.tv_nsec += 100000000L;
+	if (ts.tv_nsec >= 1000000000L) {
+		ts.tv_sec++; ts.tv_nsec -= 1000000000L;
+	}
+	(void) pthread_cond_timedwait(&writer->cond, &writer->lock, &ts);
+}
+
+static void writer_signal(writer_t *writer) {
+	pthread_mutex_lock(&writer->lock);
+	pthread_cond_broadcast(&writer->cond);
+	pthread_mutex_unlock(&writer->lock);
+}
+
+/* drop and re-establish the server connection, unless aborted */
+static int writer_reconnect(writer_t *writer) {
+	uint64_t start = metrics_now();
+	int n;
+
+	while (!atomic_load(&writer->abort)) {
+		if (writer->verbose)
+			ms_log (1, "re-connecting to datalink server\n");
+		if (writer->dlconn->link != -1)
+			dl_disconnect(writer->dlconn);
+		if (dl_connect(writer->dlconn) >= 0) {
+			metrics_observe(&writer->stats.reconnects, metrics_now() - start);
+			return 0;
+		}
+		ms_log (2, "error re-connecting to datalink server, sleeping 10 seconds\n");
+		for (n = 0; (n < 10) && (!atomic_load(&writer->abort)); n++)
+			sleep (1);
+	}
+
+	return -1;
+}
+
+/* records that could not be sent */
+static void writer_dropped(writer_t *writer, unsigned long count) {
+	atomic_fetch_add(&writer->stats.dropped, count);
+	if (atomic_load(&writer->abort))
+		atomic_fetch_add(&writer->abandoned, count);
+	atomic_fetch_add(&writer->settled, count);
+}
+
+static void writer_written(writer_t *writer, writer_entry_t *entry) {
+	hptime_t latency = writer_now() - entry->queued;
+
+	if (writer->journal != NULL) {
+		journal_release(writer->journal, entry->position);
+		if (writer->policy == WRITER_BLOCK)
+			writer_signal(writer);
+	}
+	atomic_fetch_add(&writer->settled, 1);
+
+	atomic_fetch_add(&writer->stats.written, 1);
+	atomic_fetch_add(&writer->stats.latency, (unsigned long) latency);
+	writer_max(&writer->stats.maxlatency, (unsigned long) latency);
+	metrics_observe(&writer->stats.delays, (uint64_t) latency);
+}
+
+/* send one record, reconnecting as needed */
+static int writer_send(writer_t *writer, writer_entry_t *entry) {
+	uint64_t start = metrics_now();
+
+	while (dl_write (writer->dlconn, entry->record, entry->reclen, entry->streamid, entry->starttime, entry->endtime, writer->writeack) < 0) {
+		if (writer_reconnect(writer) < 0)
+			return -1;
+		start = metrics_now();
+	}
+	metrics_observe(&writer->stats.writes, metrics_now() - start);
+
+	writer_written(writer, entry);
+
+	return 0;
+}
+
+/* send a record requesting an acknowledgement, without waiting for it */
+static int writer_transmit(writer_t *writer, writer_entry_t *entry) {
+	uint64_t start = metrics_now();
+	char header[255];
+	int len, rc;
+
+	len = snprintf(header, sizeof(header), "WRITE %s %lld %lld A %d", entry->streamid,
+		(long long) entry->starttime, (long long) entry->endtime, entry->reclen);
+	if ((len < 0) || (len >= (int) sizeof(header)))
+		return -1;
+
+	if ((rc = dl_sendpacket(writer->dlconn, header, len, entry->record, entry->reclen, NULL, 0)) >= 0)
+		metrics_observe(&writer->stats.writes, metrics_now() - start);
+
+	return (rc < 0) ? -1 : 0;
+}
+
+/* read one acknowledgement, returns zero if none is waiting and not blocking */
+static int writer_reply(writer_t *writer, int block) {
+	char buf[255];
+	int64_t value;
+	int rc;
+
+	if ((rc = dl_recvheader(writer->dlconn, buf, sizeof(buf), (block) ? 1 : 0)) <= 0)
+		return rc;
+
+	if (dl_handlereply(writer->dlconn, buf, sizeof(buf), &value) != 0)
+		return -1;
+
+	return 1;
+}
+
+/* append an entry to the spill file, must hold the lock */
+static int writer_spill(writer_t *writer, writer_entry_t *entry) {
+	if ((fseek(writer->spill, 0L, SEEK_END) < 0) ||
+			(fwrite(entry, offsetof(writer_entry_t, record) + entry->reclen, 1, writer->spill) != 1)) {
+		ms_log (2, "error writing to spill file: %s\n", strerror(errno)); return -1;
+	}
+	writer->spillcount++;
+
+	return 0;
+}
+
+/* read back the oldest spilled entry, must hold the lock */
+static int writer_unspill(writer_t *writer, writer_entry_t *entry) {
+	size_t len = offsetof(writer_entry_t, record);
+	int rc = 0;
+
+	if ((fseek(writer->spill, writer->spillread, SEEK_SET) < 0) || (fread(entry, len, 1, writer->spill) != 1) ||
+			(entry->reclen < 0) || (entry->reclen > WRITER_MAX_RECLEN) || (fread(entry->record, entry->reclen, 1, writer->spill) != 1)) {
+		ms_log (2, "error reading spill file, discarding %lu records\n", writer->spillcount);
+		writer_dropped(writer, writer->spillcount);
+		writer->spillcount = 0;
+		rc = -1;
+	}
+	else {
+		writer->spillread += (long) (len + entry->reclen);
+		writer->spillcount--;
+	}
+
+	/* start the file afresh once it has been drained */
+	if (writer->spillcount == 0) {
+		fflush(writer->spill);
+		if (ftruncate(fileno(writer->spill), 0) < 0)
+			ms_log (2, "error truncating spill file: %s\n", strerror(errno));
+		writer->spillread = 0L;
+	}
+
+	return rc;
+}
+
+/* fetch the next record to send, in order, returns -1 once stopped and drained */
+static int writer_next(writer_t *writer, writer_entry_t *entry, int wait) {
+	const journal_entry_t *record;
+	unsigned long head, tail;
+	int rc = 0;
+
+	if (writer->journal != NULL) {
+		if ((record = journal_next(writer->journal, &entry->position)) != NULL) {
+			strcpy(entry->streamid, record->streamid);
+			entry->starttime = record->starttime;
+			entry->endtime = record->endtime;
+			entry->queued = record->queued;
+			entry->reclen = record->reclen;
+			memcpy(entry->record, (const char *) record + sizeof(journal_entry_t), record->reclen);
+			return 1;
+		}
+		pthread_mutex_lock(&writer->lock);
+		if (journal_unread(writer->journal) == 0) {
+			if (atomic_load(&writer->stop))
+				rc = -1;
+			else if (wait)
+				writer_wait(writer);
+		}
+		pthread_mutex_unlock(&writer->lock);
+		return rc;
+	}
+
+	for (;;) {
+		tail = atomic_load(&writer->tail);
+		head = atomic_load(&writer->head);
+
+		if (tail == head)
+			break;
+
+		/* copy out first, the producer may drop this slot while we look at it */
+		memcpy(entry, &writer->entries[tail % writer->depth], sizeof(writer_entry_t));
+		if (!atomic_compare_exchange_strong(&writer->tail, &tail, tail + 1))
+			continue;
+		if (writer->policy == WRITER_BLOCK)
+			writer_signal(writer);
+		return 1;
+	}
+
+	/* the ring is empty, anything spilled is next in order */
+	pthread_mutex_lock(&writer->lock);
+	if ((writer->spill != NULL) && (writer->spillcount > 0)) {
+		rc = (writer_unspill(writer, entry) == 0) ? 1 : 0;
+	}
+	else if (atomic_load(&writer->head) == atomic_load(&writer->tail)) {
+		if (atomic_load(&writer->stop))
+			rc = -1;
+		else if (wait)
+			writer_wait(writer);
+	}
+	pthread_mutex_unlock(&writer->lock);
+
+	return rc;
+}
+
+/*
+ * keep up to window records in flight, releasing each only once acknowledged,
+ * until then writer_reached counts them as outstanding and holds back any save
+ */
+static void writer_pipeline(writer_t *writer, writer_entry_t *inflight) {
+	int first = 0, count = 0;
+	int done = 0, idle, failed;
+	int n, rc;
+
+	for (;;) {
+		/* top up the window */
+		idle = 0; failed = 0;
+		while ((!done) && (count < writer->window)) {
+			if ((rc = writer_next(writer, &inflight[(first + count) % writer->window], (count == 0))) < 0)
+				done = 1;
+			if (rc <= 0) {
+				idle = 1; break;
+			}
+			count++;
+			if (writer_transmit(writer, &inflight[(first + count - 1) % writer->window]) < 0) {
+				failed = 1; break;
+			}
+		}
+
+		if (count == 0) {
+			if (done)
+				break;
+			continue;
+		}
+
+		/* collect acks, only waiting when there is nothing else to do */
+		while ((!failed) && (count > 0)) {
+			if ((rc = writer_reply(writer, (idle || (count == writer->window)))) < 0) {
+				failed = 1; break;
+			}
+			if (rc == 0)
+				break;
+			writer_written(writer, &inflight[first]);
+			first = (first + 1) % writer->window; count--;
+			idle = 0;
+		}
+
+		/* resend everything not yet acknowledged */
+		while (failed) {
+			if (writer_reconnect(writer) < 0) {
+				/* a journal keeps them for the next run */
+				if (writer->journal == NULL)
+					writer_dropped(writer, (unsigned long) count);
+				first = 0; count = 0;
+				break;
+			}
+			for (failed = 0, n = 0; (!failed) && (n < count); n++)
+				failed = (writer_transmit(writer, &inflight[(first + n) % writer->window]) < 0);
+			atomic_fetch_add(&writer->stats.replayed, n);
+		}
+	}
+}
+
+static void *writer_thread(void *arg) {
+	writer_t *writer = (writer_t *) arg;
+	writer_entry_t *entry;
+	int rc;
+
+	if ((entry = (writer_entry_t *) malloc(writer->window * sizeof(writer_entry_t))) == NULL) {
+		ms_log (2, "memory error!\n"); return NULL;
+	}
+
+	if (writer->window > 1) {
+		writer_pipeline(writer, entry);
+	}
+	else {
+		while ((rc = writer_next(writer, entry, 1)) >= 0) {
+			if ((rc > 0) && (writer_send(writer, entry) < 0) && (writer->journal == NULL))
+				writer_dropped(writer, 1);
+		}
+	}
+
+	free((char *) entry);
+
+	return NULL;
+}
+
+int writer_policy(const char *name) {
+	if (strcmp(name, "block") == 0)
+		return WRITER_BLOCK;
+	if (strcmp(name, "drop") == 0)
+		return WRITER_DROP;
+	if (strcmp(name, "spill") == 0)
+		return WRITER_SPILL;
+	return -1;
+}
+
+int writer_start(writer_t *writer, DLCP *dlconn, int depth, int policy, const char *spillfile, journal_t *journal, int writeack, int window, int verbose) {
+	memset(writer, 0, sizeof(writer_t));
+
+	writer->dlconn = dlconn;
+	writer->depth = (depth > 0) ? (unsigned long) depth : 1UL;
+	writer->policy = policy;
+	writer->journal = journal;
+	writer->writeack = writeack;
+	writer->window = ((writeack) && (window > 1)) ? window : 1;
+	writer->verbose = verbose;
+
+	if ((writer->entries = (writer_entry_t *) calloc(writer->depth, sizeof(writer_entry_t))) == NULL) {
+		ms_log (2, "memory error!\n"); return -1;
+	}
+
+	if ((policy == WRITER_SPILL) && (journal == NULL)) {
+		writer->spill = (spillfile != NULL) ? fopen(spillfile, "w+b") : tmpfile();
+		if (writer->spill == NULL) {
+			ms_log (2, "unable to open spill file [%s]: %s\n", (spillfile) ? spillfile : "<tmp>", strerror(errno)); return -1;
+		}
+	}
+
+	pthread_mutex_init(&writer->lock, NULL);
+	pthread_cond_init(&writer->cond, NULL);
+
+	if (pthread_create(&writer->thread, NULL, writer_thread, writer) != 0) {
+		ms_log (2, "unable to start datalink writer thread\n"); return -1;
+	}
+
+	return 0;
+}
+
+/* add a record to the journal, a full journal either blocks or drops the record */
+static int writer_append(writer_t *writer, char *record, int reclen, char *streamid, hptime_t starttime, hptime_t endtime) {
+	uint64_t pending;
+	int rc;
+
+	while ((rc = journal_append(writer->journal, streamid, starttime, endtime, writer_now(), record, reclen)) > 0) {
+		if ((writer->policy != WRITER_BLOCK) || (atomic_load(&writer->abort))) {
+			atomic_fetch_add(&writer->stats.dropped, 1); return -1;
+		}
+		pthread_mutex_lock(&writer->lock);
+		writer_wait(writer);
+		pthread_mutex_unlock(&writer->lock);
+	}
+	if (rc < 0) {
+		atomic_fetch_add(&writer->stats.dropped, 1); return -1;
+	}
+
+	pending = journal_pending(writer->journal);
+	atomic_fetch_add(&writer->stats.queued, 1);
+	writer_max(&writer->stats.maxdepth, (unsigned long) pending);
+
+	writer_signal(writer);
+
+	return 0;
+}
+
+/* queue a record, only ever called from the collection thread */
+int writer_push(writer_t *writer, char *record, int reclen, char *streamid, hptime_t starttime, hptime_t endtime) {
+	writer_entry_t *entry;
+	unsigned long head, tail;
+
+	if ((reclen < 0) || (reclen > WRITER_MAX_RECLEN)) {
+		ms_log (2, "record too large to queue: %d\n", reclen); return -1;
+	}
+
+	if (writer->journal != NULL)
+		return writer_append(writer, record, reclen, streamid, starttime, endtime);
+
+	head = atomic_load(&writer->head);
+
+	for (;;) {
+		tail = atomic_load(&writer->tail);
+
+		/* keep order, once spilling everything is spilled until drained */
+		if (writer->policy == WRITER_SPILL) {
+			pthread_mutex_lock(&writer->lock);
+			if ((writer->spillcount > 0) || (head - tail >= writer->depth)) {
+				writer_entry_t spill;
+
+				strncpy(spill.streamid, streamid, WRITER_STREAMID - 1);
+				spill.streamid[WRITER_STREAMID - 1] = '\0';
+				spill.starttime = starttime;
+				spill.endtime = endtime;
+				spill.queued = writer_now();
+				spill.reclen = reclen;
+				memcpy(spill.record, record, reclen);
+
+				if (writer_spill(writer, &spill) < 0)
+					atomic_fetch_add(&writer->stats.dropped, 1);
+				else
+					atomic_fetch_add(&writer->stats.spilled, 1);
+				pthread_cond_broadcast(&writer->cond);
+				pthread_mutex_unlock(&writer->lock);
+				return 0;
+			}
+			pthread_mutex_unlock(&writer->lock);
+			break;
+		}
+
+		if (head - tail < writer->depth)
+			break;
+
+		if (writer->policy == WRITER_DROP) {
+			/* the consumer notices a lost race on the tail and discards its copy */
+			if (atomic_compare_exchange_strong(&writer->tail, &tail, tail + 1))
+				writer_dropped(writer, 1);
+			continue;
+		}
+
+		if (atomic_load(&writer->abort)) {
+			atomic_fetch_add(&writer->stats.dropped, 1); return -1;
+		}
+
+		pthread_mutex_lock(&writer->lock);
+		if (head - atomic_load(&writer->tail) >= writer->depth)
+			writer_wait(writer);
+		pthread_mutex_unlock(&writer->lock);
+	}
+
+	entry = &writer->entries[head % writer->depth];
+	strncpy(entry->streamid, streamid, WRITER_STREAMID - 1);
+	entry->streamid[WRITER_STREAMID - 1] = '\0';
+	entry->starttime = starttime;
+	entry->endtime = endtime;
+	entry->queued = writer_now();
+	entry->reclen = reclen;
+	memcpy(entry->record, record, reclen);
+
+	atomic_store(&writer->head, head + 1);
+	atomic_fetch_add(&writer->stats.queued, 1);
+	writer_max(&writer->stats.maxdepth, head + 1 - atomic_load(&writer->tail));
+
+	/* only wake the writer if it may be asleep */
+	if (head == atomic_load(&writer->tail))
+		writer_signal(writer);
+
+	return 0;
+}
+
+/*
+ * a mark for every record taken in so far, whether queued or spilled, for
+ * holding back a save of the positions they came from
+ */
+unsigned long writer_mark(writer_t *writer) {
+	return atomic_load(&writer->stats.queued) + atomic_load(&writer->stats.spilled);
+}
+
+/*
+ * have the records up to a mark all been written, and acknowledged when asked
+ * for, or dropped by policy, so a position saved now does not cover records
+ * still in the ring, the spill file or in flight. Records are sent in order,
+ * any given up on when aborted leave every mark short. Never blocks.
+ */
+int writer_reached(writer_t *writer, unsigned long mark) {
+	if (writer->journal != NULL)
+		return 1;
+
+	return ((atomic_load(&writer->settled) >= mark) && (atomic_load(&writer->abandoned) == 0)) ? 1 : 0;
+}
+
+/* stop waiting on the server, safe to call from a signal handler */
+void writer_abort(writer_t *writer) {
+	atomic_store(&writer->abort, 1);
+}
+
+/* drain the queue and release resources */
+void writer_stop(writer_t *writer) {
+	atomic_store(&writer->stop, 1);
+	writer_signal(writer);
+
+	pthread_join(writer->thread, NULL);
+
+	if (writer->spill != NULL)
+		fclose(writer->spill);
+
+	pthread_cond_destroy(&writer->cond);
+	pthread_mutex_destroy(&writer->lock);
+
+	free((char *) writer->entries);
+	writer->entries = NULL;
+}
+
+unsigned long writer_depth(writer_t *writer) {
+	if (writer->journal != NULL)
+		return (unsigned long) journal_pending(writer->journal);
+	return atomic_load(&writer->head) - atomic_load(&writer->tail);
+}
+
+void writer_log(writer_t *writer) {
+	unsigned long written = atomic_load(&writer->stats.written);
+
+	ms_log (0, "datalink writer: queued=%lu written=%lu dropped=%lu spilled=%lu replayed=%lu depth=%lu maxdepth=%lu latency=%.3fs maxlatency=%.3fs\n",
+		atomic_load(&writer->stats.queued), written, atomic_load(&writer->stats.dropped),
+		atomic_load(&writer->stats.spilled), atomic_load(&writer->stats.replayed), writer_depth(writer), atomic_load(&writer->stats.maxdepth),
+		(written > 0) ? (double) atomic_load(&writer->stats.latency) / (double) written / 1.0e6 : 0.0,
+		(double) atomic_load(&writer->stats.maxlatency) / 1.0e6);
+	if (writer->journal != NULL)
+		ms_log (0, "datalink journal: pending=%llu bytes, skipped=%llu already delivered\n",
+			(unsigned long long) journal_pending(writer->journal), (unsigned long long) writer->journal->skipped);
+}
@@ -0,0 +1,124 @@
+/*
+ * Copyright (c) 2014 Institute of Geological & Nuclear Sciences Ltd.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *		notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *		notice, this list of conditions and the following disclaimer in the
+ *		documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#ifndef _WRITER_H
+#define _WRITER_H
+
+/*
+ * writer: hand packed records to a datalink server from a dedicated
+ * thread so that seedlink collection is never held up by the server.
+ *
+ */
+
+#include <stdio.h>
+#include <stdatomic.h>
+#include <pthread.h>
+
+#include <libmseed.h>
+#include <libdali.h>
+
+#include "journal.h"
+#include "metrics.h"
+
+#define WRITER_MAX_RECLEN 4096 /* largest record that can be queued */
+#define WRITER_STREAMID 100
+
+/* what to do when the queue is full */
+#define WRITER_BLOCK 0
+#define WRITER_DROP 1
+#define WRITER_SPILL 2
+
+typedef struct writer_entry_s {
+	char streamid[WRITER_STREAMID];
+	hptime_t starttime;
+	hptime_t endtime;
+	hptime_t queued; /* monotonic, for latency */
+	uint64_t position; /* journal position to release once written */
+	int reclen;
+	char record[WRITER_MAX_RECLEN];
+} writer_entry_t;
+
+typedef struct writer_stats_s {
+	atomic_ulong queued;
+	atomic_ulong written;
+	atomic_ulong dropped;
+	atomic_ulong spilled;
+	atomic_ulong replayed; /* resent after a reconnect */
+	atomic_ulong maxdepth;
+	atomic_ulong latency; /* total, microseconds */
+	atomic_ulong maxlatency;
+
+	metrics_histogram_t delays; /* queued to written */
+	metrics_histogram_t writes; /* each send to the server */
+	metrics_histogram_t reconnects;
+} writer_stats_t;
+
+typedef struct writer_s {
+	DLCP *dlconn;
+	int writeack;
+	int window; /* acknowledgements outstanding at once */
+	int policy;
+	int verbose;
+
+	/* single producer, single consumer ring */
+	writer_entry_t *entries;
+	unsigned long depth;
+	atomic_ulong head; /* next slot to fill, producer only */
+	atomic_ulong tail; /* next slot to send, consumer, or producer when dropping */
+
+	/* optional persistent queue, used in place of the ring */
+	journal_t *journal;
+
+	/* overflow records, kept in arrival order */
+	FILE *spill;
+	long spillread;
+	unsigned long spillcount;
+
+	pthread_t thread;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+
+	atomic_int abort; /* give up waiting, set on termination signals */
+	atomic_int stop; /* drain and exit */
+
+	/* records taken in, and those since written, acknowledged or dropped */
+	atomic_ulong settled;
+	atomic_ulong abandoned; /* given up on when aborted */
+
+	writer_stats_t stats;
+} writer_t;
+
+extern int writer_policy(const char *name);
+extern int writer_start(writer_t *writer, DLCP *dlconn, int depth, int policy, const char *spillfile, journal_t *journal, int writeack, int window, int verbose);
+extern int writer_push(writer_t *writer, char *record, int reclen, char *streamid, hptime_t starttime, hptime_t endtime);
+extern unsigned long writer_mark(writer_t *writer);
+extern int writer_reached(writer_t *writer, unsigned long mark);
+extern void writer_abort(writer_t *writer);
+extern void writer_stop(writer_t *writer);
+extern unsigned long writer_depth(writer_t *writer);
+extern void writer_log(writer_t *writer);
+
+#endif /* _WRITER_H */